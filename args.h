@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+// Options are passed as "--name=value" (or bare "--name" for flags) and may be
+// mixed with the positional arguments in any order.
+
+static inline const char* arg_value(int argc, char** argv, const char* name) {
+    size_t len = strlen(name);
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) == 0 && strncmp(argv[i] + 2, name, len) == 0 &&
+            argv[i][2 + len] == '=') {
+            return argv[i] + 3 + len;
+        }
+    }
+    return NULL;
+}
+
+static inline int arg_flag(int argc, char** argv, const char* name) {
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) == 0 && strcmp(argv[i] + 2, name) == 0) {
+            return 1;
+        }
+    }
+    return arg_value(argc, argv, name) != NULL;
+}
+
+static inline long long arg_long(int argc, char** argv, const char* name, long long def) {
+    const char* value = arg_value(argc, argv, name);
+    return value ? atoll(value) : def;
+}
+
+static inline double arg_double(int argc, char** argv, const char* name, double def) {
+    const char* value = arg_value(argc, argv, name);
+    return value ? atof(value) : def;
+}
+
+static inline const char* arg_string(int argc, char** argv, const char* name, const char* def) {
+    const char* value = arg_value(argc, argv, name);
+    return value ? value : def;
+}
+
+// Returns the index-th argument that is not an option, or NULL.
+static inline const char* arg_positional(int argc, char** argv, int index) {
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) == 0) {
+            continue;
+        }
+        if (index-- == 0) {
+            return argv[i];
+        }
+    }
+    return NULL;
+}
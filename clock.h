@@ -1,6 +1,13 @@
 #pragma once
 
+#include "args.h"
+#include "counters.h"
+
 #include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 struct MyClock {
     double startTime;
@@ -18,3 +25,316 @@ static inline void clock_stop(struct MyClock* clock) {
 static inline double clock_elapsed(const struct MyClock* clock) {
     return clock->endTime - clock->startTime;
 }
+
+// Named phases, the same set in every program so that the breakdowns of the
+// three tasks compare:
+//   distribute - getting the inputs to the ranks (scatter, local generation,
+//                file read, claiming work)
+//   broadcast  - replicating data: x, SUMMA panels, 2.5D layers
+//   skew       - Cannon's initial alignment of the blocks
+//   compute    - local arithmetic
+//   shift      - Cannon's per-step block shifts (pipelined: the unhidden wait)
+//   halo       - neighbour exchange of the sparse x
+//   reduce     - summing partial results
+//   gather     - collecting results on a root
+// A phase may run inside another one (the 2.5D broadcast is part of the
+// distribution); each one counts its own start/stop pairs.
+enum Phase {
+    PHASE_DISTRIBUTE,
+    PHASE_BROADCAST,
+    PHASE_SKEW,
+    PHASE_COMPUTE,
+    PHASE_SHIFT,
+    PHASE_HALO,
+    PHASE_REDUCE,
+    PHASE_GATHER,
+    PHASE_COUNT
+};
+
+static const char* const phase_names[PHASE_COUNT] = {"distribute", "broadcast", "skew", "compute",
+                                                     "shift",      "halo",      "reduce", "gather"};
+
+struct PhaseTimers {
+    double seconds[PHASE_COUNT];
+    long long calls[PHASE_COUNT];
+    double started[PHASE_COUNT];
+    long long counts[PHASE_COUNT][COUNTER_COUNT]; // with --counters, see counters.h
+    long long counts_started[PHASE_COUNT][COUNTER_COUNT];
+    double flops[PHASE_COUNT]; // analytic, from phase_work
+    double bytes[PHASE_COUNT];
+};
+
+static inline void phase_start(struct PhaseTimers* timers, enum Phase phase) {
+    if (counters.enabled) {
+        counters_read(timers->counts_started[phase]);
+    }
+    timers->started[phase] = MPI_Wtime();
+}
+
+static inline void phase_stop(struct PhaseTimers* timers, enum Phase phase) {
+    timers->seconds[phase] += MPI_Wtime() - timers->started[phase];
+    timers->calls[phase]++;
+    if (counters.enabled) {
+        long long now[COUNTER_COUNT];
+        counters_read(now);
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            timers->counts[phase][c] += now[c] - timers->counts_started[phase][c];
+        }
+    }
+}
+
+// Charges a kernel's floating point operations and the bytes it has to move
+// to or from memory (each input read once, each output written once) to the
+// phase, for the GFLOP/s, GB/s and arithmetic intensity of the report
+static inline void phase_work(struct PhaseTimers* timers, enum Phase phase, double flops, double bytes) {
+    timers->flops[phase] += flops;
+    timers->bytes[phase] += bytes;
+}
+
+// y = A·X for a rows x cols block of A and K vectors
+static inline void phase_work_matvec(struct PhaseTimers* timers, enum Phase phase, long long rows, long long cols,
+                                     int vectors, size_t elem_size, size_t acc_size) {
+    phase_work(timers, phase, 2.0 * rows * cols * vectors,
+               (double)(rows * cols + cols * vectors) * elem_size + (double)rows * vectors * acc_size);
+}
+
+// Collective over comm. Rank 0 prints the run as one JSON line:
+//   {"program": "...", "ranks": P, "time": T, "result": {...}, "info": {...},
+//    "samples": [t, ...],
+//    "phases": {"compute": {"calls": C, "min": s, "mean": s, "max": s,
+//                           "imbalance": max / mean}, ...}}
+// time is the program's own measured region. result and info are JSON
+// members without the braces (info may be NULL); result holds the fields the
+// harness writes to its csv, in csv order. samples (read on rank 0, left out
+// when count is 0) are the times of the individual repetitions time
+// summarizes. min/mean/max are over the ranks, calls the largest count on a
+// rank; phases no rank started are left out. A phase with phase_work adds
+//   "flops": F, "bytes": B, "gflops": F / max, "gbs": B / max, "intensity": F / B
+// (F and B summed over the ranks), and with --counters
+//   "counters": {"cycles": ..., "ipc": ..., "llc_gbs": ...}
+// with the counters summed over the ranks.
+static inline void phases_report(const char* program, double time, const char* result, const char* info,
+                                 const struct PhaseTimers* timers, const double* samples, int count,
+                                 MPI_Comm comm) {
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    double min[PHASE_COUNT], max[PHASE_COUNT], sum[PHASE_COUNT], flops[PHASE_COUNT], bytes[PHASE_COUNT];
+    long long calls[PHASE_COUNT], counts[PHASE_COUNT][COUNTER_COUNT], counts_max[PHASE_COUNT][COUNTER_COUNT];
+    int counted;
+    MPI_Reduce(timers->seconds, min, PHASE_COUNT, MPI_DOUBLE, MPI_MIN, 0, comm);
+    MPI_Reduce(timers->seconds, max, PHASE_COUNT, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(timers->seconds, sum, PHASE_COUNT, MPI_DOUBLE, MPI_SUM, 0, comm);
+    MPI_Reduce(timers->calls, calls, PHASE_COUNT, MPI_LONG_LONG, MPI_MAX, 0, comm);
+    MPI_Reduce(timers->flops, flops, PHASE_COUNT, MPI_DOUBLE, MPI_SUM, 0, comm);
+    MPI_Reduce(timers->bytes, bytes, PHASE_COUNT, MPI_DOUBLE, MPI_SUM, 0, comm);
+    MPI_Reduce(timers->counts, counts, PHASE_COUNT * COUNTER_COUNT, MPI_LONG_LONG, MPI_SUM, 0, comm);
+    MPI_Reduce(timers->counts, counts_max, PHASE_COUNT * COUNTER_COUNT, MPI_LONG_LONG, MPI_MAX, 0, comm);
+    MPI_Reduce(&counters.enabled, &counted, 1, MPI_INT, MPI_MAX, 0, comm);
+    if (rank != 0) {
+        return;
+    }
+
+    printf("{\"program\": \"%s\", \"ranks\": %d, \"time\": %.9g, \"result\": {%s}", program, size, time, result);
+    if (info) {
+        printf(", \"info\": {%s}", info);
+    }
+    if (count > 0) {
+        printf(", \"samples\": [");
+        for (int i = 0; i < count; i++) {
+            printf("%s%.9g", i > 0 ? ", " : "", samples[i]);
+        }
+        printf("]");
+    }
+    printf(", \"phases\": {");
+    const char* separator = "";
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        if (calls[p] == 0) {
+            continue;
+        }
+        double mean = sum[p] / size;
+        printf("%s\"%s\": {\"calls\": %lld, \"min\": %.9g, \"mean\": %.9g, \"max\": %.9g, \"imbalance\": %.3f",
+               separator, phase_names[p], calls[p], min[p], mean, max[p], mean > 0 ? max[p] / mean : 1.0);
+        if (flops[p] > 0 || bytes[p] > 0) {
+            // All ranks' work over the phase's slowest rank
+            double seconds = max[p] > 0 ? max[p] : 1.0;
+            printf(", \"flops\": %.9g, \"bytes\": %.9g, \"gflops\": %.6g, \"gbs\": %.6g", flops[p], bytes[p],
+                   flops[p] / seconds * 1e-9, bytes[p] / seconds * 1e-9);
+            if (bytes[p] > 0) {
+                printf(", \"intensity\": %.6g", flops[p] / bytes[p]);
+            }
+        }
+        if (counted) {
+            // Summed over the ranks; the slowest rank's cycles for the imbalance
+            printf(", \"counters\": {");
+            const char* comma = "";
+            for (int c = 0; c < COUNTER_COUNT; c++) {
+                if (counts[p][c] > 0) {
+                    printf("%s\"%s\": %lld", comma, counter_names[c], counts[p][c]);
+                    comma = ", ";
+                }
+            }
+            long long* total = counts[p];
+            if (total[COUNTER_CYCLES] > 0 && total[COUNTER_INSTRUCTIONS] > 0) {
+                printf("%s\"ipc\": %.3f", comma, (double)total[COUNTER_INSTRUCTIONS] / total[COUNTER_CYCLES]);
+                comma = ", ";
+            }
+            if (total[COUNTER_CYCLES] > 0) {
+                printf("%s\"cycles_imbalance\": %.3f", comma,
+                       (double)counts_max[p][COUNTER_CYCLES] * size / total[COUNTER_CYCLES]);
+                comma = ", ";
+            }
+            if (total[COUNTER_LLC_REFERENCES] > 0 && total[COUNTER_LLC_MISSES] > 0) {
+                printf("%s\"llc_miss_rate\": %.4f", comma,
+                       (double)total[COUNTER_LLC_MISSES] / total[COUNTER_LLC_REFERENCES]);
+                comma = ", ";
+            }
+            if (total[COUNTER_LLC_MISSES] > 0 && max[p] > 0) {
+                printf("%s\"llc_gbs\": %.6g", comma,
+                       (double)total[COUNTER_LLC_MISSES] * COUNTER_LINE_BYTES / max[p] * 1e-9);
+            }
+            printf("}");
+        }
+        printf("}");
+        separator = ", ";
+    }
+    printf("}}\n");
+    fflush(stdout);
+}
+
+// In-process repetitions: "--reps=N" runs the measured region N times in one
+// job after "--warmup=W" unmeasured runs, so MPI start-up, allocation and data
+// distribution are paid once per launch rather than once per sample:
+//
+//   struct Reps reps;
+//   reps_init(&reps, argc, argv, &phases, comm);
+//   for (; reps_next(&reps); reps_stop(&reps)) {
+//       ... measured region ...
+//   }
+//   double time = reps_finish(&reps); // median, on rank 0
+//
+// Every rep starts with a barrier; with "--flush" each rank first streams
+// through a buffer twice the last-level cache, so no rep finds the previous
+// one's data in cache. A rep takes as long as its slowest rank. The phase
+// timers keep what was timed before the loop and get the average of the
+// measured reps for the phases inside it.
+
+// Flush buffer when the cache size is not reported
+#define REPS_FLUSH_BYTES (64 << 20)
+
+struct Reps {
+    int reps, warmup, flush;
+    int current; // counting the warmup reps
+    double* seconds; // measured reps, this rank
+    double* max_seconds; // over the ranks, on rank 0 after reps_finish
+    struct MyClock clock;
+    struct PhaseTimers* phases;
+    struct PhaseTimers before; // at the first rep
+    struct PhaseTimers measured; // at the first measured rep
+    MPI_Comm comm;
+};
+
+// 0 for a rep count below 1 or a negative warmup
+static inline int reps_init(struct Reps* r, int argc, char** argv, struct PhaseTimers* phases, MPI_Comm comm) {
+    memset(r, 0, sizeof(*r));
+    r->reps = (int)arg_long(argc, argv, "reps", 1);
+    r->warmup = (int)arg_long(argc, argv, "warmup", 0);
+    r->flush = arg_flag(argc, argv, "flush");
+    r->phases = phases;
+    r->comm = comm;
+    if (r->reps < 1 || r->warmup < 0) {
+        return 0;
+    }
+    r->seconds = (double*)calloc(r->reps, sizeof(double));
+    return 1;
+}
+
+// 1 when the options asked for more than the single measured run
+static inline int reps_requested(int argc, char** argv) {
+    return arg_value(argc, argv, "reps") || arg_value(argc, argv, "warmup") || arg_flag(argc, argv, "flush");
+}
+
+static inline void reps_flush_cache(void) {
+    static char* buffer;
+    static size_t bytes;
+    if (!buffer) {
+        long cache = 0;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+        cache = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+        bytes = cache > 0 ? 2 * (size_t)cache : REPS_FLUSH_BYTES;
+        buffer = (char*)malloc(bytes);
+    }
+    memset(buffer, (int)bytes, bytes);
+    volatile char sink = 0;
+    for (size_t i = 0; i < bytes; i += 64) {
+        sink += buffer[i];
+    }
+    (void)sink;
+}
+
+// Starts the next rep; 0 when all have run
+static inline int reps_next(struct Reps* r) {
+    if (r->current == r->warmup + r->reps) {
+        return 0;
+    }
+    if (r->flush) {
+        reps_flush_cache();
+    }
+    if (r->current == 0) {
+        r->before = *r->phases;
+    }
+    if (r->current == r->warmup) {
+        r->measured = *r->phases;
+    }
+    MPI_Barrier(r->comm);
+    clock_start(&r->clock);
+    return 1;
+}
+
+static inline void reps_stop(struct Reps* r) {
+    clock_stop(&r->clock);
+    if (r->current >= r->warmup) {
+        r->seconds[r->current - r->warmup] = clock_elapsed(&r->clock);
+    }
+    r->current++;
+}
+
+static inline int reps_compare(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Collective over the comm of reps_init. Averages the phases over the
+// measured reps and returns the median rep time on rank 0 (0 elsewhere);
+// max_seconds holds the reps in order for phases_report.
+static inline double reps_finish(struct Reps* r) {
+    struct PhaseTimers* t = r->phases;
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        t->seconds[p] = r->before.seconds[p] + (t->seconds[p] - r->measured.seconds[p]) / r->reps;
+        t->calls[p] = r->before.calls[p] + (t->calls[p] - r->measured.calls[p]) / r->reps;
+        t->flops[p] = r->before.flops[p] + (t->flops[p] - r->measured.flops[p]) / r->reps;
+        t->bytes[p] = r->before.bytes[p] + (t->bytes[p] - r->measured.bytes[p]) / r->reps;
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            t->counts[p][c] = r->before.counts[p][c] + (t->counts[p][c] - r->measured.counts[p][c]) / r->reps;
+        }
+    }
+    int rank;
+    MPI_Comm_rank(r->comm, &rank);
+    r->max_seconds = rank == 0 ? (double*)malloc(r->reps * sizeof(double)) : NULL;
+    MPI_Reduce(r->seconds, r->max_seconds, r->reps, MPI_DOUBLE, MPI_MAX, 0, r->comm);
+    if (rank != 0) {
+        return 0.0;
+    }
+    double* sorted = (double*)malloc(r->reps * sizeof(double));
+    memcpy(sorted, r->max_seconds, r->reps * sizeof(double));
+    qsort(sorted, r->reps, sizeof(double), reps_compare);
+    double median = r->reps % 2 ? sorted[r->reps / 2] : (sorted[r->reps / 2 - 1] + sorted[r->reps / 2]) / 2;
+    free(sorted);
+    return median;
+}
+
+static inline void reps_free(struct Reps* r) {
+    free(r->seconds);
+    free(r->max_seconds);
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "args.h"
+
+#include <mpi.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Optional hardware counters for the phase timers of clock.h. With
+// "--counters" every rank opens the events below for its own main thread
+// (Linux perf_event_open, user space only); phase_start/phase_stop then read
+// them and charge the difference to the phase. OpenMP workers are not
+// counted, so the counts are per rank only with one thread per rank.
+//
+// Each event is opened on its own: one the CPU or the kernel does not offer
+// (virtual machines, perf_event_paranoid > 2, non-Linux builds) is left out of
+// the report and the others still count. When the kernel multiplexes the
+// events, the counts are scaled by enabled / running time.
+//
+// Memory bandwidth comes from the LLC misses (one 64-byte line each): the
+// memory controller events are system-wide uncore counters that a rank cannot
+// attribute to itself.
+
+enum Counter {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_LLC_REFERENCES,
+    COUNTER_LLC_MISSES,
+    COUNTER_TASK_CLOCK, // nanoseconds on a CPU, a software event
+    COUNTER_COUNT
+};
+
+static const char* const counter_names[COUNTER_COUNT] = {"cycles", "instructions", "llc_references", "llc_misses",
+                                                         "task_clock_ns"};
+
+// Bytes charged for one LLC miss
+#define COUNTER_LINE_BYTES 64
+
+struct Counters {
+    int enabled;
+    int fds[COUNTER_COUNT]; // -1 when the event did not open
+};
+
+// One set per process, shared by all the phase timers of the rank
+static struct Counters counters = {0, {-1, -1, -1, -1, -1}};
+
+#ifdef __linux__
+static inline int counters_open_event(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+// Collective over comm. Opens the events if "--counters" was passed; rank 0
+// names the events no rank could open on stderr. Returns the number of events
+// open on this rank.
+static inline int counters_open(int argc, char** argv, MPI_Comm comm) {
+    if (!arg_flag(argc, argv, "counters")) {
+        return 0;
+    }
+    int opened = 0;
+#ifdef __linux__
+    static const uint32_t types[COUNTER_COUNT] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+                                                  PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE};
+    static const uint64_t configs[COUNTER_COUNT] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                    PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES,
+                                                    PERF_COUNT_SW_TASK_CLOCK};
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        counters.fds[c] = counters_open_event(types[c], configs[c]);
+        opened += counters.fds[c] >= 0;
+    }
+#endif
+    counters.enabled = opened > 0;
+
+    int open[COUNTER_COUNT], anywhere[COUNTER_COUNT], rank;
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        open[c] = counters.fds[c] >= 0;
+    }
+    MPI_Comm_rank(comm, &rank);
+    MPI_Reduce(open, anywhere, COUNTER_COUNT, MPI_INT, MPI_MAX, 0, comm);
+    if (rank == 0) {
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            if (!anywhere[c]) {
+                fprintf(stderr, "counters: %s is not available\n", counter_names[c]);
+            }
+        }
+    }
+    return opened;
+}
+
+// Current values, 0 for the events that are not open
+static inline void counters_read(long long values[COUNTER_COUNT]) {
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        values[c] = 0;
+#ifdef __linux__
+        uint64_t data[3]; // value, time enabled, time running
+        if (counters.fds[c] < 0 || read(counters.fds[c], data, sizeof(data)) != (ssize_t)sizeof(data)) {
+            continue;
+        }
+        values[c] = data[2] > 0 && data[2] < data[1] ? (long long)((double)data[0] * data[1] / data[2])
+                                                     : (long long)data[0];
+#endif
+    }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include "args.h"
+#include "matio.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Element types of the matvec programs, picked at run time with
+// "--dtype=NAME" (default int32). Every entry pairs the matrix/vector element
+// type with the type the products are accumulated (and y is stored) in:
+// int32 sums into int64 so large inputs do not overflow, the floating types
+// keep their own width so float32 halves the matrix traffic. The codes are
+// the matio.h ones, which also name the MPI datatypes.
+//
+// DTYPE_LIST(X) expands X(name, element type, accumulator type, element code,
+// accumulator code) once per entry; the programs use it to stamp out one
+// kernel per type, each compiled and vectorized for its own element width.
+
+#define DTYPE_LIST(X)                                             \
+    X(int32, int32_t, int64_t, MATIO_INT32, MATIO_INT64)          \
+    X(int64, int64_t, int64_t, MATIO_INT64, MATIO_INT64)          \
+    X(float32, float, float, MATIO_FLOAT32, MATIO_FLOAT32)        \
+    X(float64, double, double, MATIO_FLOAT64, MATIO_FLOAT64)
+
+#define DTYPE_ENUM(name, ...) DTYPE_##name,
+enum DtypeId { DTYPE_LIST(DTYPE_ENUM) DTYPE_COUNT };
+#undef DTYPE_ENUM
+
+struct Dtype {
+    int id;
+    const char* name;
+    uint32_t elem;
+    uint32_t acc;
+};
+
+#define DTYPE_ENTRY(name, T, A, elem, acc) {DTYPE_##name, #name, elem, acc},
+static const struct Dtype dtype_table[] = {DTYPE_LIST(DTYPE_ENTRY)};
+#undef DTYPE_ENTRY
+
+// NULL for an unknown name
+static inline const struct Dtype* dtype_select(int argc, char** argv) {
+    const char* name = arg_string(argc, argv, "dtype", "int32");
+    for (int i = 0; i < DTYPE_COUNT; i++) {
+        if (strcmp(dtype_table[i].name, name) == 0) {
+            return &dtype_table[i];
+        }
+    }
+    return NULL;
+}
+
+static inline size_t dtype_size(uint32_t code) {
+    return code == MATIO_INT64 || code == MATIO_FLOAT64 ? 8 : 4;
+}
+
+// buf[index] = value, for generators that compute one element at a time
+static inline void dtype_store(void* buf, size_t index, long long value, uint32_t code) {
+    switch (code) {
+    case MATIO_INT32:
+        ((int32_t*)buf)[index] = (int32_t)value;
+        break;
+    case MATIO_INT64:
+        ((int64_t*)buf)[index] = value;
+        break;
+    case MATIO_FLOAT32:
+        ((float*)buf)[index] = (float)value;
+        break;
+    case MATIO_FLOAT64:
+        ((double*)buf)[index] = (double)value;
+        break;
+    }
+}
+
+// buf[index] = value, truncated towards zero for the integer types
+static inline void dtype_store_real(void* buf, size_t index, double value, uint32_t code) {
+    switch (code) {
+    case MATIO_FLOAT32:
+        ((float*)buf)[index] = (float)value;
+        break;
+    case MATIO_FLOAT64:
+        ((double*)buf)[index] = value;
+        break;
+    default:
+        dtype_store(buf, index, (long long)value, code);
+        break;
+    }
+}
+
+// buf[index] as a double (exact for integers up to 2^53)
+static inline double dtype_load(const void* buf, size_t index, uint32_t code) {
+    switch (code) {
+    case MATIO_INT32:
+        return ((const int32_t*)buf)[index];
+    case MATIO_INT64:
+        return (double)((const int64_t*)buf)[index];
+    case MATIO_FLOAT32:
+        return ((const float*)buf)[index];
+    default:
+        return ((const double*)buf)[index];
+    }
+}
+
+// buf[i] = (first + i) % 5 + 1, the pattern of the matrices and vectors
+static inline void dtype_fill_pattern(void* buf, long long first, size_t n, uint32_t code) {
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < n; i++) {
+        dtype_store(buf, i, (first + (long long)i) % 5 + 1, code);
+    }
+}
+
+// Checksum of n elements. The programs' inputs are small integers, so the
+// sums are exact in a double for every type.
+static inline double dtype_sum(const void* buf, size_t n, uint32_t code) {
+    double sum = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        switch (code) {
+        case MATIO_INT32:
+            sum += ((const int32_t*)buf)[i];
+            break;
+        case MATIO_INT64:
+            sum += (double)((const int64_t*)buf)[i];
+            break;
+        case MATIO_FLOAT32:
+            sum += ((const float*)buf)[i];
+            break;
+        case MATIO_FLOAT64:
+            sum += ((const double*)buf)[i];
+            break;
+        }
+    }
+    return sum;
+}
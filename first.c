@@ -1,73 +1,369 @@
+#include "args.h"
 #include "clock.h"
+#include "hybrid.h"
+#include "montecarlo.h"
+#include "schedule.h"
 
+#include <math.h>
 #include <mpi.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 
-long long countIns(long long pointsNumber)
+// Points [first, first + size) of one chunk; threads split the chunk the
+// same way the static schedule splits the total between ranks
+long long CountChunk(const struct PiKernel *kernel, uint64_t seed, long long first, long long size)
 {
-    long long inCircle = 0;
-    for (long long i = 0; i < pointsNumber; ++i)
+    long long ins = 0;
+#pragma omp parallel reduction(+ : ins)
     {
-        long double x = (long double)rand() / RAND_MAX * 2.0 - 1.0;
-        long double y = (long double)rand() / RAND_MAX * 2.0 - 1.0;
-        if (x * x + y * y <= 1)
+        long long threadSize = size / hybrid_team_size();
+        long long threadFirst = first + hybrid_thread_id() * threadSize;
+        if (hybrid_thread_id() == hybrid_team_size() - 1)
         {
-            ++inCircle;
+            threadSize += size % hybrid_team_size();
+        }
+        ins = countIns(kernel, seed, threadFirst, threadSize);
+    }
+    return ins;
+}
+
+// Running totals of one rank in the target-precision mode: rounds counted,
+// and the sum and sum of squares of (round hits - reference), shifted so that
+// the variance does not cancel out. The last slot votes to stop on the budget.
+#define PRECISION_ROUNDS 0
+#define PRECISION_SUM 1
+#define PRECISION_SUMSQ 2
+#define PRECISION_OVER_BUDGET 3
+#define PRECISION_FIELDS 4
+// Fewer rounds give too rough a variance estimate to stop on
+#define PRECISION_MIN_ROUNDS 32
+
+// Rounds are counted in slices of this many blocks (2 points each) and the
+// budget is checked between them: a round of many strata takes far longer
+// than the budget check between rounds could catch
+#define PRECISION_SLICE_BLOCKS (1LL << 20)
+
+// Stratified blocks [first, first + blocks) of the round starting at block
+// roundBlock, split over the rank's threads
+long long CountStrata(const struct PiKernel *kernel, uint64_t seed, long long roundBlock, long long first,
+                      long long blocks, int strataBits)
+{
+    long long ins = 0;
+#pragma omp parallel reduction(+ : ins)
+    {
+        long long threadBlocks = blocks / hybrid_team_size();
+        long long threadFirst = first + hybrid_thread_id() * threadBlocks;
+        if (hybrid_thread_id() == hybrid_team_size() - 1)
+        {
+            threadBlocks += blocks % hybrid_team_size();
+        }
+        ins = countInsStratified(seed, roundBlock, threadFirst, threadBlocks, strataBits, kernel->precision);
+    }
+    return ins;
+}
+
+// One round of 4^k points, starting at point round * 4^k, or -1 if MPI_Wtime
+// passed deadline before the round was complete (a partial round would bias
+// the estimate, so it is dropped)
+long long CountRound(const struct PiKernel *kernel, uint64_t seed, long long round, int strataBits,
+                     int stratified, double deadline)
+{
+    long long roundBlocks = 1LL << (2 * strataBits - 1);
+    long long ins = 0;
+    for (long long first = 0; first < roundBlocks; first += PRECISION_SLICE_BLOCKS)
+    {
+        if (MPI_Wtime() >= deadline)
+        {
+            return -1;
+        }
+        long long blocks = roundBlocks - first < PRECISION_SLICE_BLOCKS ? roundBlocks - first : PRECISION_SLICE_BLOCKS;
+        ins += stratified ? CountStrata(kernel, seed, round * roundBlocks, first, blocks, strataBits)
+                          : CountChunk(kernel, seed, 2 * (round * roundBlocks + first), 2 * blocks);
+    }
+    return ins;
+}
+
+// pi, its standard error and the variance of a round's hits from the global
+// totals
+void PrecisionEstimate(const double *totals, double reference, double roundPoints, double *pi, double *se,
+                       double *variance)
+{
+    double n = totals[PRECISION_ROUNDS];
+    if (n == 0)
+    {
+        *pi = *se = *variance = 0.0;
+        return;
+    }
+    double mean = totals[PRECISION_SUM] / n;
+    *variance = n > 1 ? (totals[PRECISION_SUMSQ] - totals[PRECISION_SUM] * mean) / (n - 1) : 0.0;
+    *variance = *variance > 0 ? *variance : 0.0;
+    *pi = 4.0 * (reference + mean) / roundPoints;
+    *se = 4.0 * sqrt(*variance / n) / roundPoints;
+}
+
+// Rank r counts rounds r, r + comm_sz, ... for as long as it takes: a faster
+// rank simply contributes more rounds. The running totals are summed with
+// MPI_Iallreduce while the next rounds are computed; every rank sees the same
+// sums, so all of them stop after the same reduction, once the standard error
+// is at most the target or some rank has used up the time budget.
+void RunToPrecision(const struct PiKernel *kernel, uint64_t seed, double targetSe, double budget, int strataBits,
+                   int stratified, int my_rank, int comm_sz)
+{
+    double roundPoints = (double)(1LL << (2 * strataBits));
+    double reference = floor(roundPoints * M_PI / 4);
+    double local[PRECISION_FIELDS] = {0}, sent[PRECISION_FIELDS], totals[PRECISION_FIELDS];
+    MPI_Request request = MPI_REQUEST_NULL;
+    int stop = 0, checks = 0;
+    int byTarget = 0;
+    double pi = 0.0, se = 0.0, variance = 0.0, decided = 0.0;
+    struct PhaseTimers phases = {0};
+
+    struct MyClock clock;
+    MPI_Barrier(MPI_COMM_WORLD);
+    clock_start(&clock);
+    double start = MPI_Wtime();
+
+    for (long long round = my_rank; !stop; round += comm_sz)
+    {
+        phase_start(&phases, PHASE_COMPUTE);
+        long long ins = CountRound(kernel, seed, round, strataBits, stratified, start + budget);
+        phase_stop(&phases, PHASE_COMPUTE);
+        if (ins >= 0)
+        {
+            double d = (double)ins - reference;
+            local[PRECISION_ROUNDS] += 1;
+            local[PRECISION_SUM] += d;
+            local[PRECISION_SUMSQ] += d * d;
+        }
+
+        phase_start(&phases, PHASE_REDUCE);
+        if (request == MPI_REQUEST_NULL)
+        {
+            memcpy(sent, local, sizeof(sent));
+            sent[PRECISION_OVER_BUDGET] = MPI_Wtime() - start >= budget;
+            MPI_Iallreduce(sent, totals, PRECISION_FIELDS, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD, &request);
+            phase_stop(&phases, PHASE_REDUCE);
+            continue;
+        }
+        int done;
+        MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+        phase_stop(&phases, PHASE_REDUCE);
+        if (!done)
+        {
+            continue;
+        }
+        checks++;
+        PrecisionEstimate(totals, reference, roundPoints, &pi, &se, &variance);
+        byTarget = totals[PRECISION_ROUNDS] >= PRECISION_MIN_ROUNDS && se <= targetSe;
+        stop = byTarget || totals[PRECISION_OVER_BUDGET] > 0;
+        decided = MPI_Wtime() - start;
+    }
+
+    // The rounds counted after the deciding snapshot are valid too
+    phase_start(&phases, PHASE_REDUCE);
+    MPI_Reduce(local, totals, PRECISION_FIELDS, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    phase_stop(&phases, PHASE_REDUCE);
+    clock_stop(&clock);
+
+    double elapsed = clock_elapsed(&clock);
+    double times[2] = {elapsed, decided}, maxTimes[2];
+    MPI_Reduce(times, maxTimes, 2, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    char result[128] = "";
+    if (my_rank == 0)
+    {
+        PrecisionEstimate(totals, reference, roundPoints, &pi, &se, &variance);
+        snprintf(result, sizeof(result), "\"pi\": %.10f, \"points\": %.0f", pi,
+                 totals[PRECISION_ROUNDS] * roundPoints);
+    }
+    phases_report("first", maxTimes[0], result, NULL, &phases, NULL, 0, MPI_COMM_WORLD);
+    if (my_rank == 0)
+    {
+        double n = totals[PRECISION_ROUNDS];
+        // The hits of a round of independent points would vary by
+        // roundPoints * p * (1 - p)
+        double p = pi / 4;
+        printf("precision: se %.3e (target %.3e), 95%% ci [%.10f, %.10f], stopped by %s after %f s\n", se,
+               targetSe, pi - 1.96 * se, pi + 1.96 * se, byTarget ? "target" : "budget", maxTimes[1]);
+        printf("sampling: %s, %.0f rounds of %.0f points, %d checks, variance %.1fx below plain sampling\n",
+               stratified ? "stratified" : "plain", n, roundPoints, checks,
+               variance > 0 ? roundPoints * p * (1 - p) / variance : 0.0);
+        if (n < PRECISION_MIN_ROUNDS)
+        {
+            fprintf(stderr, "warning: only %.0f rounds fit in --budget, the standard error is not reliable "
+                            "(lower --strata or raise --budget)\n", n);
         }
     }
-    return inCircle;
 }
 
 int main(int argc, char **argv)
 {
     long long POINTS_NUMBER = 1000;
-    if (argc > 1)
+    if (arg_positional(argc, argv, 0))
     {
-        POINTS_NUMBER = atoll(argv[1]);
+        POINTS_NUMBER = atoll(arg_positional(argc, argv, 0));
     }
+    uint64_t seed = (uint64_t)arg_long(argc, argv, "seed", 1);
+    const char *isa = arg_string(argc, argv, "isa", "auto");
+    enum PiPrecision precision = strcmp(arg_string(argc, argv, "precision", "double"), "float") == 0
+                                     ? PI_FLOAT
+                                     : PI_DOUBLE;
+    int schedule = schedule_parse(arg_string(argc, argv, "schedule", "static"));
+    long long chunk = arg_long(argc, argv, "chunk", 1 << 22);
 
     int comm_sz;
     int my_rank;
 
-    MPI_Init(&argc, &argv);
+    hybrid_init(&argc, &argv);
 
     MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
     MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    counters_open(argc, argv, MPI_COMM_WORLD);
 
-    srand(time(NULL) * 10 + my_rank % 10); // Make unique seed for srand
+    const struct PiKernel *kernel = piSelectKernel(isa, precision);
+    if (!kernel)
+    {
+        if (my_rank == 0)
+        {
+            fprintf(stderr, "error: isa '%s' is not supported on this machine\n", isa);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    if (schedule < 0 || chunk <= 0)
+    {
+        if (my_rank == 0)
+        {
+            fprintf(stderr, "error: --schedule is static, dynamic or master, --chunk must be positive\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
 
-    struct MyClock clock;
-    MPI_Barrier(MPI_COMM_WORLD);
-    clock_start(&clock);
+    // --target-se runs for as long as the precision needs, once
+    double targetSe = arg_double(argc, argv, "target-se", 0.0);
+    struct PhaseTimers phases = {0};
+    struct Reps reps;
+    if (!reps_init(&reps, argc, argv, &phases, MPI_COMM_WORLD) || (targetSe > 0 && reps_requested(argc, argv)))
+    {
+        if (my_rank == 0)
+        {
+            fprintf(stderr, "error: --reps must be at least 1 and --warmup at least 0, "
+                            "neither applies to --target-se\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
 
-    long long currentSize = POINTS_NUMBER / comm_sz;
-    if (my_rank == comm_sz - 1)
+    // --target-se=E runs until the standard error of pi is at most E, or for
+    // --budget seconds; the point count is not used
+    if (targetSe > 0)
     {
-        currentSize += POINTS_NUMBER % comm_sz;
+        int strata = (int)arg_long(argc, argv, "strata", 256);
+        const char *sampling = arg_string(argc, argv, "sampling", "stratified");
+        int strataBits = 0;
+        while ((1 << strataBits) < strata)
+        {
+            strataBits++;
+        }
+        int gridBits = precision == PI_DOUBLE ? PI_GRID_BITS_DOUBLE : PI_GRID_BITS_FLOAT;
+        if ((1 << strataBits) != strata || strataBits < 1 || strataBits >= gridBits ||
+            (strcmp(sampling, "stratified") != 0 && strcmp(sampling, "plain") != 0))
+        {
+            if (my_rank == 0)
+            {
+                fprintf(stderr, "error: --strata must be a power of two from 2 to %d, --sampling is stratified or plain\n",
+                        1 << (gridBits - 1));
+            }
+            MPI_Finalize();
+            return 1;
+        }
+        RunToPrecision(kernel, seed, targetSe, arg_double(argc, argv, "budget", 60.0), strataBits,
+                       strcmp(sampling, "stratified") == 0, my_rank, comm_sz);
+        MPI_Finalize();
+        return 0;
     }
-    long long localIns = countIns(currentSize);
-    long long totalIns = 0;
 
-    MPI_Reduce(&localIns, &totalIns, 1, MPI_LONG_LONG,
-               MPI_SUM, 0, MPI_COMM_WORLD);
+    // Ranges this rank counted, for --check
+    int check = arg_flag(argc, argv, "check");
+    long long *ranges = NULL;
+    long long rangesCount = 0, rangesCapacity = 0;
 
-    clock_stop(&clock);
+    // Every rep hands out the whole range again; the check and the schedule
+    // report are about the last one
+    struct Scheduler scheduler;
+    long long localIns = 0, totalIns = 0;
+    for (; reps_next(&reps); reps_stop(&reps))
+    {
+        schedule_begin(&scheduler, schedule, POINTS_NUMBER, chunk, MPI_COMM_WORLD);
+        long long first = 0, currentSize = 0;
+        localIns = 0;
+        rangesCount = 0;
+        for (;;)
+        {
+            phase_start(&phases, PHASE_DISTRIBUTE);
+            int more = schedule_next(&scheduler, &first, &currentSize);
+            phase_stop(&phases, PHASE_DISTRIBUTE);
+            if (!more)
+            {
+                break;
+            }
+            phase_start(&phases, PHASE_COMPUTE);
+            localIns += CountChunk(kernel, seed, first, currentSize);
+            phase_stop(&phases, PHASE_COMPUTE);
+            if (check)
+            {
+                if (rangesCount == rangesCapacity)
+                {
+                    rangesCapacity = rangesCapacity ? 2 * rangesCapacity : 16;
+                    ranges = realloc(ranges, 2 * rangesCapacity * sizeof(long long));
+                }
+                ranges[2 * rangesCount] = first;
+                ranges[2 * rangesCount + 1] = currentSize;
+                rangesCount++;
+            }
+        }
+        schedule_end(&scheduler);
 
-    // Time measurement
-    double elapsed = clock_elapsed(&clock);
-    double max_elapsed;
-    MPI_Reduce(&elapsed, &max_elapsed, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        phase_start(&phases, PHASE_REDUCE);
+        MPI_Reduce(&localIns, &totalIns, 1, MPI_LONG_LONG,
+                   MPI_SUM, 0, MPI_COMM_WORLD);
+        phase_stop(&phases, PHASE_REDUCE);
+    }
+
+    // Time measurement: the median rep
+    double max_elapsed = reps_finish(&reps);
     MPI_Barrier(MPI_COMM_WORLD);
 
+    // Re-count with the scalar kernel of the same precision
+    int mismatch = 0;
+    if (check)
+    {
+        long long checkIns = 0;
+        for (long long r = 0; r < rangesCount; r++)
+        {
+            checkIns += countIns(piSelectKernel("scalar", precision), seed, ranges[2 * r], ranges[2 * r + 1]);
+        }
+        int localMismatch = checkIns != localIns;
+        MPI_Reduce(&localMismatch, &mismatch, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+        if (my_rank == 0)
+        {
+            fprintf(stderr, "check (%s vs scalar): %s\n", kernel->isa, mismatch ? "MISMATCH" : "ok");
+        }
+    }
+
+    char result[128] = "";
     if (my_rank == 0)
     {
-        long double pi = (long double)totalIns * 4.0 / POINTS_NUMBER;
-        printf("|%Lf,%lld,%f|\n", pi, POINTS_NUMBER, max_elapsed);
+        long double pi = POINTS_NUMBER > 0 ? (long double)totalIns * 4.0 / POINTS_NUMBER : 0.0;
+        snprintf(result, sizeof(result), "\"pi\": %Lf, \"points\": %lld", pi, POINTS_NUMBER);
     }
+    phases_report("first", max_elapsed, result, NULL, &phases, reps.max_seconds, reps.reps, MPI_COMM_WORLD);
+    schedule_report(&scheduler, MPI_COMM_WORLD);
+    reps_free(&reps);
+    free(ranges);
 
     MPI_Finalize();
-    return 0;
+    return mismatch;
 }
\ No newline at end of file
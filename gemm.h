@@ -0,0 +1,393 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GEMM_HAVE_X86 1
+#endif
+
+// Packed, cache-blocked C += A * B for row-major doubles (Goto/BLIS layout).
+//
+//   jc: NC columns of B  -> packed B panel stays in L3
+//   pc: KC depth slice   -> packed A panel (MC x KC) stays in L2
+//   ic: MC rows of A
+//   jr/ir: NR x MR micro-tile, one KC-long rank-1 update chain in registers
+//
+// A micro-panels are stored k-major with MR rows each, B micro-panels k-major
+// with NR columns each, zero-padded at the edges so the micro-kernel never
+// branches on the tile shape.
+
+#define GEMM_KC 256
+#define GEMM_MC 96
+#define GEMM_NC 3072
+#define GEMM_MAX_TILE (8 * 24)
+
+typedef void (*GemmMicroFn)(int kc, const double* Ap, const double* Bp, double* C, int ldc);
+
+struct GemmKernel {
+    const char* isa;
+    int mr;
+    int nr;
+    GemmMicroFn micro;
+};
+
+#define GEMM_SCALAR_MR 4
+#define GEMM_SCALAR_NR 4
+
+static inline void gemmMicroScalar(int kc, const double* Ap, const double* Bp, double* C, int ldc) {
+    double acc[GEMM_SCALAR_MR][GEMM_SCALAR_NR] = {{0}};
+    for (int p = 0; p < kc; p++) {
+        for (int i = 0; i < GEMM_SCALAR_MR; i++) {
+            for (int j = 0; j < GEMM_SCALAR_NR; j++) {
+                acc[i][j] += Ap[p * GEMM_SCALAR_MR + i] * Bp[p * GEMM_SCALAR_NR + j];
+            }
+        }
+    }
+    for (int i = 0; i < GEMM_SCALAR_MR; i++) {
+        for (int j = 0; j < GEMM_SCALAR_NR; j++) {
+            C[i * ldc + j] += acc[i][j];
+        }
+    }
+}
+
+#ifdef GEMM_HAVE_X86
+
+#define GEMM_AVX2_MR 6
+#define GEMM_AVX2_NR 8
+
+__attribute__((target("avx2,fma")))
+static inline void gemmMicroAvx2(int kc, const double* Ap, const double* Bp, double* C, int ldc) {
+    __m256d acc[GEMM_AVX2_MR][2];
+    for (int i = 0; i < GEMM_AVX2_MR; i++) {
+        acc[i][0] = _mm256_setzero_pd();
+        acc[i][1] = _mm256_setzero_pd();
+    }
+    for (int p = 0; p < kc; p++) {
+        __m256d b0 = _mm256_load_pd(Bp + p * GEMM_AVX2_NR);
+        __m256d b1 = _mm256_load_pd(Bp + p * GEMM_AVX2_NR + 4);
+        for (int i = 0; i < GEMM_AVX2_MR; i++) {
+            __m256d a = _mm256_broadcast_sd(Ap + p * GEMM_AVX2_MR + i);
+            acc[i][0] = _mm256_fmadd_pd(a, b0, acc[i][0]);
+            acc[i][1] = _mm256_fmadd_pd(a, b1, acc[i][1]);
+        }
+    }
+    for (int i = 0; i < GEMM_AVX2_MR; i++) {
+        double* c = C + i * ldc;
+        _mm256_storeu_pd(c, _mm256_add_pd(_mm256_loadu_pd(c), acc[i][0]));
+        _mm256_storeu_pd(c + 4, _mm256_add_pd(_mm256_loadu_pd(c + 4), acc[i][1]));
+    }
+}
+
+#define GEMM_AVX512_MR 8
+#define GEMM_AVX512_NR 24
+
+__attribute__((target("avx512f")))
+static inline void gemmMicroAvx512(int kc, const double* Ap, const double* Bp, double* C, int ldc) {
+    __m512d acc[GEMM_AVX512_MR][3];
+    for (int i = 0; i < GEMM_AVX512_MR; i++) {
+        acc[i][0] = _mm512_setzero_pd();
+        acc[i][1] = _mm512_setzero_pd();
+        acc[i][2] = _mm512_setzero_pd();
+    }
+    for (int p = 0; p < kc; p++) {
+        __m512d b0 = _mm512_load_pd(Bp + p * GEMM_AVX512_NR);
+        __m512d b1 = _mm512_load_pd(Bp + p * GEMM_AVX512_NR + 8);
+        __m512d b2 = _mm512_load_pd(Bp + p * GEMM_AVX512_NR + 16);
+        for (int i = 0; i < GEMM_AVX512_MR; i++) {
+            __m512d a = _mm512_set1_pd(Ap[p * GEMM_AVX512_MR + i]);
+            acc[i][0] = _mm512_fmadd_pd(a, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_pd(a, b1, acc[i][1]);
+            acc[i][2] = _mm512_fmadd_pd(a, b2, acc[i][2]);
+        }
+    }
+    for (int i = 0; i < GEMM_AVX512_MR; i++) {
+        double* c = C + i * ldc;
+        _mm512_storeu_pd(c, _mm512_add_pd(_mm512_loadu_pd(c), acc[i][0]));
+        _mm512_storeu_pd(c + 8, _mm512_add_pd(_mm512_loadu_pd(c + 8), acc[i][1]));
+        _mm512_storeu_pd(c + 16, _mm512_add_pd(_mm512_loadu_pd(c + 16), acc[i][2]));
+    }
+}
+
+#endif
+
+static const struct GemmKernel gemmKernels[] = {
+    {"scalar", GEMM_SCALAR_MR, GEMM_SCALAR_NR, gemmMicroScalar},
+#ifdef GEMM_HAVE_X86
+    {"avx2", GEMM_AVX2_MR, GEMM_AVX2_NR, gemmMicroAvx2},
+    {"avx512", GEMM_AVX512_MR, GEMM_AVX512_NR, gemmMicroAvx512},
+#endif
+};
+
+static inline int gemmIsaSupported(const char* isa) {
+    if (strcmp(isa, "scalar") == 0) {
+        return 1;
+    }
+#ifdef GEMM_HAVE_X86
+    __builtin_cpu_init();
+    if (strcmp(isa, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    }
+    if (strcmp(isa, "avx512") == 0) {
+        return __builtin_cpu_supports("avx512f");
+    }
+#endif
+    return 0;
+}
+
+// Picks the micro-kernel for isa ("auto" = widest supported); NULL if unavailable.
+static inline const struct GemmKernel* gemmSelectKernel(const char* isa) {
+    const struct GemmKernel* best = NULL;
+    for (size_t i = 0; i < sizeof(gemmKernels) / sizeof(gemmKernels[0]); i++) {
+        if (!gemmIsaSupported(gemmKernels[i].isa)) {
+            continue;
+        }
+        if (strcmp(isa, "auto") == 0 || strcmp(isa, gemmKernels[i].isa) == 0) {
+            best = &gemmKernels[i];
+        }
+    }
+    return best;
+}
+
+static inline double* gemmAlloc(size_t elements) {
+    size_t bytes = (elements * sizeof(double) + 63) / 64 * 64;
+    return (double*)aligned_alloc(64, bytes);
+}
+
+static inline void gemmPackA(int mc, int kc, const double* A, int lda, int mr, double* Ap) {
+    for (int ir = 0; ir < mc; ir += mr) {
+        int rows = mc - ir < mr ? mc - ir : mr;
+        for (int p = 0; p < kc; p++) {
+            for (int i = 0; i < rows; i++) {
+                Ap[p * mr + i] = A[(ir + i) * lda + p];
+            }
+            for (int i = rows; i < mr; i++) {
+                Ap[p * mr + i] = 0.0;
+            }
+        }
+        Ap += mr * kc;
+    }
+}
+
+// Packs the micro-panel of B starting at column jr.
+static inline void gemmPackBPanel(int kc, int nc, int jr, const double* B, int ldb, int nr, double* Bp) {
+    int cols = nc - jr < nr ? nc - jr : nr;
+    for (int p = 0; p < kc; p++) {
+        for (int j = 0; j < cols; j++) {
+            Bp[p * nr + j] = B[p * ldb + jr + j];
+        }
+        for (int j = cols; j < nr; j++) {
+            Bp[p * nr + j] = 0.0;
+        }
+    }
+}
+
+static inline int gemmMaxThreads(void) {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+static inline int gemmThreadId(void) {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+// Doubles of packing space gemmPacked needs for products at most n columns
+// wide: the shared B panel, then one A panel per thread (both multiples of
+// 64 bytes, so every panel stays aligned)
+static inline size_t gemmPackSpace(const struct GemmKernel* kernel, int n, int threads) {
+    const int mr = kernel->mr, nr = kernel->nr;
+    const int mc_max = (GEMM_MC + mr - 1) / mr * mr;
+    const int nc_max = (GEMM_NC + nr - 1) / nr * nr;
+    int nc = (n + nr - 1) / nr * nr;
+    return (size_t)GEMM_KC * (nc < nc_max ? nc : nc_max) + (size_t)threads * mc_max * GEMM_KC;
+}
+
+// gemm with caller-provided packing space of gemmPackSpace(kernel, n, T)
+// doubles, T at least the OpenMP team size, 64-byte aligned
+static inline void gemmPacked(const struct GemmKernel* kernel, int m, int n, int k, const double* A, int lda,
+                              const double* B, int ldb, double* C, int ldc, double* pack) {
+    const int mr = kernel->mr, nr = kernel->nr;
+    const int mc_max = (GEMM_MC + mr - 1) / mr * mr;
+    const int nc_max = (GEMM_NC + nr - 1) / nr * nr;
+    double* Bp = pack;
+    double* Ap_all = pack + gemmPackSpace(kernel, n, 0);
+
+#pragma omp parallel
+    {
+        double* Ap = Ap_all + (size_t)gemmThreadId() * mc_max * GEMM_KC;
+        double tile[GEMM_MAX_TILE];
+
+        for (int jc = 0; jc < n; jc += nc_max) {
+            int nc = n - jc < nc_max ? n - jc : nc_max;
+            for (int pc = 0; pc < k; pc += GEMM_KC) {
+                int kc = k - pc < GEMM_KC ? k - pc : GEMM_KC;
+
+#pragma omp for schedule(static)
+                for (int jr = 0; jr < nc; jr += nr) {
+                    gemmPackBPanel(kc, nc, jr, B + (size_t)pc * ldb + jc, ldb, nr, Bp + (size_t)jr * kc);
+                }
+
+#pragma omp for schedule(dynamic)
+                for (int ic = 0; ic < m; ic += mc_max) {
+                    int mc = m - ic < mc_max ? m - ic : mc_max;
+                    gemmPackA(mc, kc, A + (size_t)ic * lda + pc, lda, mr, Ap);
+                    for (int jr = 0; jr < nc; jr += nr) {
+                        int cols = nc - jr < nr ? nc - jr : nr;
+                        for (int ir = 0; ir < mc; ir += mr) {
+                            int rows = mc - ir < mr ? mc - ir : mr;
+                            const double* a = Ap + (size_t)ir * kc;
+                            const double* b = Bp + (size_t)jr * kc;
+                            double* c = C + (size_t)(ic + ir) * ldc + jc + jr;
+                            if (rows == mr && cols == nr) {
+                                kernel->micro(kc, a, b, c, ldc);
+                                continue;
+                            }
+                            // Edge tile: run the full kernel on a scratch tile
+                            memset(tile, 0, sizeof(double) * mr * nr);
+                            kernel->micro(kc, a, b, tile, nr);
+                            for (int i = 0; i < rows; i++) {
+                                for (int j = 0; j < cols; j++) {
+                                    c[i * ldc + j] += tile[i * nr + j];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// C (m x n) += A (m x k) * B (k x n), all row-major. B panels are packed
+// cooperatively by the rank's OpenMP team, A panels per thread.
+static inline void gemm(const struct GemmKernel* kernel, int m, int n, int k, const double* A, int lda,
+                        const double* B, int ldb, double* C, int ldc) {
+    double* pack = gemmAlloc(gemmPackSpace(kernel, n, gemmMaxThreads()));
+    gemmPacked(kernel, m, n, k, A, lda, B, ldb, C, ldc, pack);
+    free(pack);
+}
+
+// Strassen-Winograd: above the cutoff, C = A * B for n x n blocks takes 7
+// products of the h x h quadrants (h = n / 2) and 15 quadrant additions
+// instead of 8 products; blocks of cutoff or less go to gemm. The schedule
+// (Boyer, Dumas, Pernet, Zhou) keeps the products in the quadrants of C and
+// needs two h x h temporaries per level; those, the packing space of the
+// leaf products and the product itself are carved out of one workspace of
+// gemmStrassenWorkspace doubles, so the recursion never allocates. An odd n
+// is peeled: the even leading part recurses, the last row and column and the
+// rank-1 remainder go to gemm.
+
+// Quadrant additions at least this large use the OpenMP team
+#define GEMM_STRASSEN_PARALLEL (1 << 14)
+
+// C = A + sign * B for n x n blocks; C may be A or B
+static inline void gemmCombine(int n, const double* A, int lda, const double* B, int ldb, double sign, double* C,
+                               int ldc) {
+#pragma omp parallel for schedule(static) if ((long long)n * n >= GEMM_STRASSEN_PARALLEL)
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            C[(size_t)i * ldc + j] = A[(size_t)i * lda + j] + sign * B[(size_t)i * ldb + j];
+        }
+    }
+}
+
+static inline void gemmZero(int m, int n, double* C, int ldc) {
+    for (int i = 0; i < m; i++) {
+        memset(C + (size_t)i * ldc, 0, (size_t)n * sizeof(double));
+    }
+}
+
+// Recursion depth for n: the number of halvings before the cutoff
+static inline int gemmStrassenLevels(int n, int cutoff) {
+    int levels = 0;
+    for (; n > cutoff && n >= 2; n /= 2) {
+        levels++;
+    }
+    return levels;
+}
+
+// Doubles of workspace gemmStrassen needs for n x n blocks, for the OpenMP
+// team size at the time of the call
+static inline size_t gemmStrassenWorkspace(const struct GemmKernel* kernel, int n, int cutoff) {
+    size_t total = gemmPackSpace(kernel, n, gemmMaxThreads()) + (size_t)n * n; // packing, the product
+    for (; n > cutoff && n >= 2; n /= 2) {
+        total += 2 * (size_t)(n / 2) * (n / 2);
+    }
+    return total;
+}
+
+// C = A * B (overwrites C), packing in pack
+static inline void gemmStrassenSet(const struct GemmKernel* kernel, int n, const double* A, int lda, const double* B,
+                                   int ldb, double* C, int ldc, int cutoff, double* pack, double* work) {
+    if (n <= cutoff || n < 2) {
+        gemmZero(n, n, C, ldc);
+        gemmPacked(kernel, n, n, n, A, lda, B, ldb, C, ldc, pack);
+        return;
+    }
+    if (n % 2 != 0) {
+        int m = n - 1;
+        gemmStrassenSet(kernel, m, A, lda, B, ldb, C, ldc, cutoff, pack, work);
+        gemmPacked(kernel, m, m, 1, A + m, lda, B + (size_t)m * ldb, ldb, C, ldc, pack);
+        gemmZero(n, 1, C + m, ldc);
+        gemmZero(1, m, C + (size_t)m * ldc, ldc);
+        gemmPacked(kernel, n, 1, n, A, lda, B + m, ldb, C + m, ldc, pack);
+        gemmPacked(kernel, 1, m, n, A + (size_t)m * lda, lda, B, ldb, C + (size_t)m * ldc, ldc, pack);
+        return;
+    }
+
+    int h = n / 2;
+    const double *A11 = A, *A12 = A + h, *A21 = A + (size_t)h * lda, *A22 = A21 + h;
+    const double *B11 = B, *B12 = B + h, *B21 = B + (size_t)h * ldb, *B22 = B21 + h;
+    double *C11 = C, *C12 = C + h, *C21 = C + (size_t)h * ldc, *C22 = C21 + h;
+    double *X = work, *Y = work + (size_t)h * h, *next = Y + (size_t)h * h;
+
+    gemmCombine(h, A11, lda, A21, lda, -1.0, X, h);                 // S3 = A11 - A21
+    gemmCombine(h, B22, ldb, B12, ldb, -1.0, Y, h);                 // T3 = B22 - B12
+    gemmStrassenSet(kernel, h, X, h, Y, h, C21, ldc, cutoff, pack, next); // P7 = S3 T3
+    gemmCombine(h, A21, lda, A22, lda, 1.0, X, h);                  // S1 = A21 + A22
+    gemmCombine(h, B12, ldb, B11, ldb, -1.0, Y, h);                 // T1 = B12 - B11
+    gemmStrassenSet(kernel, h, X, h, Y, h, C22, ldc, cutoff, pack, next); // P5 = S1 T1
+    gemmCombine(h, X, h, A11, lda, -1.0, X, h);                     // S2 = S1 - A11
+    gemmCombine(h, B22, ldb, Y, h, -1.0, Y, h);                     // T2 = B22 - T1
+    gemmStrassenSet(kernel, h, X, h, Y, h, C12, ldc, cutoff, pack, next); // P6 = S2 T2
+    gemmCombine(h, A12, lda, X, h, -1.0, X, h);                     // S4 = A12 - S2
+    gemmStrassenSet(kernel, h, X, h, B22, ldb, C11, ldc, cutoff, pack, next); // P3 = S4 B22
+    gemmStrassenSet(kernel, h, A11, lda, B11, ldb, X, h, cutoff, pack, next); // P1 = A11 B11
+    gemmCombine(h, X, h, C12, ldc, 1.0, C12, ldc);                  // U2 = P1 + P6
+    gemmCombine(h, C12, ldc, C21, ldc, 1.0, C21, ldc);              // U3 = U2 + P7
+    gemmCombine(h, C12, ldc, C22, ldc, 1.0, C12, ldc);              // U4 = U2 + P5
+    gemmCombine(h, C21, ldc, C22, ldc, 1.0, C22, ldc);              // C22 = U3 + P5
+    gemmCombine(h, C12, ldc, C11, ldc, 1.0, C12, ldc);              // C12 = U4 + P3
+    gemmCombine(h, Y, h, B21, ldb, -1.0, Y, h);                     // T4 = T2 - B21
+    gemmStrassenSet(kernel, h, A22, lda, Y, h, C11, ldc, cutoff, pack, next); // P4 = A22 T4
+    gemmCombine(h, C21, ldc, C11, ldc, -1.0, C21, ldc);             // C21 = U3 - P4
+    gemmStrassenSet(kernel, h, A12, lda, B21, ldb, C11, ldc, cutoff, pack, next); // P2 = A12 B21
+    gemmCombine(h, X, h, C11, ldc, 1.0, C11, ldc);                  // C11 = P1 + P2
+}
+
+// C (n x n) += A (n x n) * B (n x n), row-major, with 64-byte aligned work
+// of at least gemmStrassenWorkspace(kernel, n, cutoff) doubles; plain gemm at
+// or below the cutoff
+static inline void gemmStrassen(const struct GemmKernel* kernel, int n, const double* A, int lda, const double* B,
+                                int ldb, double* C, int ldc, int cutoff, double* work) {
+    double* pack = work;
+    double* product = work + gemmPackSpace(kernel, n, gemmMaxThreads());
+    if (n <= cutoff) {
+        gemmPacked(kernel, n, n, n, A, lda, B, ldb, C, ldc, pack);
+        return;
+    }
+    gemmStrassenSet(kernel, n, A, lda, B, ldb, product, n, cutoff, pack, product + (size_t)n * n);
+    gemmCombine(n, C, ldc, product, n, 1.0, C, ldc);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "args.h"
+
+#include <mpi.h>
+#include <stdlib.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Hybrid MPI + OpenMP start-up: only the main thread talks to MPI, the kernels
+// run on an OpenMP team of "--threads=T" threads per rank (build with -fopenmp).
+// Without --threads the team size comes from OMP_NUM_THREADS, or 1 if unset,
+// so a plain one-rank-per-core launch behaves as before.
+static inline int hybrid_init(int* argc, char*** argv) {
+    int provided;
+    MPI_Init_thread(argc, argv, MPI_THREAD_FUNNELED, &provided);
+
+    int threads = (int)arg_long(*argc, *argv, "threads", 0);
+    if (threads <= 0) {
+        threads = getenv("OMP_NUM_THREADS") ? atoi(getenv("OMP_NUM_THREADS")) : 1;
+    }
+    if (threads <= 0) {
+        threads = 1;
+    }
+#ifdef _OPENMP
+    omp_set_num_threads(threads);
+#else
+    threads = 1;
+#endif
+    return threads;
+}
+
+static inline int hybrid_thread_id(void) {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+static inline int hybrid_team_size(void) {
+#ifdef _OPENMP
+    return omp_get_num_threads();
+#else
+    return 1;
+#endif
+}
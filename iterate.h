@@ -0,0 +1,127 @@
+#pragma once
+
+#include "args.h"
+#include "dtype.h"
+
+#include <mpi.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Iterative matvec mode: "--iterations=M" keeps the matrix resident and runs
+// M products y = A * x; with "--normalize" y is scaled and fed back as the
+// next x (power iteration, needs a square matrix). x has the --dtype element
+// type and y its accumulator type, as in the single products. The
+// normalization makes max |x| ITER_NORM_SCALE, in fixed point for the integer
+// types.
+//
+// The per-iteration exchange is set up once as a persistent collective and
+// replayed with MPI_Start: MPI_<name>_init with MPI 4, or the MPIX_<name>_init
+// of Open MPI's pcollreq extension on the MPI 3.1 Open MPI 4.x releases.
+// Libraries with neither run the equivalent blocking collective.
+
+#if defined(OPEN_MPI) && OPEN_MPI
+#include <mpi-ext.h>
+#endif
+
+#if MPI_VERSION >= 4
+#define ITER_PERSISTENT 1
+#define ITER_COLL_INIT(name) MPI_##name##_init
+#define ITER_EXCHANGE "persistent (MPI-4)"
+#elif defined(OMPI_HAVE_MPI_EXT_PCOLLREQ) && OMPI_HAVE_MPI_EXT_PCOLLREQ
+#define ITER_PERSISTENT 1
+#define ITER_COLL_INIT(name) MPIX_##name##_init
+#define ITER_EXCHANGE "persistent (MPIX pcollreq)"
+#else
+#define ITER_PERSISTENT 0
+#define ITER_EXCHANGE "blocking"
+#endif
+
+#define ITER_NORM_SCALE 1024
+
+struct IterOptions {
+    int iterations;
+    int normalize;
+};
+
+struct IterLatency {
+    double p50;
+    double p90;
+    double p99;
+    double max;
+    double mean;
+};
+
+static inline struct IterOptions iter_options(int argc, char** argv) {
+    struct IterOptions opts;
+    opts.iterations = (int)arg_long(argc, argv, "iterations", 0);
+    opts.normalize = arg_flag(argc, argv, "normalize");
+    return opts;
+}
+
+// Largest |y[i]| of n elements of matio type code
+static inline double iter_max_abs(const void* y, int n, uint32_t code) {
+    double max_abs = 0.0;
+    for (int i = 0; i < n; i++) {
+        double v = fabs(dtype_load(y, i, code));
+        if (v > max_abs) {
+            max_abs = v;
+        }
+    }
+    return max_abs;
+}
+
+// x = y * ITER_NORM_SCALE / max_abs, where max_abs is max |y| over the whole
+// (possibly distributed) vector; integer x is truncated towards zero
+static inline void iter_normalize(void* x, uint32_t x_code, const void* y, uint32_t y_code, int n, double max_abs) {
+    for (int i = 0; i < n; i++) {
+        dtype_store_real(x, i, max_abs > 0 ? dtype_load(y, i, y_code) * ITER_NORM_SCALE / max_abs : 0.0, x_code);
+    }
+}
+
+static inline int iter_compare(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted times
+static inline double iter_percentile(const double* sorted, int n, double p) {
+    int rank = (int)ceil(p / 100.0 * n);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// An iteration is as slow as its slowest rank: the per-iteration times are
+// reduced with MPI_MAX before the percentiles. The result is valid on rank 0,
+// where times is left holding the maxima in iteration order (the samples of
+// phases_report).
+static inline void iter_latency(double* times, int iterations, MPI_Comm comm, struct IterLatency* out) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    double* max_times = (double*)malloc(iterations * sizeof(double));
+    MPI_Reduce(times, max_times, iterations, MPI_DOUBLE, MPI_MAX, 0, comm);
+    if (rank == 0) {
+        memcpy(times, max_times, iterations * sizeof(double));
+        qsort(max_times, iterations, sizeof(double), iter_compare);
+        double sum = 0.0;
+        for (int i = 0; i < iterations; i++) {
+            sum += max_times[i];
+        }
+        out->p50 = iter_percentile(max_times, iterations, 50);
+        out->p90 = iter_percentile(max_times, iterations, 90);
+        out->p99 = iter_percentile(max_times, iterations, 99);
+        out->max = max_times[iterations - 1];
+        out->mean = sum / iterations;
+    }
+    free(max_times);
+}
+
+// max_abs is max |y| of the last iteration; with max |x| = ITER_NORM_SCALE it
+// estimates the dominant eigenvalue
+static inline void iter_print(const struct IterLatency* lat, struct IterOptions opts, double max_abs) {
+    printf("iterations: %d, latency p50 %.3e s, p90 %.3e s, p99 %.3e s, max %.3e s, mean %.3e s, exchange %s\n",
+           opts.iterations, lat->p50, lat->p90, lat->p99, lat->max, lat->mean, ITER_EXCHANGE);
+    if (opts.normalize) {
+        printf("eigenvalue estimate: %.4f\n", max_abs / ITER_NORM_SCALE);
+    }
+}
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <mpi.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Binary matrix file: a 32-byte header followed by the rows x cols elements in
+// row-major order, all in the byte order of the machine that wrote it
+// (little-endian on everything we run on).
+//
+//   offset  0  char[4]   magic "MATB"
+//   offset  4  uint32    version (1)
+//   offset  8  uint32    dtype (MATIO_INT32, ...)
+//   offset 12  uint32    reserved, 0
+//   offset 16  uint64    rows
+//   offset 24  uint64    cols
+//
+// Every rank reads or writes its own rectangular block with collective MPI-IO:
+// the file view is a subarray of the global matrix, so the library merges the
+// ranks' pieces into large contiguous requests and no rank stages data for
+// another.
+
+#define MATIO_MAGIC "MATB"
+#define MATIO_VERSION 1
+#define MATIO_HEADER_BYTES 32
+// Elements per rank per collective call when a block is transposed on the way
+#define MATIO_CHUNK_ELEMENTS (1 << 20)
+
+enum MatioDtype {
+    MATIO_INT32 = 1,
+    MATIO_INT64 = 2,
+    MATIO_FLOAT32 = 3,
+    MATIO_FLOAT64 = 4,
+};
+
+struct MatioHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t reserved;
+    uint64_t rows;
+    uint64_t cols;
+};
+
+// Bytes moved and time spent by this rank, accumulated over calls
+struct MatioStats {
+    double seconds;
+    long long bytes;
+};
+
+// int is 32 and long long 64 bits on every target we build for
+static inline MPI_Datatype matio_mpi_type(uint32_t dtype) {
+    switch (dtype) {
+    case MATIO_INT32:
+        return MPI_INT;
+    case MATIO_INT64:
+        return MPI_LONG_LONG;
+    case MATIO_FLOAT32:
+        return MPI_FLOAT;
+    case MATIO_FLOAT64:
+        return MPI_DOUBLE;
+    }
+    return MPI_DATATYPE_NULL;
+}
+
+static inline const char* matio_dtype_name(uint32_t dtype) {
+    switch (dtype) {
+    case MATIO_INT32:
+        return "int32";
+    case MATIO_INT64:
+        return "int64";
+    case MATIO_FLOAT32:
+        return "float32";
+    case MATIO_FLOAT64:
+        return "float64";
+    }
+    return "unknown";
+}
+
+// Reads and checks the header, which must hold the given dtype; every rank of
+// comm gets it. Returns 0 on success, otherwise prints the reason on rank 0
+// and returns 1.
+static inline int matio_read_header(MPI_Comm comm, const char* path, uint32_t dtype, struct MatioHeader* header) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    MPI_File fh;
+    if (MPI_File_open(comm, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        if (rank == 0) {
+            fprintf(stderr, "error: cannot open '%s'\n", path);
+        }
+        return 1;
+    }
+    MPI_File_read_at_all(fh, 0, header, sizeof(*header), MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+
+    if (memcmp(header->magic, MATIO_MAGIC, 4) != 0 || header->version != MATIO_VERSION ||
+        matio_mpi_type(header->dtype) == MPI_DATATYPE_NULL) {
+        if (rank == 0) {
+            fprintf(stderr, "error: '%s' is not a version %d matrix file\n", path, MATIO_VERSION);
+        }
+        return 1;
+    }
+    if (header->dtype != dtype) {
+        if (rank == 0) {
+            fprintf(stderr, "error: '%s' holds %s, expected %s\n", path, matio_dtype_name(header->dtype),
+                    matio_dtype_name(dtype));
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// File view of the block [row0, row0 + rows) x [col0, col0 + cols) of a
+// total_rows x total_cols matrix. An empty block gets a plain etype view and
+// takes part in the collective call with count 0.
+static inline void matio_set_view(MPI_File fh, uint64_t total_rows, uint64_t total_cols, int row0, int col0,
+                                  int rows, int cols, MPI_Datatype etype) {
+    if (rows == 0 || cols == 0) {
+        MPI_File_set_view(fh, MATIO_HEADER_BYTES, etype, etype, "native", MPI_INFO_NULL);
+        return;
+    }
+    int sizes[2] = {(int)total_rows, (int)total_cols};
+    int subsizes[2] = {rows, cols};
+    int starts[2] = {row0, col0};
+    MPI_Datatype filetype;
+    MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, etype, &filetype);
+    MPI_Type_commit(&filetype);
+    MPI_File_set_view(fh, MATIO_HEADER_BYTES, etype, filetype, "native", MPI_INFO_NULL);
+    MPI_Type_free(&filetype);
+}
+
+// Collective over comm: every rank reads its block into buf, laid out by
+// memcount elements of memtype (count rows * cols of the element type for a
+// contiguous row-major block).
+static inline void matio_read_block(MPI_Comm comm, const char* path, const struct MatioHeader* header, int row0,
+                                    int col0, int rows, int cols, void* buf, MPI_Datatype memtype, int memcount,
+                                    struct MatioStats* stats) {
+    MPI_Datatype etype = matio_mpi_type(header->dtype);
+    double start = MPI_Wtime();
+    MPI_File fh;
+    MPI_File_open(comm, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+    matio_set_view(fh, header->rows, header->cols, row0, col0, rows, cols, etype);
+    MPI_File_read_all(fh, buf, rows && cols ? memcount : 0, memtype, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+    stats->seconds += MPI_Wtime() - start;
+
+    int esize;
+    MPI_Type_size(etype, &esize);
+    stats->bytes += (long long)rows * cols * esize;
+}
+
+// Collective over comm: creates (or truncates) path to the size of the
+// matrix and writes the header from rank 0
+static inline MPI_File matio_create(MPI_Comm comm, const char* path, uint32_t dtype, uint64_t total_rows,
+                                    uint64_t total_cols) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    int esize;
+    MPI_Type_size(matio_mpi_type(dtype), &esize);
+
+    MPI_File fh;
+    if (MPI_File_open(comm, path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        if (rank == 0) {
+            fprintf(stderr, "error: cannot create '%s'\n", path);
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_File_set_size(fh, MATIO_HEADER_BYTES + (MPI_Offset)(total_rows * total_cols * esize));
+    if (rank == 0) {
+        struct MatioHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MATIO_MAGIC, 4);
+        header.version = MATIO_VERSION;
+        header.dtype = dtype;
+        header.rows = total_rows;
+        header.cols = total_cols;
+        MPI_File_write_at(fh, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    return fh;
+}
+
+// Collective over comm: creates path and every rank writes its block
+static inline void matio_write_block(MPI_Comm comm, const char* path, uint32_t dtype, uint64_t total_rows,
+                                     uint64_t total_cols, int row0, int col0, int rows, int cols, const void* buf,
+                                     MPI_Datatype memtype, int memcount, struct MatioStats* stats) {
+    MPI_Datatype etype = matio_mpi_type(dtype);
+    int esize;
+    MPI_Type_size(etype, &esize);
+
+    double start = MPI_Wtime();
+    MPI_File fh = matio_create(comm, path, dtype, total_rows, total_cols);
+    matio_set_view(fh, total_rows, total_cols, row0, col0, rows, cols, etype);
+    MPI_File_write_all(fh, buf, rows && cols ? memcount : 0, memtype, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+    stats->seconds += MPI_Wtime() - start;
+    stats->bytes += (long long)rows * cols * esize;
+}
+
+// Column-major local blocks (element (i, j) at buf[j * rows + i]). A strided
+// memory datatype makes the library pack element by element, which is many
+// times slower than the file access itself, so the block moves in chunks of
+// whole rows through a row-major bounce buffer and is transposed locally.
+// Every rank makes the same number of collective calls, sized by the widest
+// block of comm.
+static inline int matio_chunk_rows(MPI_Comm comm, int rows, int cols, int* chunks) {
+    int max_rows, max_cols;
+    MPI_Allreduce(&rows, &max_rows, 1, MPI_INT, MPI_MAX, comm);
+    MPI_Allreduce(&cols, &max_cols, 1, MPI_INT, MPI_MAX, comm);
+    int chunk = max_cols > 0 ? MATIO_CHUNK_ELEMENTS / max_cols : max_rows;
+    chunk = chunk < 1 ? 1 : chunk;
+    *chunks = (max_rows + chunk - 1) / chunk;
+    return chunk;
+}
+
+// Moves rows [r, r + n) of a column-major block between buf (leading
+// dimension buf_rows) and the row-major bounce buffer
+#define MATIO_TRANSPOSE_ROWS(type)                                                  \
+    for (int j = 0; j < cols; j++) {                                               \
+        type* column = (type*)buf + (size_t)j * buf_rows + r;                      \
+        type* row = (type*)bounce + j;                                             \
+        for (int i = 0; i < n; i++) {                                              \
+            if (to_columns) {                                                      \
+                column[i] = row[(size_t)i * cols];                                 \
+            } else {                                                               \
+                row[(size_t)i * cols] = column[i];                                 \
+            }                                                                      \
+        }                                                                          \
+    }
+
+static inline void matio_transpose_rows(void* buf, void* bounce, int buf_rows, int r, int n, int cols, int esize,
+                                        int to_columns) {
+    if (esize == 4) {
+        MATIO_TRANSPOSE_ROWS(uint32_t)
+    } else {
+        MATIO_TRANSPOSE_ROWS(uint64_t)
+    }
+}
+
+#undef MATIO_TRANSPOSE_ROWS
+
+static inline void matio_read_columns(MPI_Comm comm, const char* path, const struct MatioHeader* header, int row0,
+                                      int col0, int rows, int cols, void* buf, struct MatioStats* stats) {
+    MPI_Datatype etype = matio_mpi_type(header->dtype);
+    int esize;
+    MPI_Type_size(etype, &esize);
+    int chunks;
+    int chunk = matio_chunk_rows(comm, rows, cols, &chunks);
+    char* bounce = (char*)malloc((size_t)chunk * cols * esize + 1);
+
+    double start = MPI_Wtime();
+    MPI_File fh;
+    MPI_File_open(comm, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+    matio_set_view(fh, header->rows, header->cols, row0, col0, rows, cols, etype);
+    for (int c = 0; c < chunks; c++) {
+        int r = c * chunk;
+        int n = r >= rows ? 0 : rows - r < chunk ? rows - r : chunk;
+        MPI_File_read_all(fh, bounce, n * cols, etype, MPI_STATUS_IGNORE);
+        matio_transpose_rows(buf, bounce, rows, r, n, cols, esize, 1);
+    }
+    MPI_File_close(&fh);
+    stats->seconds += MPI_Wtime() - start;
+    stats->bytes += (long long)rows * cols * esize;
+    free(bounce);
+}
+
+static inline void matio_write_columns(MPI_Comm comm, const char* path, uint32_t dtype, uint64_t total_rows,
+                                       uint64_t total_cols, int row0, int col0, int rows, int cols, const void* buf,
+                                       struct MatioStats* stats) {
+    MPI_Datatype etype = matio_mpi_type(dtype);
+    int esize;
+    MPI_Type_size(etype, &esize);
+    int chunks;
+    int chunk = matio_chunk_rows(comm, rows, cols, &chunks);
+    char* bounce = (char*)malloc((size_t)chunk * cols * esize + 1);
+
+    double start = MPI_Wtime();
+    MPI_File fh = matio_create(comm, path, dtype, total_rows, total_cols);
+    matio_set_view(fh, total_rows, total_cols, row0, col0, rows, cols, etype);
+    for (int c = 0; c < chunks; c++) {
+        int r = c * chunk;
+        int n = r >= rows ? 0 : rows - r < chunk ? rows - r : chunk;
+        matio_transpose_rows((void*)buf, bounce, rows, r, n, cols, esize, 0);
+        MPI_File_write_all(fh, bounce, n * cols, etype, MPI_STATUS_IGNORE);
+    }
+    MPI_File_close(&fh);
+    stats->seconds += MPI_Wtime() - start;
+    stats->bytes += (long long)rows * cols * esize;
+    free(bounce);
+}
+
+// Aggregate bandwidth: all bytes moved over the slowest rank's time.
+// Collective over comm, printed on its rank 0.
+static inline void matio_report(const char* what, const struct MatioStats* stats, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    long long bytes;
+    double seconds;
+    MPI_Reduce(&stats->bytes, &bytes, 1, MPI_LONG_LONG, MPI_SUM, 0, comm);
+    MPI_Reduce(&stats->seconds, &seconds, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    if (rank == 0) {
+        printf("io: %s %.1f MiB in %f s, %.1f MiB/s\n", what, bytes / 1048576.0, seconds,
+               seconds > 0 ? bytes / 1048576.0 / seconds : 0.0);
+    }
+}
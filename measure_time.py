@@ -1,37 +1,433 @@
 import argparse
+import csv
+import hashlib
+import itertools
+import json
+import math
 import matplotlib.pyplot as plt
 import matplotlib.ticker as ticker
+import os
 import pandas as pd
+import platform
+import random
+import re
+import shutil
+import socket
 import subprocess
+import sys
 import time
 
 
-threads_all = [1, 3, 5, 7, 10]
+# Phases of clock.h, in its order
+PHASES = ["distribute", "broadcast", "skew", "compute", "shift", "halo", "reduce", "gather"]
+
+# Roofline metrics of the compute phase: analytic (phase_work) and, with
+# --counters, from the hardware counters (counters.h)
+KERNEL_METRICS = ["gflops", "gbs", "intensity", "ipc", "llc_miss_rate", "llc_gbs"]
+
+# Sweep files for --filename, by the first name that matches
+SWEEPS = [("first", "sweeps/first.json"), ("sparse", "sweeps/sparse.json"), ("second", "sweeps/second.json"),
+          ("third", "sweeps/third.json")]
+
+# Defaults of the sweep file keys
+SWEEP_DEFAULTS = {
+    "runs": 10,
+    "warmup": 1,
+    "reps": 1,
+    "rep_warmup": 0,
+    "flush": False,
+    "counters": False,
+    "scaling": "strong",
+    "weak": None,
+    "flags": ["-O3", "-fopenmp"],
+    "max_failures": 3,
+    "timeout": None,
+    "bootstrap": 2000,
+    "confidence": 0.95,
+    "extract": {},
+    "derived": {},
+    "graphs": None,
+}
 
 
 def parse_args():
-    parser = argparse.ArgumentParser(description="Run an MPI program multiple times.")
+    parser = argparse.ArgumentParser(description="Run a sweep of MPI program launches and summarize the timings.")
+    parser.add_argument("--sweep", help="Sweep file (JSON) describing the cases, see sweeps/")
     parser.add_argument(
-        "--filename", required=True, help="Path to code file (e.g., first.c)"
+        "--filename", help="Code file (e.g., first.c); runs the matching sweep from sweeps/"
+    )
+    parser.add_argument("--retries", type=int, default=None, help="Measured runs per case (overrides the sweep)")
+    parser.add_argument("--warmup", type=int, default=None, help="Discarded runs per case (overrides the sweep)")
+    parser.add_argument(
+        "--reps", type=int, default=None, help="Timed reps inside each run, passed as --reps (overrides the sweep)"
+    )
+    parser.add_argument(
+        "--rep-warmup", type=int, default=None, help="Untimed reps before them, passed as --warmup (overrides the sweep)"
+    )
+    parser.add_argument(
+        "--flush", action="store_true", default=None, help="Flush the caches before every rep (passes --flush)"
+    )
+    parser.add_argument(
+        "--counters", action="store_true", default=None, help="Read the hardware counters (passes --counters)"
+    )
+    parser.add_argument(
+        "--roofline",
+        default=None,
+        help="Peak GFLOP/s and GB/s of the ranks' cores, comma-separated; draws the kernels on a roofline",
+    )
+    parser.add_argument(
+        "--scaling",
+        choices=["strong", "weak"],
+        default=None,
+        help="strong: the sizes of the grid as they are; weak: the sizes are per rank and grow with the ranks",
+    )
+    parser.add_argument(
+        "--bind", default=None, help="Comma-separated binding policies to sweep (mpiexec --bind-to: core,socket,numa,none)"
+    )
+    parser.add_argument(
+        "--map", default=None, help="Comma-separated mapping policies to sweep (mpiexec --map-by: core,socket,numa,node)"
+    )
+    parser.add_argument("--output", default="stats.csv", help="Summary file, one row per case")
+    parser.add_argument(
+        "--samples", default=None, help="Raw samples file, one row per run or rep (default: <output>_samples.csv)"
+    )
+    parser.add_argument("--fresh", action="store_true", help="Discard the samples file instead of resuming")
+    parser.add_argument("--shuffle", action="store_true", help="Run the cases in random order")
+    parser.add_argument("--parquet", action="store_true", help="Also write both tables as .parquet")
+    parser.add_argument("--no-graphs", action="store_true", help="Do not draw the graphs")
+    parser.add_argument(
+        "--omp-threads",
+        default=None,
+        help="Comma-separated OpenMP threads per rank to sweep (e.g. 1,2,4)",
+    )
+    parser.add_argument(
+        "--vectors",
+        default=None,
+        help="Comma-separated vector counts K for the matvec programs (e.g. 1,4,16)",
+    )
+    parser.add_argument(
+        "--dtypes",
+        default=None,
+        help="Comma-separated element types for the matvec programs (int32,int64,float32,float64)",
+    )
+    parser.add_argument(
+        "--ranks-per-node",
+        type=int,
+        default=None,
+        help="Place this many ranks per node (mpiexec --map-by ppr:N:node)",
     )
-    parser.add_argument("--retries", default=10, help="Number of retries")
-    parser.add_argument("--output", default="stats.csv", help="File for stats")
-
-    return parser.parse_args()
-
 
-def build(filename):
-    executable_filename = filename[: filename.rfind(".")]
-    subprocess.run(
-        ["mpicc", filename, "-o", executable_filename],
+    args = parser.parse_args()
+    if args.sweep is None:
+        if args.filename is None:
+            parser.error("one of --sweep or --filename is required")
+        matches = [path for name, path in SWEEPS if name in args.filename]
+        if not matches:
+            parser.error(f"no sweep for {args.filename}, pass --sweep")
+        args.sweep = os.path.join(os.path.dirname(os.path.abspath(__file__)), matches[0])
+    if args.samples is None:
+        args.samples = os.path.splitext(args.output)[0] + "_samples.csv"
+    # Grid overrides: key in the sweep grid -> values
+    args.overrides = {}
+    if args.omp_threads is not None:
+        args.overrides["omp_threads"] = [int(t) for t in args.omp_threads.split(",")]
+    if args.vectors is not None:
+        args.overrides["vectors"] = [int(k) for k in args.vectors.split(",")]
+    if args.dtypes is not None:
+        args.overrides["dtype"] = args.dtypes.split(",")
+    # Placement policies are added to the grid even if the sweep has none
+    args.placement = {}
+    if args.bind is not None:
+        args.placement["bind"] = args.bind.split(",")
+    if args.map is not None:
+        args.placement["map"] = args.map.split(",")
+    if args.placement and args.ranks_per_node is not None:
+        parser.error("--ranks-per-node is a mapping policy of its own, it does not combine with --bind/--map")
+    if args.roofline is not None:
+        args.roofline = [float(peak) for peak in args.roofline.split(",")]
+        if len(args.roofline) != 2:
+            parser.error("--roofline takes GFLOP/s,GB/s")
+    return args
+
+
+def load_sweep(args):
+    with open(args.sweep) as f:
+        sweep = {**SWEEP_DEFAULTS, **json.load(f)}
+    for key in ("name", "program", "args", "grid"):
+        if key not in sweep:
+            raise ValueError(f"{args.sweep}: missing '{key}'")
+    if "threads" not in sweep["grid"]:
+        raise ValueError(f"{args.sweep}: the grid needs 'threads' (processes)")
+    sweep["grid"].setdefault("omp_threads", [1])
+    for key, values in args.overrides.items():
+        if key in sweep["grid"]:
+            sweep["grid"][key] = values
+    sweep["grid"].update(args.placement)
+    if args.retries is not None:
+        sweep["runs"] = args.retries
+    if args.warmup is not None:
+        sweep["warmup"] = args.warmup
+    for key in ("reps", "rep_warmup", "flush", "counters", "scaling"):
+        if getattr(args, key) is not None:
+            sweep[key] = getattr(args, key)
+    if sweep["scaling"] == "weak" and not sweep["weak"]:
+        raise ValueError(f"{args.sweep}: weak scaling needs 'weak' (which size grows with the ranks)")
+    return sweep
+
+
+def weak_size(weak, base, processes):
+    # Work per rank stays that of base on one rank: the work grows as
+    # size ** exponent, so the size grows as processes ** (1 / exponent);
+    # rounded to the multiple the program needs ("sqrt": of sqrt(processes),
+    # the process grid side)
+    multiple = weak.get("multiple", 1)
+    if multiple == "sqrt":
+        multiple = max(1, math.isqrt(processes))
+    size = base * processes ** (1.0 / weak.get("exponent", 1))
+    return max(multiple, int(round(size / multiple)) * multiple)
+
+
+def sweep_cases(sweep):
+    # Every combination of the grid values, in the order of the file. In weak
+    # scaling the grid holds the one-rank sizes, kept as weak_base
+    keys = list(sweep["grid"])
+    for values in itertools.product(*(sweep["grid"][key] for key in keys)):
+        params = dict(zip(keys, values))
+        if sweep["scaling"] == "weak":
+            key = sweep["weak"]["key"]
+            params["weak_base"] = params[key]
+            params[key] = weak_size(sweep["weak"], params[key], params["threads"])
+        yield params, sweep["program"].format(**params)
+
+
+def program_options(sweep):
+    # In-process reps and counters of clock.h; absent at the defaults so every program accepts them
+    arguments = []
+    if sweep["reps"] != 1:
+        arguments.append(f"--reps={sweep['reps']}")
+    if sweep["rep_warmup"] != 0:
+        arguments.append(f"--warmup={sweep['rep_warmup']}")
+    if sweep["flush"]:
+        arguments.append("--flush")
+    if sweep["counters"]:
+        arguments.append("--counters")
+    return arguments
+
+
+def case_key(sweep, program, params):
+    # Samples taken with other reps or counter settings are a different case
+    return " ".join([program, json.dumps(params, sort_keys=True)] + program_options(sweep))
+
+
+def build(filename, flags):
+    executable_filename = os.path.splitext(filename)[0]
+    result = subprocess.run(
+        ["mpicc", *flags, filename, "-o", executable_filename, "-lm"],
         capture_output=True,
         text=True,
     )
+    if result.returncode != 0:
+        raise RuntimeError(f"build of {filename} failed:\n{result.stderr}")
     return executable_filename
 
 
+def first_line(command):
+    try:
+        result = subprocess.run(command, capture_output=True, text=True)
+    except OSError:
+        return ""
+    lines = result.stdout.strip().splitlines()
+    return lines[0].strip() if result.returncode == 0 and lines else ""
+
+
+def environment_info(flags):
+    # Recorded in every sample so runs from different machines or builds
+    # never get mixed up
+    cpu = platform.processor()
+    try:
+        with open("/proc/cpuinfo") as f:
+            models = [line.split(":", 1)[1].strip() for line in f if line.startswith("model name")]
+        cpu = models[0] if models else cpu
+    except OSError:
+        pass
+    commit = first_line(["git", "rev-parse", "--short", "HEAD"])
+    if commit and first_line(["git", "status", "--porcelain", "--untracked-files=no"]):
+        commit += "-dirty"
+    return {
+        "host": socket.gethostname(),
+        "cpu": cpu,
+        "cores": os.cpu_count(),
+        "mpi": first_line(["mpiexec", "--version"]),
+        "compiler": first_line(["mpicc", "--version"]),
+        "flags": " ".join(flags),
+        "commit": commit,
+    }
+
+
+def topology_info():
+    # One line for the samples and the full description for the topology
+    # file: hwloc's lstopo if installed, else lscpu and the NUMA nodes
+    fields = {}
+    lscpu = subprocess.run(["lscpu"], capture_output=True, text=True) if shutil.which("lscpu") else None
+    if lscpu is not None and lscpu.returncode == 0:
+        for line in lscpu.stdout.splitlines():
+            name, _, value = line.partition(":")
+            fields[name.strip()] = value.strip()
+    summary = (
+        f"{fields.get('Socket(s)', '?')} sockets x {fields.get('Core(s) per socket', '?')} cores x "
+        f"{fields.get('Thread(s) per core', '?')} threads, {fields.get('NUMA node(s)', '?')} NUMA nodes, "
+        f"L3 {fields.get('L3 cache', '?')}"
+    )
+    sections = []
+    for command in (["lstopo-no-graphics", "--of", "console"], ["lscpu"], ["numactl", "--hardware"]):
+        if shutil.which(command[0]):
+            result = subprocess.run(command, capture_output=True, text=True)
+            if result.returncode == 0:
+                sections.append(f"$ {' '.join(command)}\n{result.stdout}")
+    return summary, "\n".join(sections)
+
+
+def mpiexec_command(params, args):
+    processes, omp_threads = params["threads"], params["omp_threads"]
+    command = ["mpiexec", "-n", str(processes), "-x", f"OMP_NUM_THREADS={omp_threads}"]
+    if "map" in params or "bind" in params:
+        # PE=T gives each rank T cores for its team
+        if "map" in params:
+            command += ["--map-by", params["map"] + (f":PE={omp_threads}" if omp_threads > 1 else "")]
+        if "bind" in params:
+            command += ["--bind-to", params["bind"]]
+        command += ["--report-bindings"]
+    elif args.ranks_per_node is not None:
+        command += ["--map-by", f"ppr:{args.ranks_per_node}:node:PE={omp_threads}"]
+    elif omp_threads > 1:
+        # Default core binding would pin a rank's whole team to one core
+        command += ["--bind-to", "none"]
+    return command
+
+
+def parse_bindings(stderr):
+    # Open MPI's --report-bindings: "... MCW rank 3 bound to socket 0[core 3[hwt 0]]: [././././B/...]"
+    # or "MCW rank 3 is not bound", as "rank:mask" pairs
+    bindings = []
+    for match in re.finditer(r"MCW rank (\d+) (?:bound to .*?: (\S+)|is not bound)", stderr):
+        bindings.append(f"{match.group(1)}:{match.group(2) or 'unbound'}")
+    return " ".join(sorted(bindings, key=lambda b: int(b.split(":")[0])))
+
+
+def parse_record(stdout):
+    # The JSON line rank 0 prints at the end of a run (clock.h phases_report)
+    for line in stdout.splitlines():
+        if line.startswith("{"):
+            try:
+                return json.loads(line)
+            except json.JSONDecodeError:
+                return None
+    return None
+
+
+# Statistics
+
+
+def percentile(sorted_values, q):
+    # Linear interpolation between the closest ranks (numpy's default)
+    position = (len(sorted_values) - 1) * q
+    low = int(position)
+    high = min(low + 1, len(sorted_values) - 1)
+    return sorted_values[low] + (sorted_values[high] - sorted_values[low]) * (position - low)
+
+
+def median(values):
+    return percentile(sorted(values), 0.5)
+
+
+def bootstrap_ci(launches, resamples, confidence, seed):
+    # Percentile bootstrap interval of the median. Hierarchical: resamples the
+    # launches, then the reps of each drawn launch, since reps of one launch
+    # share its placement and are not independent of each other
+    values = [t for reps in launches for t in reps]
+    if len(values) < 2 or resamples <= 0:
+        return values[0], values[0]
+    rng = random.Random(seed)
+    medians = []
+    for _ in range(resamples):
+        drawn = [t for reps in rng.choices(launches, k=len(launches)) for t in rng.choices(reps, k=len(reps))]
+        medians.append(median(drawn))
+    medians.sort()
+    tail = (1.0 - confidence) / 2
+    return percentile(medians, tail), percentile(medians, 1.0 - tail)
+
+
+def outlier_flags(values):
+    # Tukey's fences: further than 1.5 IQR outside the quartiles
+    ordered = sorted(values)
+    q1, q3 = percentile(ordered, 0.25), percentile(ordered, 0.75)
+    low, high = q1 - 1.5 * (q3 - q1), q3 + 1.5 * (q3 - q1)
+    return [value < low or value > high for value in values]
+
+
+def time_stats(launches, sweep, seed):
+    # launches: the rep times of every measured run
+    times = [t for reps in launches for t in reps]
+    ordered = sorted(times)
+    outliers = outlier_flags(times)
+    kept = [t for t, outlier in zip(times, outliers) if not outlier]
+    mean = sum(kept) / len(kept)
+    std = (sum((t - mean) ** 2 for t in kept) / (len(kept) - 1)) ** 0.5 if len(kept) > 1 else 0.0
+    ci_low, ci_high = bootstrap_ci(launches, sweep["bootstrap"], sweep["confidence"], seed)
+    return {
+        "time": percentile(ordered, 0.5),
+        "time_mean": mean,
+        "time_std": std,
+        "time_min": ordered[0],
+        "time_p5": percentile(ordered, 0.05),
+        "time_p25": percentile(ordered, 0.25),
+        "time_p75": percentile(ordered, 0.75),
+        "time_p95": percentile(ordered, 0.95),
+        "time_max": ordered[-1],
+        "time_ci_low": ci_low,
+        "time_ci_high": ci_high,
+        "runs": len(times),
+        "launches": len(launches),
+        "outliers": sum(outliers),
+    }
+
+
+def series_keys(sweep):
+    # The parameters a scaling curve keeps fixed: all but the process count
+    # and, in weak scaling, the size that grows with it (weak_base stays)
+    keys = [key for key in sweep["grid"] if key != "threads"]
+    if sweep["scaling"] == "weak":
+        keys = [key for key in keys if key != sweep["weak"]["key"]] + ["weak_base"]
+    return keys
+
+
+def scaling_stats(rows, sweep):
+    # Against the fewest processes of each series (P0, time T0):
+    #   strong: speedup = T0 / T, efficiency = speedup * P0 / P
+    #   weak:   efficiency = T0 / T, speedup = efficiency * P / P0 (scaled speedup)
+    series = {}
+    for row in rows:
+        series.setdefault(tuple(row[key] for key in series_keys(sweep)), []).append(row)
+    for members in series.values():
+        reference = min(members, key=lambda row: row["threads"])
+        for row in members:
+            ratio = reference["time"] / row["time"] if row["time"] > 0 else 0.0
+            processes = row["threads"] / reference["threads"]
+            if sweep["scaling"] == "weak":
+                row["efficiency"], row["speedup"] = ratio, ratio * processes
+            else:
+                row["speedup"], row["efficiency"] = ratio, ratio / processes
+
+
+def only_pure_mpi(df):
+    # The graphs compare process counts; hybrid runs stay in the csv only
+    if "omp_threads" in df.columns:
+        df = df[df["omp_threads"] == 1].drop(columns="omp_threads")
+    return df
+
+
 def draw_graphs(output):
-    df = pd.read_csv(output)
+    df = only_pure_mpi(pd.read_csv(output))
   
     df_merged = pd.merge(
         df.copy(),
@@ -48,7 +444,7 @@ def draw_graphs(output):
     axes = axes.flatten()
     fig.suptitle("Задание 1 (Расчет числа пи)", fontsize=14)
 
-    for threads in threads_all:
+    for threads in sorted(df_merged["threads"].unique()):
         label = f"{threads} процесса"
         if threads == 1:
             label = "Последовательный"
@@ -104,7 +500,13 @@ def draw_graphs(output):
     plt.savefig(output_file, dpi=300)
 
 def draw_graphs_second(output):
-    df = pd.read_csv(output)
+    df = only_pure_mpi(pd.read_csv(output))
+    if "dtype" in df.columns:
+        draw_graphs_dtypes(df, output)
+        df = df[df["dtype"] == "int32"].drop(columns=["dtype"])
+    if "vectors" in df.columns:
+        draw_graphs_vectors(df, output)
+        df = df[df["vectors"] == 1].drop(columns=["vectors", "vectors_per_sec"])
     df['size'] = df['row_size'] * df['column_size']
 
     df_merged = pd.merge(
@@ -122,7 +524,7 @@ def draw_graphs_second(output):
     axes = axes.flatten()
     fig.suptitle("Задание 2 (Умножение матрицы на вектор)", fontsize=14)
 
-    for threads in threads_all:
+    for threads in sorted(df_merged["threads"].unique()):
         label = f"{threads} процесса"
         if threads not in (1, 5, 10):
             continue
@@ -176,29 +578,70 @@ def draw_graphs_second(output):
     output_file = output[:output.find('.')] + "_graph.png"
     plt.savefig(output_file, dpi=300)
 
-def draw_graphs_third(output):
-    threads_all = [1, 4]
-    data = []
-    with open(output, 'r') as f:
-        lines = f.readlines()
-        for i, line in enumerate(lines):
-            if i == 0:
+DTYPE_BYTES = {"int32": 4, "int64": 8, "float32": 4, "float64": 8}
+
+
+def draw_graphs_dtypes(df, output):
+    # Matrix bytes streamed per second for each element type, largest matrix,
+    # single vector, one line per algorithm
+    if df["dtype"].nunique() < 2:
+        return
+    df = df[df["vectors"] == 1] if "vectors" in df.columns else df
+    df = df[df["row_size"] * df["column_size"] == (df["row_size"] * df["column_size"]).max()].copy()
+    df["gb_per_sec"] = (
+        df["row_size"] * df["column_size"] * df["dtype"].map(DTYPE_BYTES) / df["time"] * 1e-9
+    )
+    dtypes = [d for d in DTYPE_BYTES if d in set(df["dtype"])]
+
+    fig, ax = plt.subplots(figsize=(8, 5))
+    for algorithm, cur_df in df.groupby("algorithm"):
+        cur_df = cur_df.set_index(["dtype", "threads"])["gb_per_sec"].unstack()
+        for threads in cur_df.columns:
+            if threads not in (1, 5, 10):
                 continue
-            parts = line.strip().split(',')
-            if len(parts) >= 4:
-                try:
-                    data.append({
-                        'threads': int(parts[0]),
-                        'points_number': int(parts[1]),
-                        'time': float(parts[3]) 
-                    })
-                except (ValueError, IndexError):
-                    continue
-    
-    df = pd.DataFrame(data)
+            ax.plot(dtypes, [cur_df[threads].get(d) for d in dtypes], "o-", label=f"{algorithm}, {threads}")
+    ax.set_title("Скорость чтения матрицы от типа элементов")
+    ax.set_xlabel("Тип элементов")
+    ax.set_ylabel("ГБ/с")
+    ax.legend()
+    ax.grid(True)
+
+    plt.tight_layout()
+    output_file = output[:output.find('.')] + "_dtypes_graph.png"
+    plt.savefig(output_file, dpi=300)
+
+
+def draw_graphs_vectors(df, output):
+    # Throughput of the batched mode as K grows, largest matrix, one line per
+    # algorithm and process count
+    vectors_all = sorted(df["vectors"].unique())
+    if len(vectors_all) < 2:
+        return
+    df = df[df["row_size"] * df["column_size"] == (df["row_size"] * df["column_size"]).max()]
+
+    fig, ax = plt.subplots(figsize=(8, 5))
+    for (algorithm, threads), cur_df in df.groupby(["algorithm", "threads"]):
+        if threads not in (1, 5, 10):
+            continue
+        cur_df = cur_df.sort_values("vectors")
+        ax.plot(cur_df["vectors"], cur_df["vectors_per_sec"], "o-", label=f"{algorithm}, {threads}")
+    ax.set_title("Пропускная способность от количества векторов K")
+    ax.set_xlabel("K")
+    ax.set_ylabel("Векторов в секунду")
+    ax.set_xscale("log", base=2)
+    ax.legend()
+    ax.grid(True)
+
+    plt.tight_layout()
+    output_file = output[:output.find('.')] + "_vectors_graph.png"
+    plt.savefig(output_file, dpi=300)
+
+def draw_graphs_third(output):
+    df = only_pure_mpi(pd.read_csv(output))[["threads", "points_number", "time"]]
 
     if len(df) == 0:
         raise ValueError(f"Не удалось загрузить данные из {output}")
+    threads_all = sorted(df["threads"].unique())
 
     df_merged = pd.merge(
         df.copy(),
@@ -254,171 +697,324 @@ def draw_graphs_third(output):
     plt.savefig(output.replace(".csv", "_third_graphs.png"), dpi=300)
     plt.show()
 
-def first_task(args):
-    threads_all = [1, 3, 5, 7, 10]
-    points_numbers = [
-        100,
-        1000,
-        10000,
-        100000,
-        1000000,
-        10000000,
-        100000000,
-        300000000,
-        1000000000
-    ]
+def draw_graphs_sparse(output):
+    df = only_pure_mpi(pd.read_csv(output))
+    df = df[df["size"] == df["size"].max()]
 
-    executable_filename = build(args.filename)
-
-    with open(args.output, "w") as f:
-        print("threads,pi,points_number,time", file=f)
-
-        for threads in threads_all:
-            for points_number in points_numbers:
-                cur_string = ""
-                times_sum = 0.0
-                for _ in range(args.retries):
-                    # Execute + measure time
-                    result = subprocess.run(
-                        [
-                            "mpiexec",
-                            "-n",
-                            str(threads),
-                            executable_filename,
-                            str(points_number),
-                        ],
-                        capture_output=True,
-                        text=True,
-                    )
-                    stdout = result.stdout
-                    time_string = stdout[stdout.find("|") + 1 : stdout.rfind("|")]
-                    print(time_string)
-                    cur_string = time_string[: time_string.rfind(",")]
-                    times_sum += float(time_string.split(",")[-1])
-
-                    time.sleep(0.1)
-
-                cur_string = f"{threads},{cur_string},{str(times_sum / args.retries)}"
-                print("final: ", cur_string)
-                print(cur_string, file=f)
-    draw_graphs(args.output)
-
-
-def second_task(args):
-    row_sizes = [10, 100, 1000]
-    column_sizes = [10, 100000]
-    filenames = ['second_blocks.c', 'second_rows.c', 'second_columns.c']
-    executable_filenames = []
-    
-    for filename in filenames:
-        executable_filenames.append(build(filename))
-    
-    with open(args.output, "w") as f:
-        print("algorithm,threads,total_sum,row_size,column_size,time", file=f)
-        for executable_filename in executable_filenames:
-            algorithm = executable_filename.split('_')[-1]
-            for threads in threads_all:
-                for row_size in row_sizes:
-                    for column_size in column_sizes:
-                        cur_string = ""
-                        times_sum = 0.0
-                        i = 0
-                        while i < args.retries:
-                            i += 1
-                            # Execute + measure time
-                            result = subprocess.run(
-                                [
-                                    "mpiexec",
-                                    "-n",
-                                    str(threads),
-                                    executable_filename,
-                                    str(row_size),
-                                    str(column_size)
-                                ],
-                                capture_output=True,
-                                text=True,
-                            )
-                            stdout = result.stdout
-                            if 'Incorrect' in stdout:
-                                break
-                            time_string = stdout[stdout.find("|") + 1 : stdout.rfind("|")]
-                            cur_string = time_string[: time_string.rfind(",")]
-                            try:
-                                times_sum += float(time_string.split(",")[-1])
-                            except:
-                                i -= 1
-                                continue
-
-                            print(time_string)
-                            time.sleep(0.1)
-
-                        if len(cur_string) == 0:
-                            continue
-                        cur_string = f"{algorithm},{threads},{cur_string},{str(times_sum / args.retries)}"
-                        print("final: ", cur_string)
-                        print(cur_string, file=f)
-    draw_graphs_second(args.output)
-
-def third_task(args):
-    threads_all = [1, 4]
-    points_numbers = [
-        100,
-        400,
-        800,
-        1200,
+    fig, axes = plt.subplots(1, 2, figsize=(12, 5))
+    fig.suptitle("Разреженная матрица (CSR)", fontsize=14)
+    for partition, cur_df in df.groupby("partition"):
+        cur_df = cur_df.sort_values("threads")
+        axes[0].plot(cur_df["threads"], cur_df["gflops"], "o-", label=partition)
+        axes[1].plot(cur_df["threads"], cur_df["halo_bytes"], "o-", label=partition)
 
-    ]
-    # Build
-    executable_filename = args.filename[: args.filename.rfind(".")]
-    subprocess.run(
-        ["mpicc", args.filename, "-o", executable_filename],
-        capture_output=True,
-        text=True,
+    axes[0].set_title("GFLOP/s от количества процессов")
+    axes[0].set_xlabel("Количество процессов")
+    axes[0].set_ylabel("GFLOP/s")
+    axes[0].legend()
+    axes[0].grid(True)
+
+    axes[1].set_title("Объем обмена (halo) за умножение")
+    axes[1].set_xlabel("Количество процессов")
+    axes[1].set_ylabel("Байт")
+    axes[1].legend()
+    axes[1].grid(True)
+
+    plt.tight_layout()
+    output_file = output[:output.find('.')] + "_graph.png"
+    plt.savefig(output_file, dpi=300)
+
+
+def draw_graphs_scaling(output, sweep):
+    # Speedup and efficiency against the process count, one curve per series
+    df = pd.read_csv(output)
+    keys = [key for key in series_keys(sweep) if key in df.columns and df[key].nunique() > 1]
+    weak = sweep["scaling"] == "weak"
+
+    fig, axes = plt.subplots(1, 2, figsize=(12, 5))
+    fig.suptitle("Слабая масштабируемость" if weak else "Сильная масштабируемость", fontsize=14)
+    for values, cur_df in (df.groupby(keys) if keys else [((), df)]):
+        values = values if isinstance(values, tuple) else (values,)
+        label = ", ".join(f"{key}={value}" for key, value in zip(keys, values)) or sweep["name"]
+        cur_df = cur_df.sort_values("threads")
+        axes[0].plot(cur_df["threads"], cur_df["speedup"], "o-", label=label)
+        axes[1].plot(cur_df["threads"], cur_df["efficiency"], "o-", label=label)
+
+    processes = sorted(df["threads"].unique())
+    axes[0].plot(processes, [p / processes[0] for p in processes], "k--", label="идеал")
+    axes[1].axhline(1.0, color="k", linestyle="--", label="идеал")
+    axes[0].set_title("Масштабированное ускорение" if weak else "Ускорение")
+    axes[0].set_xlabel("Количество процессов")
+    axes[0].set_ylabel("Ускорение")
+    axes[0].legend(fontsize=7)
+    axes[0].grid(True)
+
+    axes[1].set_title("Эффективность")
+    axes[1].set_xlabel("Количество процессов")
+    axes[1].set_ylabel("Эффективность")
+    axes[1].legend(fontsize=7)
+    axes[1].grid(True)
+
+    plt.tight_layout()
+    output_file = output[:output.find('.')] + "_scaling.png"
+    plt.savefig(output_file, dpi=300)
+
+
+def draw_roofline(output, peak_gflops, peak_gbs):
+    # Every case's compute phase at its arithmetic intensity, under
+    # min(peak GFLOP/s, intensity * peak GB/s); the peaks are the caller's
+    df = pd.read_csv(output)
+    if "compute_intensity" not in df.columns:
+        print("no compute_intensity in the summary, skipping the roofline", file=sys.stderr)
+        return
+    df = df.dropna(subset=["compute_intensity", "compute_gflops"])
+    df = df[df["compute_intensity"] > 0]
+    if df.empty:
+        return
+
+    low = min(df["compute_intensity"].min(), peak_gflops / peak_gbs) / 4
+    high = max(df["compute_intensity"].max(), peak_gflops / peak_gbs) * 4
+    intensities = [low * (high / low) ** (i / 100) for i in range(101)]
+    plt.figure(figsize=(8, 6))
+    plt.plot(intensities, [min(peak_gflops, i * peak_gbs) for i in intensities], "k-", label="roofline")
+    for program, cur_df in df.groupby("program"):
+        plt.scatter(cur_df["compute_intensity"], cur_df["compute_gflops"], label=program)
+    plt.xscale("log")
+    plt.yscale("log")
+    plt.title("Roofline: фаза compute")
+    plt.xlabel("Арифметическая интенсивность, FLOP/байт")
+    plt.ylabel("GFLOP/s")
+    plt.legend()
+    plt.grid(True, which="both")
+
+    plt.tight_layout()
+    output_file = output[:output.find('.')] + "_roofline.png"
+    plt.savefig(output_file, dpi=300)
+
+
+# Sweep runner. Every launch (one row per rep) is appended to the samples file as soon as it
+# finishes, so an interrupted campaign resumes where it stopped: cases that
+# already have their warmup and measured runs are skipped, partial ones are
+# topped up. The summary is rebuilt from all samples at the end.
+
+
+def sample_columns(sweep):
+    return (
+        ["timestamp", "host", "cpu", "cores", "mpi", "compiler", "flags", "commit", "topology", "case", "program"]
+        + list(sweep["grid"])
+        + (["weak_base"] if sweep["scaling"] == "weak" else [])
+        + ["launch", "warmup", "rep", "status", "time", "result", "bindings"]
+        + [f"{phase}_time" for phase in PHASES]
+        + [f"compute_{metric}" for metric in KERNEL_METRICS]
+        + list(sweep["extract"])
     )
 
-    with open(args.output, "w") as f:
-        print("threads,points_number,time", file=f)
-
-        for threads in threads_all:
-            for points_number in points_numbers:
-                cur_string = ""
-                times_sum = 0.0
-                for i in range(args.retries):
-                    # Execute + measure time
-                    result = subprocess.run(
-                        [
-                            "mpiexec",
-                            "-n",
-                            str(threads),
-                            executable_filename,
-                            str(points_number),
-                        ],
-                        capture_output=True,
-                        text=True,
-                    )
-                    stdout = result.stdout
-                    time_string = stdout[stdout.find("|") + 1 : stdout.rfind("|")]
-                    print(time_string)
-                    cur_string = time_string[: time_string.rfind(",")]
-                    times_sum += float(time_string.split(",")[-1])
-
-                    time.sleep(0.1)
-
-                cur_string = f"{threads},{cur_string},{str(times_sum / args.retries)}"
-                print("final: ", cur_string)
-                print(cur_string, file=f)
-    draw_graphs_third(args.output)
+
+def read_progress(path, columns, env):
+    # Launches per case of an earlier run of the same sweep (their first rep rows)
+    progress = {}
+    if not os.path.exists(path):
+        return progress
+    with open(path, newline="") as f:
+        reader = csv.DictReader(f)
+        if reader.fieldnames != columns:
+            raise ValueError(f"{path} was written by a different sweep, pass --fresh or another --samples")
+        others = set()
+        for row in reader:
+            if row["rep"] not in ("", "0"):
+                continue
+            state = progress.setdefault(row["case"], {"ok": 0, "warmup": 0, "failed": 0, "invalid": False})
+            if row["status"] == "ok":
+                state["warmup" if row["warmup"] == "1" else "ok"] += 1
+            elif row["status"] == "invalid":
+                state["invalid"] = True
+            else:
+                state["failed"] += 1
+            if (row["host"], row["commit"]) != (env["host"], env["commit"]):
+                others.add(f"{row['host']} {row['commit']}")
+    if others:
+        print(f"warning: {path} also has samples from {', '.join(sorted(others))}", file=sys.stderr)
+    return progress
+
+
+def run_once(sweep, params, executable, args):
+    command = (
+        mpiexec_command(params, args)
+        + [executable]
+        + [argument.format(**params) for argument in sweep["args"]]
+        + program_options(sweep)
+    )
+    try:
+        result = subprocess.run(command, capture_output=True, text=True, timeout=sweep["timeout"])
+    except subprocess.TimeoutExpired:
+        return "failed", None, "", ""
+    record = parse_record(result.stdout)
+    bindings = parse_bindings(result.stderr)
+    # The programs reject sizes and process counts they do not support, and
+    # mpiexec placements the machine cannot give
+    refused = re.search(r"more\s+processes\s+than\s+cpus", result.stderr)
+    if "Incorrect" in result.stdout or "error:" in result.stderr or refused:
+        return "invalid", None, result.stdout, bindings
+    if result.returncode != 0 or record is None:
+        return "failed", None, result.stdout, bindings
+    return "ok", record, result.stdout, bindings
+
+
+def run_sweep(args, sweep):
+    cases = list(sweep_cases(sweep))
+    if args.shuffle:
+        # Spreads slow drifts of the machine over all cases
+        random.shuffle(cases)
+    topology, description = topology_info()
+    env = {**environment_info(sweep["flags"]), "topology": topology}
+    # The machine the samples come from, next to them
+    with open(os.path.splitext(args.samples)[0] + "_topology.txt", "w") as f:
+        f.write(f"{env['host']}: {topology}\n\n{description}")
+    executables = {program: build(program, sweep["flags"]) for program in dict.fromkeys(p for _, p in cases)}
+
+    columns = sample_columns(sweep)
+    if args.fresh and os.path.exists(args.samples):
+        os.remove(args.samples)
+    progress = read_progress(args.samples, columns, env)
+    new_file = not os.path.exists(args.samples)
+    with open(args.samples, "a", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=columns)
+        if new_file:
+            writer.writeheader()
+        for params, program in cases:
+            key = case_key(sweep, program, params)
+            state = progress.get(key, {"ok": 0, "warmup": 0, "failed": 0, "invalid": False})
+            while not state["invalid"] and (state["warmup"] < sweep["warmup"] or state["ok"] < sweep["runs"]):
+                if state["failed"] >= sweep["max_failures"]:
+                    print(f"giving up on {key} after {state['failed']} failed runs", file=sys.stderr)
+                    break
+                warmup = state["warmup"] < sweep["warmup"]
+                status, record, stdout, bindings = run_once(sweep, params, executables[program], args)
+                base = {
+                    **env,
+                    **params,
+                    "timestamp": time.strftime("%Y-%m-%dT%H:%M:%S"),
+                    "case": key,
+                    "program": program,
+                    "launch": state["ok"] + state["warmup"] + state["failed"],
+                    "warmup": int(warmup),
+                    "status": status,
+                }
+                row = {**base, "bindings": bindings}
+                # One row per timed rep; the result, phases and extracts stay on the first
+                reps = []
+                if record is not None:
+                    reps = record.get("samples", [record["time"]])
+                    row["rep"] = 0
+                    row["time"] = reps[0]
+                    row["result"] = json.dumps(record["result"])
+                    for phase, stats in record["phases"].items():
+                        row[f"{phase}_time"] = stats["max"]
+                    compute = record["phases"].get("compute", {})
+                    for metric in KERNEL_METRICS:
+                        row[f"compute_{metric}"] = compute.get(metric, compute.get("counters", {}).get(metric, ""))
+                for name, pattern in sweep["extract"].items():
+                    match = re.search(pattern, stdout)
+                    row[name] = match.group(1) if match else ""
+                writer.writerow(row)
+                for rep, seconds in enumerate(reps[1:], 1):
+                    writer.writerow({**base, "rep": rep, "time": seconds})
+                f.flush()
+
+                if status == "ok":
+                    state["warmup" if warmup else "ok"] += 1
+                elif status == "invalid":
+                    state["invalid"] = True
+                else:
+                    state["failed"] += 1
+                print(key, status, "warmup" if warmup else "", record["time"] if record is not None else "")
+
+
+def number(text):
+    for convert in (int, float):
+        try:
+            return convert(text)
+        except ValueError:
+            pass
+    return text
+
+
+def summarize(args, sweep):
+    samples = {}
+    reps = {}
+    with open(args.samples, newline="") as f:
+        for row in csv.DictReader(f):
+            if row["status"] == "ok" and row["warmup"] == "0":
+                if row["rep"] in ("", "0"):
+                    samples.setdefault(row["case"], []).append(row)
+                reps.setdefault(row["case"], {}).setdefault(row["launch"], []).append(float(row["time"]))
+
+    # Phase columns of the phases the programs reported, in clock.h order
+    phases = [p for p in PHASES if any(s[f"{p}_time"] for case in samples.values() for s in case)]
+    metrics = [
+        f"compute_{m}" for m in KERNEL_METRICS if any(s[f"compute_{m}"] for case in samples.values() for s in case)
+    ]
+    rows = []
+    for params, program in sweep_cases(sweep):
+        key = case_key(sweep, program, params)
+        if key not in samples:
+            continue
+        case_samples = samples[key]
+        row = {"program": os.path.splitext(os.path.basename(program))[0], **params}
+        for name, value in json.loads(case_samples[-1]["result"]).items():
+            row.setdefault(name, value)
+        # Seeded by the case so the intervals are reproducible
+        seed = int(hashlib.sha256(key.encode()).hexdigest()[:8], 16)
+        row.update(time_stats(list(reps[key].values()), sweep, seed))
+        for phase in phases:
+            values = [float(s[f"{phase}_time"]) for s in case_samples if s[f"{phase}_time"]]
+            row[f"{phase}_time"] = median(values) if values else 0.0
+        for metric in metrics:
+            values = [float(s[metric]) for s in case_samples if s[metric]]
+            row[metric] = median(values) if values else ""
+        for name in sweep["extract"]:
+            row[name] = number(case_samples[-1][name])
+        for name, expression in sweep["derived"].items():
+            row[name] = eval(expression, {}, dict(row))
+        row["bindings"] = case_samples[-1]["bindings"]
+        rows.append(row)
+        print(
+            f"{key}: median {row['time']:.6g} s, {sweep['confidence']:.0%} ci "
+            f"[{row['time_ci_low']:.6g}, {row['time_ci_high']:.6g}], {row['runs']} runs in {row['launches']} launches, "
+            f"{row['outliers']} outliers"
+        )
+
+    scaling_stats(rows, sweep)
+    columns = list(dict.fromkeys(name for row in rows for name in row))
+    with open(args.output, "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=columns, restval="")
+        writer.writeheader()
+        writer.writerows(rows)
+
+
+GRAPHS = {
+    "first": draw_graphs,
+    "second": draw_graphs_second,
+    "sparse": draw_graphs_sparse,
+    "third": draw_graphs_third,
+}
 
 
 def main():
     args = parse_args()
-
-    if "first" in args.filename:
-        first_task(args)
-    elif "second" in args.filename:
-        second_task(args)
-    elif "third" in args.filename:
-        third_task(args)
+    sweep = load_sweep(args)
+    run_sweep(args, sweep)
+    summarize(args, sweep)
+    if args.parquet:
+        for path in (args.samples, args.output):
+            pd.read_csv(path).to_parquet(os.path.splitext(path)[0] + ".parquet")
+    if not args.no_graphs:
+        # The task graphs compare equal sizes, which weak scaling does not have
+        if sweep["graphs"] and sweep["scaling"] == "strong":
+            GRAPHS[sweep["graphs"]](args.output)
+        draw_graphs_scaling(args.output, sweep)
+    if args.roofline and not args.no_graphs:
+        draw_roofline(args.output, *args.roofline)
 
 
 if __name__ == "__main__":
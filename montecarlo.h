@@ -0,0 +1,454 @@
+#pragma once
+
+#include "rng.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PI_HAVE_X86 1
+#endif
+
+// Point p of the global sequence takes words 2p and 2p + 1 of the points
+// stream, so the set of points depends only on (seed, POINTS_NUMBER) and not on
+// how the index range is split between ranks.
+//
+// Each coordinate is the centre of a cell on a 2^bits grid over the unit
+// quarter: x = (2i + 1) / 2^(bits + 1). Comparing in those integer units keeps
+// x * x + y * y exact, so every ISA path returns the same count as the scalar
+// one. The float grid is coarser (2^11) because its squares must fit in 24 bits.
+#define PI_GRID_BITS_DOUBLE 25
+#define PI_GRID_BITS_FLOAT 11
+#define PI_BATCH_BLOCKS 512
+
+enum PiPrecision {
+    PI_DOUBLE = 0,
+    PI_FLOAT = 1,
+};
+
+// Counts hits among blocks [firstBlock, firstBlock + blocks), two points each.
+typedef long long (*PiBlocksFn)(uint64_t seed, uint64_t firstBlock, long long blocks);
+
+struct PiKernel {
+    const char* isa;
+    enum PiPrecision precision;
+    PiBlocksFn countBlocks;
+};
+
+static inline long long countInsWords(const uint32_t* words, long long pointsNumber,
+                                      enum PiPrecision precision) {
+    long long inCircle = 0;
+    if (precision == PI_DOUBLE) {
+        const double radius2 = (double)(1ULL << (2 * PI_GRID_BITS_DOUBLE + 2));
+        for (long long i = 0; i < pointsNumber; ++i) {
+            double x = (double)((words[2 * i] >> (31 - PI_GRID_BITS_DOUBLE)) | 1);
+            double y = (double)((words[2 * i + 1] >> (31 - PI_GRID_BITS_DOUBLE)) | 1);
+            inCircle += x * x + y * y < radius2;
+        }
+    } else {
+        const float radius2 = (float)(1u << (2 * PI_GRID_BITS_FLOAT + 2));
+        for (long long i = 0; i < pointsNumber; ++i) {
+            float x = (float)((words[2 * i] >> (31 - PI_GRID_BITS_FLOAT)) | 1);
+            float y = (float)((words[2 * i + 1] >> (31 - PI_GRID_BITS_FLOAT)) | 1);
+            inCircle += x * x + y * y < radius2;
+        }
+    }
+    return inCircle;
+}
+
+static inline long long countInsScalar(uint64_t seed, uint64_t firstBlock, long long blocks,
+                                       enum PiPrecision precision) {
+    uint32_t words[4 * PI_BATCH_BLOCKS];
+    long long inCircle = 0;
+    while (blocks > 0) {
+        long long batch = blocks < PI_BATCH_BLOCKS ? blocks : PI_BATCH_BLOCKS;
+        philox_fill(seed, RNG_STREAM_POINTS, firstBlock, words, batch);
+        inCircle += countInsWords(words, 2 * batch, precision);
+        firstBlock += batch;
+        blocks -= batch;
+    }
+    return inCircle;
+}
+
+static inline long long countInsScalarDouble(uint64_t seed, uint64_t firstBlock, long long blocks) {
+    return countInsScalar(seed, firstBlock, blocks, PI_DOUBLE);
+}
+
+static inline long long countInsScalarFloat(uint64_t seed, uint64_t firstBlock, long long blocks) {
+    return countInsScalar(seed, firstBlock, blocks, PI_FLOAT);
+}
+
+// The SIMD paths run Philox in 32-bit lanes, one block per lane, so the four
+// output words of a block end up in the same lane of c0..c3: (c0, c1) is the
+// first point of the block and (c2, c3) the second. 32x32->64 products are
+// taken with mul_epu32 on the even lanes and on the odd lanes shifted down.
+
+#ifdef PI_HAVE_X86
+
+// Counter lanes for blocks first .. first + lanes - 1. The low words are an
+// iota on top of the base unless they wrap past 2^32 inside the group.
+static inline int piCounterWraps(uint64_t first, int lanes) {
+    return (uint32_t)first > UINT32_MAX - (uint32_t)(lanes - 1);
+}
+
+static inline void piCounterLanes(uint64_t first, int lanes, uint32_t* lo, uint32_t* hi) {
+    for (int l = 0; l < lanes; l++) {
+        lo[l] = (uint32_t)(first + l);
+        hi[l] = (uint32_t)((first + l) >> 32);
+    }
+}
+
+// Rounds for `groups` independent counter vectors at once; interleaving them
+// hides the latency of the multiply -> blend -> xor chain of a single round.
+#define PI_PHILOX_ROUNDS(VEC, MUL, SRLI64, SLLI64, BLEND_ODD, XOR, SET1, c, groups, seed)      \
+    do {                                                                                       \
+        VEC m0 = SET1((int)PHILOX_M0), m1 = SET1((int)PHILOX_M1);                              \
+        uint32_t k0 = (uint32_t)(seed), k1 = (uint32_t)((seed) >> 32);                         \
+        for (int round = 0; round < 10; round++) {                                             \
+            VEC key0 = SET1((int)k0), key1 = SET1((int)k1);                                    \
+            for (int g = 0; g < (groups); g++) {                                               \
+                VEC e0 = MUL(c[g][0], m0), o0 = MUL(SRLI64(c[g][0], 32), m0);                  \
+                VEC e1 = MUL(c[g][2], m1), o1 = MUL(SRLI64(c[g][2], 32), m1);                  \
+                VEC lo0 = BLEND_ODD(e0, SLLI64(o0, 32)), hi0 = BLEND_ODD(SRLI64(e0, 32), o0);  \
+                VEC lo1 = BLEND_ODD(e1, SLLI64(o1, 32)), hi1 = BLEND_ODD(SRLI64(e1, 32), o1);  \
+                c[g][0] = XOR(XOR(hi1, c[g][1]), key0);                                        \
+                c[g][1] = lo1;                                                                 \
+                c[g][2] = XOR(XOR(hi0, c[g][3]), key1);                                        \
+                c[g][3] = lo0;                                                                 \
+            }                                                                                  \
+            k0 += PHILOX_W0;                                                                   \
+            k1 += PHILOX_W1;                                                                   \
+        }                                                                                      \
+    } while (0)
+
+static inline __m128i piBlendOddSse2(__m128i even, __m128i odd) {
+    const __m128i oddMask = _mm_set_epi32(-1, 0, -1, 0);
+    return _mm_or_si128(_mm_andnot_si128(oddMask, even), _mm_and_si128(oddMask, odd));
+}
+
+#define PI_SSE2_GROUPS 2
+
+static inline void piPhiloxSse2(uint64_t seed, uint64_t first, __m128i c[PI_SSE2_GROUPS][4]) {
+    for (int g = 0; g < PI_SSE2_GROUPS; g++, first += 4) {
+        if (piCounterWraps(first, 4)) {
+            uint32_t lo[4], hi[4];
+            piCounterLanes(first, 4, lo, hi);
+            c[g][0] = _mm_loadu_si128((const __m128i*)lo);
+            c[g][1] = _mm_loadu_si128((const __m128i*)hi);
+        } else {
+            c[g][0] = _mm_add_epi32(_mm_set1_epi32((int)first), _mm_setr_epi32(0, 1, 2, 3));
+            c[g][1] = _mm_set1_epi32((int)(first >> 32));
+        }
+        c[g][2] = _mm_set1_epi32(RNG_STREAM_POINTS);
+        c[g][3] = _mm_setzero_si128();
+    }
+    PI_PHILOX_ROUNDS(__m128i, _mm_mul_epu32, _mm_srli_epi64, _mm_slli_epi64, piBlendOddSse2,
+                     _mm_xor_si128, _mm_set1_epi32, c, PI_SSE2_GROUPS, seed);
+}
+
+static inline long long countInsSse2Double(uint64_t seed, uint64_t firstBlock, long long blocks) {
+    const __m128d radius2 = _mm_set1_pd((double)(1ULL << (2 * PI_GRID_BITS_DOUBLE + 2)));
+    const __m128i one = _mm_set1_epi32(1);
+    long long inCircle = 0;
+    long long b = 0;
+    for (; b + 4 * PI_SSE2_GROUPS <= blocks; b += 4 * PI_SSE2_GROUPS) {
+        __m128i c[PI_SSE2_GROUPS][4];
+        piPhiloxSse2(seed, firstBlock + b, c);
+        for (int g = 0; g < PI_SSE2_GROUPS; g++) {
+            __m128d sq[4][2];
+            for (int w = 0; w < 4; w++) {
+                __m128i v = _mm_or_si128(_mm_srli_epi32(c[g][w], 31 - PI_GRID_BITS_DOUBLE), one);
+                __m128d lo = _mm_cvtepi32_pd(v);
+                __m128d hi = _mm_cvtepi32_pd(_mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+                sq[w][0] = _mm_mul_pd(lo, lo);
+                sq[w][1] = _mm_mul_pd(hi, hi);
+            }
+            for (int h = 0; h < 2; h++) {
+                __m128d r0 = _mm_add_pd(sq[0][h], sq[1][h]);
+                __m128d r1 = _mm_add_pd(sq[2][h], sq[3][h]);
+                inCircle += __builtin_popcount(_mm_movemask_pd(_mm_cmplt_pd(r0, radius2)));
+                inCircle += __builtin_popcount(_mm_movemask_pd(_mm_cmplt_pd(r1, radius2)));
+            }
+        }
+    }
+    return inCircle + countInsScalarDouble(seed, firstBlock + b, blocks - b);
+}
+
+static inline long long countInsSse2Float(uint64_t seed, uint64_t firstBlock, long long blocks) {
+    const __m128 radius2 = _mm_set1_ps((float)(1u << (2 * PI_GRID_BITS_FLOAT + 2)));
+    const __m128i one = _mm_set1_epi32(1);
+    long long inCircle = 0;
+    long long b = 0;
+    for (; b + 4 * PI_SSE2_GROUPS <= blocks; b += 4 * PI_SSE2_GROUPS) {
+        __m128i c[PI_SSE2_GROUPS][4];
+        piPhiloxSse2(seed, firstBlock + b, c);
+        for (int g = 0; g < PI_SSE2_GROUPS; g++) {
+            __m128 sq[4];
+            for (int w = 0; w < 4; w++) {
+                __m128 v = _mm_cvtepi32_ps(_mm_or_si128(_mm_srli_epi32(c[g][w], 31 - PI_GRID_BITS_FLOAT), one));
+                sq[w] = _mm_mul_ps(v, v);
+            }
+            __m128 r0 = _mm_add_ps(sq[0], sq[1]);
+            __m128 r1 = _mm_add_ps(sq[2], sq[3]);
+            inCircle += __builtin_popcount(_mm_movemask_ps(_mm_cmplt_ps(r0, radius2)));
+            inCircle += __builtin_popcount(_mm_movemask_ps(_mm_cmplt_ps(r1, radius2)));
+        }
+    }
+    return inCircle + countInsScalarFloat(seed, firstBlock + b, blocks - b);
+}
+
+#define PI_AVX2_BLEND_ODD(even, odd) _mm256_blend_epi32(even, odd, 0xAA)
+
+#define PI_AVX2_GROUPS 2
+
+__attribute__((target("avx2,popcnt")))
+static inline void piPhiloxAvx2(uint64_t seed, uint64_t first, __m256i c[PI_AVX2_GROUPS][4]) {
+    for (int g = 0; g < PI_AVX2_GROUPS; g++, first += 8) {
+        if (piCounterWraps(first, 8)) {
+            uint32_t lo[8], hi[8];
+            piCounterLanes(first, 8, lo, hi);
+            c[g][0] = _mm256_loadu_si256((const __m256i*)lo);
+            c[g][1] = _mm256_loadu_si256((const __m256i*)hi);
+        } else {
+            c[g][0] = _mm256_add_epi32(_mm256_set1_epi32((int)first), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+            c[g][1] = _mm256_set1_epi32((int)(first >> 32));
+        }
+        c[g][2] = _mm256_set1_epi32(RNG_STREAM_POINTS);
+        c[g][3] = _mm256_setzero_si256();
+    }
+    PI_PHILOX_ROUNDS(__m256i, _mm256_mul_epu32, _mm256_srli_epi64, _mm256_slli_epi64, PI_AVX2_BLEND_ODD,
+                     _mm256_xor_si256, _mm256_set1_epi32, c, PI_AVX2_GROUPS, seed);
+}
+
+__attribute__((target("avx2,popcnt")))
+static inline long long countInsAvx2Double(uint64_t seed, uint64_t firstBlock, long long blocks) {
+    const __m256d radius2 = _mm256_set1_pd((double)(1ULL << (2 * PI_GRID_BITS_DOUBLE + 2)));
+    const __m256i one = _mm256_set1_epi32(1);
+    long long inCircle = 0;
+    long long b = 0;
+    for (; b + 8 * PI_AVX2_GROUPS <= blocks; b += 8 * PI_AVX2_GROUPS) {
+        __m256i c[PI_AVX2_GROUPS][4];
+        piPhiloxAvx2(seed, firstBlock + b, c);
+        for (int g = 0; g < PI_AVX2_GROUPS; g++) {
+            __m256d sq[4][2];
+            for (int w = 0; w < 4; w++) {
+                __m256i v = _mm256_or_si256(_mm256_srli_epi32(c[g][w], 31 - PI_GRID_BITS_DOUBLE), one);
+                __m256d lo = _mm256_cvtepi32_pd(_mm256_castsi256_si128(v));
+                __m256d hi = _mm256_cvtepi32_pd(_mm256_extracti128_si256(v, 1));
+                sq[w][0] = _mm256_mul_pd(lo, lo);
+                sq[w][1] = _mm256_mul_pd(hi, hi);
+            }
+            for (int h = 0; h < 2; h++) {
+                __m256d r0 = _mm256_add_pd(sq[0][h], sq[1][h]);
+                __m256d r1 = _mm256_add_pd(sq[2][h], sq[3][h]);
+                inCircle += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(r0, radius2, _CMP_LT_OQ)));
+                inCircle += __builtin_popcount(_mm256_movemask_pd(_mm256_cmp_pd(r1, radius2, _CMP_LT_OQ)));
+            }
+        }
+    }
+    return inCircle + countInsScalarDouble(seed, firstBlock + b, blocks - b);
+}
+
+__attribute__((target("avx2,popcnt")))
+static inline long long countInsAvx2Float(uint64_t seed, uint64_t firstBlock, long long blocks) {
+    const __m256 radius2 = _mm256_set1_ps((float)(1u << (2 * PI_GRID_BITS_FLOAT + 2)));
+    const __m256i one = _mm256_set1_epi32(1);
+    long long inCircle = 0;
+    long long b = 0;
+    for (; b + 8 * PI_AVX2_GROUPS <= blocks; b += 8 * PI_AVX2_GROUPS) {
+        __m256i c[PI_AVX2_GROUPS][4];
+        piPhiloxAvx2(seed, firstBlock + b, c);
+        for (int g = 0; g < PI_AVX2_GROUPS; g++) {
+            __m256 sq[4];
+            for (int w = 0; w < 4; w++) {
+                __m256 v = _mm256_cvtepi32_ps(_mm256_or_si256(_mm256_srli_epi32(c[g][w], 31 - PI_GRID_BITS_FLOAT), one));
+                sq[w] = _mm256_mul_ps(v, v);
+            }
+            __m256 r0 = _mm256_add_ps(sq[0], sq[1]);
+            __m256 r1 = _mm256_add_ps(sq[2], sq[3]);
+            inCircle += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(r0, radius2, _CMP_LT_OQ)));
+            inCircle += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(r1, radius2, _CMP_LT_OQ)));
+        }
+    }
+    return inCircle + countInsScalarFloat(seed, firstBlock + b, blocks - b);
+}
+
+#define PI_AVX512_BLEND_ODD(even, odd) _mm512_mask_blend_epi32(0xAAAA, even, odd)
+
+#define PI_AVX512_GROUPS 4
+
+__attribute__((target("avx512f,popcnt")))
+static inline void piPhiloxAvx512(uint64_t seed, uint64_t first, __m512i c[PI_AVX512_GROUPS][4]) {
+    const __m512i iota = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    for (int g = 0; g < PI_AVX512_GROUPS; g++, first += 16) {
+        if (piCounterWraps(first, 16)) {
+            uint32_t lo[16], hi[16];
+            piCounterLanes(first, 16, lo, hi);
+            c[g][0] = _mm512_loadu_si512(lo);
+            c[g][1] = _mm512_loadu_si512(hi);
+        } else {
+            c[g][0] = _mm512_add_epi32(_mm512_set1_epi32((int)first), iota);
+            c[g][1] = _mm512_set1_epi32((int)(first >> 32));
+        }
+        c[g][2] = _mm512_set1_epi32(RNG_STREAM_POINTS);
+        c[g][3] = _mm512_setzero_si512();
+    }
+    PI_PHILOX_ROUNDS(__m512i, _mm512_mul_epu32, _mm512_srli_epi64, _mm512_slli_epi64, PI_AVX512_BLEND_ODD,
+                     _mm512_xor_si512, _mm512_set1_epi32, c, PI_AVX512_GROUPS, seed);
+}
+
+__attribute__((target("avx512f,popcnt")))
+static inline long long countInsAvx512Double(uint64_t seed, uint64_t firstBlock, long long blocks) {
+    const __m512d radius2 = _mm512_set1_pd((double)(1ULL << (2 * PI_GRID_BITS_DOUBLE + 2)));
+    const __m512i one = _mm512_set1_epi32(1);
+    long long inCircle = 0;
+    long long b = 0;
+    for (; b + 16 * PI_AVX512_GROUPS <= blocks; b += 16 * PI_AVX512_GROUPS) {
+        __m512i c[PI_AVX512_GROUPS][4];
+        piPhiloxAvx512(seed, firstBlock + b, c);
+        for (int g = 0; g < PI_AVX512_GROUPS; g++) {
+            __m512d sq[4][2];
+            for (int w = 0; w < 4; w++) {
+                __m512i v = _mm512_or_si512(_mm512_srli_epi32(c[g][w], 31 - PI_GRID_BITS_DOUBLE), one);
+                __m512d lo = _mm512_cvtepi32_pd(_mm512_castsi512_si256(v));
+                __m512d hi = _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(v, 1));
+                sq[w][0] = _mm512_mul_pd(lo, lo);
+                sq[w][1] = _mm512_mul_pd(hi, hi);
+            }
+            for (int h = 0; h < 2; h++) {
+                __m512d r0 = _mm512_add_pd(sq[0][h], sq[1][h]);
+                __m512d r1 = _mm512_add_pd(sq[2][h], sq[3][h]);
+                inCircle += __builtin_popcount(_mm512_cmp_pd_mask(r0, radius2, _CMP_LT_OQ));
+                inCircle += __builtin_popcount(_mm512_cmp_pd_mask(r1, radius2, _CMP_LT_OQ));
+            }
+        }
+    }
+    return inCircle + countInsScalarDouble(seed, firstBlock + b, blocks - b);
+}
+
+__attribute__((target("avx512f,popcnt")))
+static inline long long countInsAvx512Float(uint64_t seed, uint64_t firstBlock, long long blocks) {
+    const __m512 radius2 = _mm512_set1_ps((float)(1u << (2 * PI_GRID_BITS_FLOAT + 2)));
+    const __m512i one = _mm512_set1_epi32(1);
+    long long inCircle = 0;
+    long long b = 0;
+    for (; b + 16 * PI_AVX512_GROUPS <= blocks; b += 16 * PI_AVX512_GROUPS) {
+        __m512i c[PI_AVX512_GROUPS][4];
+        piPhiloxAvx512(seed, firstBlock + b, c);
+        for (int g = 0; g < PI_AVX512_GROUPS; g++) {
+            __m512 sq[4];
+            for (int w = 0; w < 4; w++) {
+                __m512 v = _mm512_cvtepi32_ps(_mm512_or_si512(_mm512_srli_epi32(c[g][w], 31 - PI_GRID_BITS_FLOAT), one));
+                sq[w] = _mm512_mul_ps(v, v);
+            }
+            __m512 r0 = _mm512_add_ps(sq[0], sq[1]);
+            __m512 r1 = _mm512_add_ps(sq[2], sq[3]);
+            inCircle += __builtin_popcount(_mm512_cmp_ps_mask(r0, radius2, _CMP_LT_OQ));
+            inCircle += __builtin_popcount(_mm512_cmp_ps_mask(r1, radius2, _CMP_LT_OQ));
+        }
+    }
+    return inCircle + countInsScalarFloat(seed, firstBlock + b, blocks - b);
+}
+
+#endif
+
+static const struct PiKernel piKernels[] = {
+    {"scalar", PI_DOUBLE, countInsScalarDouble},
+    {"scalar", PI_FLOAT, countInsScalarFloat},
+#ifdef PI_HAVE_X86
+    {"sse2", PI_DOUBLE, countInsSse2Double},
+    {"sse2", PI_FLOAT, countInsSse2Float},
+    {"avx2", PI_DOUBLE, countInsAvx2Double},
+    {"avx2", PI_FLOAT, countInsAvx2Float},
+    {"avx512", PI_DOUBLE, countInsAvx512Double},
+    {"avx512", PI_FLOAT, countInsAvx512Float},
+#endif
+};
+
+static inline int piIsaSupported(const char* isa) {
+    if (strcmp(isa, "scalar") == 0) {
+        return 1;
+    }
+#ifdef PI_HAVE_X86
+    __builtin_cpu_init();
+    if (strcmp(isa, "sse2") == 0) {
+        return __builtin_cpu_supports("sse2");
+    }
+    if (strcmp(isa, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    }
+    if (strcmp(isa, "avx512") == 0) {
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("popcnt");
+    }
+#endif
+    return 0;
+}
+
+// Picks the kernel for isa ("auto" = widest supported); NULL if unavailable.
+static inline const struct PiKernel* piSelectKernel(const char* isa, enum PiPrecision precision) {
+    const struct PiKernel* best = NULL;
+    for (size_t i = 0; i < sizeof(piKernels) / sizeof(piKernels[0]); i++) {
+        const struct PiKernel* kernel = &piKernels[i];
+        if (kernel->precision != precision || !piIsaSupported(kernel->isa)) {
+            continue;
+        }
+        if (strcmp(isa, "auto") == 0 || strcmp(isa, kernel->isa) == 0) {
+            best = kernel;
+        }
+    }
+    return best;
+}
+
+// Counts hits among points [first, first + pointsNumber) of the global sequence.
+static inline long long countIns(const struct PiKernel* kernel, uint64_t seed,
+                                 long long first, long long pointsNumber) {
+    uint32_t words[4];
+    long long inCircle = 0;
+    long long end = first + pointsNumber;
+
+    if (first < end && first % 2 != 0) {
+        philox_fill(seed, RNG_STREAM_POINTS, first / 2, words, 1);
+        inCircle += countInsWords(words + 2, 1, kernel->precision);
+        ++first;
+    }
+    if (first < end) {
+        inCircle += kernel->countBlocks(seed, first / 2, (end - first) / 2);
+    }
+    if (first < end && end % 2 != 0) {
+        philox_fill(seed, RNG_STREAM_POINTS, end / 2, words, 1);
+        inCircle += countInsWords(words, 1, kernel->precision);
+    }
+    return inCircle;
+}
+
+// Stratified sampling: a round of 4^k points cuts the quarter into 2^k x 2^k
+// strata and puts point s of the round into stratum s, at the position its
+// random words give inside that stratum (the top k bits of each grid
+// coordinate are the stratum's, the rest come from the words). Only strata
+// the arc crosses contribute variance, so a round's count varies far less
+// than that of 4^k independent points. Counts blocks [firstBlock, firstBlock
+// + blocks) of the round whose first block is roundBlock; 0 < k < grid bits.
+static inline long long countInsStratified(uint64_t seed, uint64_t roundBlock, long long firstBlock,
+                                           long long blocks, int strataBits, enum PiPrecision precision) {
+    uint32_t words[4 * PI_BATCH_BLOCKS];
+    int gridBits = precision == PI_DOUBLE ? PI_GRID_BITS_DOUBLE : PI_GRID_BITS_FLOAT;
+    int strataShift = gridBits - strataBits;
+    int wordShift = 32 - strataShift;
+    uint32_t strataMask = (1u << strataBits) - 1;
+    long long inCircle = 0;
+    while (blocks > 0) {
+        long long batch = blocks < PI_BATCH_BLOCKS ? blocks : PI_BATCH_BLOCKS;
+        philox_fill(seed, RNG_STREAM_POINTS, roundBlock + firstBlock, words, batch);
+        for (long long i = 0; i < 2 * batch; ++i) {
+            // A round has 4^k points, more than 32 bits hold for k > 16
+            uint64_t stratum = (uint64_t)(2 * firstBlock + i);
+            uint32_t sx = (uint32_t)(stratum >> strataBits), sy = (uint32_t)stratum & strataMask;
+            words[2 * i] = (sx << strataShift | words[2 * i] >> wordShift) << (32 - gridBits);
+            words[2 * i + 1] = (sy << strataShift | words[2 * i + 1] >> wordShift) << (32 - gridBits);
+        }
+        inCircle += countInsWords(words, 2 * batch, precision);
+        firstBlock += batch;
+        blocks -= batch;
+    }
+    return inCircle;
+}
@@ -0,0 +1,246 @@
+#pragma once
+
+#include "dtype.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Matrix times a panel of K vectors in one pass over the matrix.
+//
+// The panel X is cols x K, row-major (X[j * K + v] is entry j of vector v), so
+// the K values that multiply one matrix element are contiguous. The kernel
+// keeps an MULTIVEC_RB x MULTIVEC_KB tile of Y in registers: each matrix
+// element is loaded once per tile and multiplied into MULTIVEC_KB vector lanes,
+// so the matrix is streamed once per MULTIVEC_KB vectors instead of once per
+// vector. The matrix is addressed through a row and a column stride, which
+// covers both row-major blocks (rows, blocks) and the column-major local slice
+// of the column split.
+//
+// Like the single-vector kernels, the loops are stamped out once per
+// DTYPE_LIST entry: the matrix and X hold the element type, Y (and the tile)
+// the accumulator type, so int32 panels sum into int64.
+
+#define MULTIVEC_RB 4
+#define MULTIVEC_KB 16
+// Scratch bytes per task for column-major matrices (rs == 1): a chunk of rows
+// of Y, transposed, stays cache-resident while every column streams past
+#define MULTIVEC_CM_BYTES 65536
+
+// Rows [first, first + n) of the panel, entry j of vector v being
+// (j + v) % 5 + 1; vector 0 is the single vector of the K = 1 runs.
+static inline void multivecFill(void* X, int first, int n, int K, uint32_t code) {
+    for (int j = 0; j < n; j++) {
+        for (int v = 0; v < K; v++) {
+            dtype_store(X, (size_t)j * K + v, (first + j + v) % 5 + 1, code);
+        }
+    }
+}
+
+typedef void (*MultivecRowsFn)(const void* M, int rs, int cs, int rb, int cols, const void* X, int K,
+                               const void* Xtail, void* Y);
+
+// multivecTile_<name>: one rb x kb tile of Y against all columns.
+//
+// multivecColumnsBody_<name>: column-major slice. A 4-row register tile would
+// touch a new cache line of every column per tile. Instead a chunk of rb rows
+// of Y is kept transposed (kc x rb) in yt, and four columns at a time update it
+// with kc contiguous fused axpys, the same shape as the single-vector column
+// kernel. The vectors go through yt kc = MULTIVEC_CM_BYTES / (rb * sizeof(A))
+// at a time (all K unless K alone overflows the scratch).
+//
+// multivecRowsBody_<name>: one block of rb <= MULTIVEC_RB rows against all K
+// vectors. The last K % MULTIVEC_KB vectors come zero-padded to a full tile in
+// Xtail, so every tile runs with constant bounds and keeps its accumulators in
+// registers.
+#define MULTIVEC_DEFINE_BODY(name, T, A, ...)                                                                      \
+    __attribute__((always_inline)) static inline void multivecTile_##name(                                         \
+        const T* M, int rs, int cs, int cols, const T* X, int ldx, A* Y, int ldy, int rb, int kb) {                \
+        A acc[MULTIVEC_RB][MULTIVEC_KB];                                                                           \
+        for (int r = 0; r < rb; r++) {                                                                             \
+            _Pragma("omp simd") for (int v = 0; v < kb; v++) {                                                     \
+                acc[r][v] = Y[r * ldy + v];                                                                        \
+            }                                                                                                      \
+        }                                                                                                          \
+        for (int j = 0; j < cols; j++) {                                                                           \
+            const T* x = X + (size_t)j * ldx;                                                                      \
+            for (int r = 0; r < rb; r++) {                                                                         \
+                T a = M[(size_t)r * rs + (size_t)j * cs];                                                          \
+                _Pragma("omp simd") for (int v = 0; v < kb; v++) {                                                 \
+                    acc[r][v] += (A)a * x[v];                                                                      \
+                }                                                                                                  \
+            }                                                                                                      \
+        }                                                                                                          \
+        for (int r = 0; r < rb; r++) {                                                                             \
+            _Pragma("omp simd") for (int v = 0; v < kb; v++) {                                                     \
+                Y[r * ldy + v] = acc[r][v];                                                                        \
+            }                                                                                                      \
+        }                                                                                                          \
+    }                                                                                                              \
+                                                                                                                   \
+    __attribute__((always_inline)) static inline void multivecColumnsBody_##name(const T* M, int cs, int rb,       \
+                                                                                int cols, const T* X, int K,      \
+                                                                                A* Y) {                           \
+        A yt[MULTIVEC_CM_BYTES / sizeof(A)];                                                                       \
+        int kc_max = (int)(MULTIVEC_CM_BYTES / sizeof(A)) / rb;                                                    \
+        for (int v0 = 0; v0 < K; v0 += kc_max) {                                                                   \
+            int kc = K - v0 < kc_max ? K - v0 : kc_max;                                                            \
+            for (int r = 0; r < rb; r++) {                                                                         \
+                for (int v = 0; v < kc; v++) {                                                                     \
+                    yt[v * rb + r] = Y[(size_t)r * K + v0 + v];                                                    \
+                }                                                                                                  \
+            }                                                                                                      \
+            int j = 0;                                                                                             \
+            for (; j + 4 <= cols; j += 4) {                                                                        \
+                const T* a0 = M + (size_t)j * cs;                                                                  \
+                const T* a1 = a0 + cs;                                                                             \
+                const T* a2 = a1 + cs;                                                                             \
+                const T* a3 = a2 + cs;                                                                             \
+                const T* x = X + (size_t)j * K + v0;                                                               \
+                for (int v = 0; v < kc; v++) {                                                                     \
+                    A x0 = x[v], x1 = x[K + v], x2 = x[2 * K + v], x3 = x[3 * K + v];                              \
+                    A* y = yt + v * rb;                                                                            \
+                    _Pragma("omp simd") for (int r = 0; r < rb; r++) {                                             \
+                        y[r] += x0 * a0[r] + x1 * a1[r] + x2 * a2[r] + x3 * a3[r];                                 \
+                    }                                                                                              \
+                }                                                                                                  \
+            }                                                                                                      \
+            for (; j < cols; j++) {                                                                                \
+                const T* a0 = M + (size_t)j * cs;                                                                  \
+                for (int v = 0; v < kc; v++) {                                                                     \
+                    A x0 = X[(size_t)j * K + v0 + v];                                                              \
+                    A* y = yt + v * rb;                                                                            \
+                    _Pragma("omp simd") for (int r = 0; r < rb; r++) {                                             \
+                        y[r] += x0 * a0[r];                                                                        \
+                    }                                                                                              \
+                }                                                                                                  \
+            }                                                                                                      \
+            for (int r = 0; r < rb; r++) {                                                                         \
+                for (int v = 0; v < kc; v++) {                                                                     \
+                    Y[(size_t)r * K + v0 + v] = yt[v * rb + r];                                                    \
+                }                                                                                                  \
+            }                                                                                                      \
+        }                                                                                                          \
+    }                                                                                                              \
+                                                                                                                   \
+    __attribute__((always_inline)) static inline void multivecRowsBody_##name(                                     \
+        const void* M_, int rs, int cs, int rb, int cols, const void* X_, int K, const void* Xtail_, void* Y_) {   \
+        const T* M = (const T*)M_;                                                                                 \
+        const T* X = (const T*)X_;                                                                                 \
+        const T* Xtail = (const T*)Xtail_;                                                                         \
+        A* Y = (A*)Y_;                                                                                             \
+        if (rs == 1 && cs != 1) {                                                                                  \
+            multivecColumnsBody_##name(M, cs, rb, cols, X, K, Y);                                                  \
+            return;                                                                                                \
+        }                                                                                                          \
+        int full = K / MULTIVEC_KB * MULTIVEC_KB;                                                                  \
+        for (int v = 0; v < full; v += MULTIVEC_KB) {                                                              \
+            if (rb == MULTIVEC_RB) {                                                                               \
+                multivecTile_##name(M, rs, cs, cols, X + v, K, Y + v, K, MULTIVEC_RB, MULTIVEC_KB);                \
+            } else {                                                                                               \
+                multivecTile_##name(M, rs, cs, cols, X + v, K, Y + v, K, rb, MULTIVEC_KB);                         \
+            }                                                                                                      \
+        }                                                                                                          \
+        if (full == K) {                                                                                           \
+            return;                                                                                                \
+        }                                                                                                          \
+        int kb = K - full;                                                                                         \
+        A y[MULTIVEC_RB * MULTIVEC_KB] = {0};                                                                      \
+        for (int r = 0; r < rb; r++) {                                                                             \
+            for (int v = 0; v < kb; v++) {                                                                         \
+                y[r * MULTIVEC_KB + v] = Y[r * K + full + v];                                                      \
+            }                                                                                                      \
+        }                                                                                                          \
+        if (rb == MULTIVEC_RB) {                                                                                   \
+            multivecTile_##name(M, rs, cs, cols, Xtail, MULTIVEC_KB, y, MULTIVEC_KB, MULTIVEC_RB, MULTIVEC_KB);    \
+        } else {                                                                                                   \
+            multivecTile_##name(M, rs, cs, cols, Xtail, MULTIVEC_KB, y, MULTIVEC_KB, rb, MULTIVEC_KB);             \
+        }                                                                                                          \
+        for (int r = 0; r < rb; r++) {                                                                             \
+            for (int v = 0; v < kb; v++) {                                                                         \
+                Y[r * K + full + v] = y[r * MULTIVEC_KB + v];                                                      \
+            }                                                                                                      \
+        }                                                                                                          \
+    }
+
+DTYPE_LIST(MULTIVEC_DEFINE_BODY)
+
+// The same loops compiled per ISA: 32-bit lane multiplies (pmulld) are not in
+// the SSE2 baseline, so without these the vector lanes are emulated.
+#define MULTIVEC_DEFINE_ISA(name, suffix, attributes)                                                              \
+    attributes static void multivecRows##suffix##_##name(const void* M, int rs, int cs, int rb, int cols,          \
+                                                          const void* X, int K, const void* Xtail, void* Y) {      \
+        multivecRowsBody_##name(M, rs, cs, rb, cols, X, K, Xtail, Y);                                              \
+    }
+#define MULTIVEC_DEFAULT(name, ...) MULTIVEC_DEFINE_ISA(name, Default, )
+#define MULTIVEC_DEFAULT_ENTRY(name, ...) multivecRowsDefault_##name,
+DTYPE_LIST(MULTIVEC_DEFAULT)
+static const MultivecRowsFn multivecRowsDefault[] = {DTYPE_LIST(MULTIVEC_DEFAULT_ENTRY)};
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MULTIVEC_AVX2(name, ...) MULTIVEC_DEFINE_ISA(name, Avx2, __attribute__((target("avx2"))))
+#define MULTIVEC_AVX2_ENTRY(name, ...) multivecRowsAvx2_##name,
+#define MULTIVEC_AVX512(name, ...) MULTIVEC_DEFINE_ISA(name, Avx512, __attribute__((target("avx512f,avx512dq"))))
+#define MULTIVEC_AVX512_ENTRY(name, ...) multivecRowsAvx512_##name,
+DTYPE_LIST(MULTIVEC_AVX2)
+DTYPE_LIST(MULTIVEC_AVX512)
+static const MultivecRowsFn multivecRowsAvx2[] = {DTYPE_LIST(MULTIVEC_AVX2_ENTRY)};
+static const MultivecRowsFn multivecRowsAvx512[] = {DTYPE_LIST(MULTIVEC_AVX512_ENTRY)};
+#endif
+
+static inline MultivecRowsFn multivecSelectRows(int id) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq")) {
+        return multivecRowsAvx512[id];
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return multivecRowsAvx2[id];
+    }
+#endif
+    return multivecRowsDefault[id];
+}
+
+// Y (rows x K, dtype->acc) += M (rows x cols, dtype->elem, element (i, j) at
+// M[i * rs + j * cs]) * X. The parallel loop stays out of the per-ISA
+// functions: the outlined OpenMP body would not inherit their target
+// attribute.
+static inline void multivecMultiply(const struct Dtype* dtype, const void* M, int rs, int cs, int rows, int cols,
+                                    const void* X, int K, void* Y) {
+    MultivecRowsFn kernel = multivecSelectRows(dtype->id);
+    size_t elem_size = dtype_size(dtype->elem), acc_size = dtype_size(dtype->acc);
+    int step = MULTIVEC_RB;
+    if (rs == 1 && cs != 1) {
+        // As many rows as fit the scratch with all K vectors (at least one,
+        // the body then splits K), but enough chunks for the team
+        int threads = 1;
+#ifdef _OPENMP
+        threads = omp_get_max_threads();
+#endif
+        int per_thread = (rows + threads - 1) / threads;
+        int fit = (int)(MULTIVEC_CM_BYTES / acc_size) / K;
+        step = fit < per_thread ? fit : per_thread;
+        step = step < 1 ? 1 : step;
+    }
+
+    int full = K / MULTIVEC_KB * MULTIVEC_KB;
+    char* Xtail = NULL;
+    if (full < K && step == MULTIVEC_RB) {
+        Xtail = (char*)calloc((size_t)cols * MULTIVEC_KB, elem_size);
+        for (int j = 0; j < cols; j++) {
+            memcpy(Xtail + (size_t)j * MULTIVEC_KB * elem_size, (const char*)X + ((size_t)j * K + full) * elem_size,
+                   (K - full) * elem_size);
+        }
+    }
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < rows; i += step) {
+        int rb = rows - i < step ? rows - i : step;
+        kernel((const char*)M + (size_t)i * rs * elem_size, rs, cs, rb, cols, X, K, Xtail,
+               (char*)Y + (size_t)i * K * acc_size);
+    }
+    free(Xtail);
+}
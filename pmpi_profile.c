@@ -0,0 +1,784 @@
+// Communication profile through the standard PMPI interface: every MPI call
+// the programs make below is wrapped, timed and counted, and MPI_Finalize
+// writes a summary. No source change is needed, either link it in
+//
+//   mpicc -O2 -fPIC -shared pmpi_profile.c -o libpmpi_profile.so
+//   mpicc -O3 second_rows.c -o second_rows -L. -lpmpi_profile -Wl,-rpath,.
+//
+// or preload it into an existing binary:
+//
+//   mpiexec -n 4 -x LD_PRELOAD=./libpmpi_profile.so ./second_rows 1000 1000
+//
+// For each rank, communicator and call the profile keeps the number of calls,
+// the bytes the rank sends and receives (the payload of its own buffers:
+// count * type size, so a broadcast is count bytes sent on the root and count
+// bytes received elsewhere, whatever tree the library uses) and the time
+// spent inside the calls. Nonblocking and persistent operations are charged
+// on their post/start, and the time of Wait/Waitall/Test on them goes to the
+// same operation (for Startall/Waitall, to the first request of the list).
+//
+// Communicators are named by their members in MPI_COMM_WORLD ranks ("world",
+// or "4 ranks: 0 2 4 6"), so the same communicator has the same name on every
+// rank and the ranks' records can be merged. Rank 0 prints one line per call
+// and communicator (calls and bytes summed over the ranks, time min/mean/max
+// over the ranks that made the call) and the time in MPI per rank, to stderr
+// or to the file in PMPI_PROFILE_OUTPUT. PMPI_PROFILE_CSV=FILE also writes
+// every rank's raw records.
+//
+// The programs only call MPI from the main thread (MPI_THREAD_FUNNELED), so
+// the tables need no locking.
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(OPEN_MPI) && OPEN_MPI
+#include <mpi-ext.h>
+#endif
+
+// Persistent collectives are MPI_<name>_init in MPI 4, and MPIX_<name>_init
+// in the pcollreq extension of the MPI 3.1 Open MPI releases, which is what
+// iterate.h calls there; the wrappers below define whichever the programs use
+#if MPI_VERSION >= 4
+#define PROFILE_PCOLL(name) MPI_##name
+#define PROFILE_PPCOLL(name) PMPI_##name
+#elif defined(OMPI_HAVE_MPI_EXT_PCOLLREQ) && OMPI_HAVE_MPI_EXT_PCOLLREQ
+#define PROFILE_PCOLL(name) MPIX_##name
+#define PROFILE_PPCOLL(name) PMPIX_##name
+#endif
+
+// X(name) once per wrapped operation
+#define PROFILE_OPS(X)                                                                                            \
+    X(Send)                                                                                                       \
+    X(Recv)                                                                                                       \
+    X(Sendrecv)                                                                                                   \
+    X(Sendrecv_replace)                                                                                           \
+    X(Send_init)                                                                                                  \
+    X(Recv_init)                                                                                                  \
+    X(Barrier)                                                                                                    \
+    X(Bcast)                                                                                                      \
+    X(Reduce)                                                                                                     \
+    X(Allreduce)                                                                                                  \
+    X(Iallreduce)                                                                                                 \
+    X(Reduce_scatter)                                                                                             \
+    X(Scatter)                                                                                                    \
+    X(Scatterv)                                                                                                   \
+    X(Gather)                                                                                                     \
+    X(Gatherv)                                                                                                    \
+    X(Allgather)                                                                                                  \
+    X(Allgatherv)                                                                                                 \
+    X(Alltoall)                                                                                                   \
+    X(Alltoallv)                                                                                                  \
+    X(Alltoallw)                                                                                                  \
+    X(Neighbor_alltoallv)                                                                                         \
+    X(Allreduce_init)                                                                                             \
+    X(Allgather_init)                                                                                             \
+    X(Allgatherv_init)                                                                                            \
+    X(Reduce_init)                                                                                                \
+    X(Reduce_scatter_init)                                                                                        \
+    X(Fetch_and_op)                                                                                               \
+    X(Win_flush)                                                                                                  \
+    X(Wait)
+
+#define PROFILE_ENUM(name) OP_##name,
+enum ProfileOp { PROFILE_OPS(PROFILE_ENUM) OP_COUNT };
+#undef PROFILE_ENUM
+
+#define PROFILE_NAME(name) #name,
+static const char* const op_names[OP_COUNT] = {PROFILE_OPS(PROFILE_NAME)};
+#undef PROFILE_NAME
+
+#define PROFILE_MAX_COMMS 64
+#define PROFILE_MAX_HANDLES 256
+#define PROFILE_MAX_REQUESTS 256
+#define PROFILE_LABEL 64
+// Members listed in a communicator name before it is cut short
+#define PROFILE_LABEL_RANKS 8
+
+struct OpStats {
+    long long calls;
+    long long sent, recv;
+    double seconds;
+};
+
+struct CommSlot {
+    char label[PROFILE_LABEL];
+    struct OpStats ops[OP_COUNT];
+};
+
+// One merged record, as gathered on rank 0 and written to the csv
+struct Record {
+    char label[PROFILE_LABEL];
+    int rank;
+    int op;
+    long long calls;
+    long long sent, recv;
+    double seconds;
+};
+
+// A request the profile knows: its operation, communicator and (persistent
+// ones) the bytes of one start
+struct TrackedRequest {
+    MPI_Request request;
+    int op, slot;
+    long long sent, recv;
+    int persistent;
+};
+
+static struct CommSlot slots[PROFILE_MAX_COMMS];
+static int slot_count;
+// Handle caches, dropped on MPI_Comm_free/MPI_Win_free because the handles
+// are reused; unnamed requests and overflow land in the last slot
+static MPI_Comm comm_handles[PROFILE_MAX_HANDLES];
+static int comm_handle_slots[PROFILE_MAX_HANDLES];
+static int comm_handle_count;
+static MPI_Win win_handles[PROFILE_MAX_HANDLES];
+static int win_handle_slots[PROFILE_MAX_HANDLES];
+static int win_handle_count;
+static struct TrackedRequest requests[PROFILE_MAX_REQUESTS];
+static int request_count;
+static double init_time;
+
+static int slot_for_label(const char* label) {
+    for (int s = 0; s < slot_count; s++) {
+        if (strcmp(slots[s].label, label) == 0) {
+            return s;
+        }
+    }
+    if (slot_count == PROFILE_MAX_COMMS) {
+        return PROFILE_MAX_COMMS - 1;
+    }
+    snprintf(slots[slot_count].label, PROFILE_LABEL, "%s",
+             slot_count == PROFILE_MAX_COMMS - 1 ? "other" : label);
+    return slot_count++;
+}
+
+static int slot_for_group(MPI_Group group) {
+    MPI_Group world;
+    PMPI_Comm_group(MPI_COMM_WORLD, &world);
+    int same;
+    PMPI_Group_compare(group, world, &same);
+    char label[PROFILE_LABEL];
+    if (same == MPI_IDENT) {
+        snprintf(label, sizeof(label), "world");
+    } else {
+        int size;
+        PMPI_Group_size(group, &size);
+        int shown = size > PROFILE_LABEL_RANKS ? PROFILE_LABEL_RANKS : size;
+        int ranks[PROFILE_LABEL_RANKS + 1], world_ranks[PROFILE_LABEL_RANKS + 1];
+        for (int i = 0; i < shown; i++) {
+            ranks[i] = i;
+        }
+        // The last member too, so long communicators stay apart
+        ranks[shown] = size - 1;
+        PMPI_Group_translate_ranks(group, shown + 1, ranks, world, world_ranks);
+        int length = snprintf(label, sizeof(label), "%d ranks:", size);
+        for (int i = 0; i < shown && length < (int)sizeof(label); i++) {
+            length += snprintf(label + length, sizeof(label) - length, " %d", world_ranks[i]);
+        }
+        if (shown < size && length < (int)sizeof(label)) {
+            snprintf(label + length, sizeof(label) - length, " ... %d", world_ranks[shown]);
+        }
+    }
+    PMPI_Group_free(&world);
+    return slot_for_label(label);
+}
+
+static int slot_for_comm(MPI_Comm comm) {
+    for (int i = 0; i < comm_handle_count; i++) {
+        if (comm_handles[i] == comm) {
+            return comm_handle_slots[i];
+        }
+    }
+    MPI_Group group;
+    PMPI_Comm_group(comm, &group);
+    int slot = slot_for_group(group);
+    PMPI_Group_free(&group);
+    if (comm_handle_count < PROFILE_MAX_HANDLES) {
+        comm_handles[comm_handle_count] = comm;
+        comm_handle_slots[comm_handle_count++] = slot;
+    }
+    return slot;
+}
+
+static int slot_for_win(MPI_Win win) {
+    for (int i = 0; i < win_handle_count; i++) {
+        if (win_handles[i] == win) {
+            return win_handle_slots[i];
+        }
+    }
+    MPI_Group group;
+    PMPI_Win_get_group(win, &group);
+    int slot = slot_for_group(group);
+    PMPI_Group_free(&group);
+    if (win_handle_count < PROFILE_MAX_HANDLES) {
+        win_handles[win_handle_count] = win;
+        win_handle_slots[win_handle_count++] = slot;
+    }
+    return slot;
+}
+
+static void add(int slot, enum ProfileOp op, long long calls, long long sent, long long recv, double seconds) {
+    struct OpStats* stats = &slots[slot].ops[op];
+    stats->calls += calls;
+    stats->sent += sent;
+    stats->recv += recv;
+    stats->seconds += seconds;
+}
+
+static long long bytes(int count, MPI_Datatype type) {
+    if (count <= 0 || type == MPI_DATATYPE_NULL) {
+        return 0;
+    }
+    int size;
+    PMPI_Type_size(type, &size);
+    return (long long)count * size;
+}
+
+static long long bytes_sum(const int* counts, int n, MPI_Datatype type) {
+    long long total = 0;
+    for (int i = 0; i < n; i++) {
+        total += bytes(counts[i], type);
+    }
+    return total;
+}
+
+static int comm_rank(MPI_Comm comm) {
+    int rank;
+    PMPI_Comm_rank(comm, &rank);
+    return rank;
+}
+
+static int comm_size(MPI_Comm comm) {
+    int size;
+    PMPI_Comm_size(comm, &size);
+    return size;
+}
+
+static void track(MPI_Request request, enum ProfileOp op, int slot, long long sent, long long recv, int persistent) {
+    if (request_count < PROFILE_MAX_REQUESTS) {
+        requests[request_count++] = (struct TrackedRequest){request, op, slot, sent, recv, persistent};
+    }
+}
+
+static struct TrackedRequest* find_request(MPI_Request request) {
+    for (int i = 0; i < request_count; i++) {
+        if (requests[i].request == request) {
+            return &requests[i];
+        }
+    }
+    return NULL;
+}
+
+static void untrack(MPI_Request request) {
+    struct TrackedRequest* tracked = find_request(request);
+    if (tracked) {
+        *tracked = requests[--request_count];
+    }
+}
+
+// Charges the wait on a list of requests to the first one the profile knows,
+// and forgets the nonblocking ones that completed
+static void charge_wait(int count, const MPI_Request* before, const MPI_Request* after, double seconds) {
+    struct TrackedRequest* charged = NULL;
+    for (int i = 0; i < count && !charged; i++) {
+        charged = find_request(before[i]);
+    }
+    if (charged) {
+        add(charged->slot, charged->op, 0, 0, 0, seconds);
+    } else {
+        add(slot_for_label("requests"), OP_Wait, 1, 0, 0, seconds);
+    }
+    for (int i = 0; i < count; i++) {
+        struct TrackedRequest* tracked = find_request(before[i]);
+        if (tracked && !tracked->persistent && after[i] == MPI_REQUEST_NULL) {
+            untrack(before[i]);
+        }
+    }
+}
+
+// Times call, then adds one call of op on comm with the given bytes
+#define PROFILE(op, comm, sent, recv, call)                                                                       \
+    do {                                                                                                          \
+        double start_ = PMPI_Wtime();                                                                             \
+        int result_ = call;                                                                                       \
+        add(slot_for_comm(comm), op, 1, sent, recv, PMPI_Wtime() - start_);                                       \
+        return result_;                                                                                           \
+    } while (0)
+
+int MPI_Init(int* argc, char*** argv) {
+    int result = PMPI_Init(argc, argv);
+    init_time = PMPI_Wtime();
+    return result;
+}
+
+int MPI_Init_thread(int* argc, char*** argv, int required, int* provided) {
+    int result = PMPI_Init_thread(argc, argv, required, provided);
+    init_time = PMPI_Wtime();
+    return result;
+}
+
+int MPI_Comm_free(MPI_Comm* comm) {
+    for (int i = 0; i < comm_handle_count; i++) {
+        if (comm_handles[i] == *comm) {
+            comm_handles[i] = comm_handles[--comm_handle_count];
+            comm_handle_slots[i] = comm_handle_slots[comm_handle_count];
+            break;
+        }
+    }
+    return PMPI_Comm_free(comm);
+}
+
+int MPI_Win_free(MPI_Win* win) {
+    for (int i = 0; i < win_handle_count; i++) {
+        if (win_handles[i] == *win) {
+            win_handles[i] = win_handles[--win_handle_count];
+            win_handle_slots[i] = win_handle_slots[win_handle_count];
+            break;
+        }
+    }
+    return PMPI_Win_free(win);
+}
+
+int MPI_Request_free(MPI_Request* request) {
+    untrack(*request);
+    return PMPI_Request_free(request);
+}
+
+// Point-to-point
+
+int MPI_Send(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm) {
+    PROFILE(OP_Send, comm, bytes(count, type), 0, PMPI_Send(buf, count, type, dest, tag, comm));
+}
+
+int MPI_Recv(void* buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Status* status) {
+    MPI_Status local;
+    MPI_Status* used = status == MPI_STATUS_IGNORE ? &local : status;
+    double start = PMPI_Wtime();
+    int result = PMPI_Recv(buf, count, type, source, tag, comm, used);
+    double seconds = PMPI_Wtime() - start;
+    int received;
+    PMPI_Get_count(used, MPI_BYTE, &received);
+    add(slot_for_comm(comm), OP_Recv, 1, 0, received == MPI_UNDEFINED ? 0 : received, seconds);
+    return result;
+}
+
+int MPI_Sendrecv(const void* sendbuf, int sendcount, MPI_Datatype sendtype, int dest, int sendtag, void* recvbuf,
+                 int recvcount, MPI_Datatype recvtype, int source, int recvtag, MPI_Comm comm, MPI_Status* status) {
+    PROFILE(OP_Sendrecv, comm, bytes(sendcount, sendtype), bytes(recvcount, recvtype),
+            PMPI_Sendrecv(sendbuf, sendcount, sendtype, dest, sendtag, recvbuf, recvcount, recvtype, source,
+                          recvtag, comm, status));
+}
+
+int MPI_Sendrecv_replace(void* buf, int count, MPI_Datatype type, int dest, int sendtag, int source, int recvtag,
+                         MPI_Comm comm, MPI_Status* status) {
+    PROFILE(OP_Sendrecv_replace, comm, bytes(count, type), bytes(count, type),
+            PMPI_Sendrecv_replace(buf, count, type, dest, sendtag, source, recvtag, comm, status));
+}
+
+int MPI_Send_init(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm,
+                  MPI_Request* request) {
+    double start = PMPI_Wtime();
+    int result = PMPI_Send_init(buf, count, type, dest, tag, comm, request);
+    int slot = slot_for_comm(comm);
+    add(slot, OP_Send_init, 0, 0, 0, PMPI_Wtime() - start);
+    track(*request, OP_Send_init, slot, bytes(count, type), 0, 1);
+    return result;
+}
+
+int MPI_Recv_init(void* buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm,
+                  MPI_Request* request) {
+    double start = PMPI_Wtime();
+    int result = PMPI_Recv_init(buf, count, type, source, tag, comm, request);
+    int slot = slot_for_comm(comm);
+    add(slot, OP_Recv_init, 0, 0, 0, PMPI_Wtime() - start);
+    track(*request, OP_Recv_init, slot, 0, bytes(count, type), 1);
+    return result;
+}
+
+// Starts count as calls of the persistent operations, with their bytes
+
+int MPI_Start(MPI_Request* request) {
+    struct TrackedRequest* tracked = find_request(*request);
+    double start = PMPI_Wtime();
+    int result = PMPI_Start(request);
+    if (tracked) {
+        add(tracked->slot, tracked->op, 1, tracked->sent, tracked->recv, PMPI_Wtime() - start);
+    }
+    return result;
+}
+
+int MPI_Startall(int count, MPI_Request requests_list[]) {
+    double start = PMPI_Wtime();
+    int result = PMPI_Startall(count, requests_list);
+    double seconds = PMPI_Wtime() - start;
+    for (int i = 0; i < count; i++) {
+        struct TrackedRequest* tracked = find_request(requests_list[i]);
+        if (tracked) {
+            add(tracked->slot, tracked->op, 1, tracked->sent, tracked->recv, seconds);
+            seconds = 0.0;
+        }
+    }
+    return result;
+}
+
+int MPI_Wait(MPI_Request* request, MPI_Status* status) {
+    MPI_Request before = *request;
+    double start = PMPI_Wtime();
+    int result = PMPI_Wait(request, status);
+    charge_wait(1, &before, request, PMPI_Wtime() - start);
+    return result;
+}
+
+int MPI_Waitall(int count, MPI_Request requests_list[], MPI_Status statuses[]) {
+    MPI_Request before[PROFILE_MAX_REQUESTS];
+    int kept = count < PROFILE_MAX_REQUESTS ? count : PROFILE_MAX_REQUESTS;
+    memcpy(before, requests_list, kept * sizeof(MPI_Request));
+    double start = PMPI_Wtime();
+    int result = PMPI_Waitall(count, requests_list, statuses);
+    charge_wait(kept, before, requests_list, PMPI_Wtime() - start);
+    return result;
+}
+
+int MPI_Test(MPI_Request* request, int* flag, MPI_Status* status) {
+    MPI_Request before = *request;
+    double start = PMPI_Wtime();
+    int result = PMPI_Test(request, flag, status);
+    charge_wait(1, &before, request, PMPI_Wtime() - start);
+    return result;
+}
+
+// Collectives
+
+int MPI_Barrier(MPI_Comm comm) {
+    PROFILE(OP_Barrier, comm, 0, 0, PMPI_Barrier(comm));
+}
+
+int MPI_Bcast(void* buf, int count, MPI_Datatype type, int root, MPI_Comm comm) {
+    int is_root = comm_rank(comm) == root;
+    PROFILE(OP_Bcast, comm, is_root ? bytes(count, type) : 0, is_root ? 0 : bytes(count, type),
+            PMPI_Bcast(buf, count, type, root, comm));
+}
+
+int MPI_Reduce(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op, int root,
+               MPI_Comm comm) {
+    PROFILE(OP_Reduce, comm, bytes(count, type), comm_rank(comm) == root ? bytes(count, type) : 0,
+            PMPI_Reduce(sendbuf, recvbuf, count, type, op, root, comm));
+}
+
+int MPI_Allreduce(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm) {
+    PROFILE(OP_Allreduce, comm, bytes(count, type), bytes(count, type),
+            PMPI_Allreduce(sendbuf, recvbuf, count, type, op, comm));
+}
+
+int MPI_Iallreduce(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm,
+                   MPI_Request* request) {
+    double start = PMPI_Wtime();
+    int result = PMPI_Iallreduce(sendbuf, recvbuf, count, type, op, comm, request);
+    int slot = slot_for_comm(comm);
+    add(slot, OP_Iallreduce, 1, bytes(count, type), bytes(count, type), PMPI_Wtime() - start);
+    track(*request, OP_Iallreduce, slot, 0, 0, 0);
+    return result;
+}
+
+int MPI_Reduce_scatter(const void* sendbuf, void* recvbuf, const int recvcounts[], MPI_Datatype type, MPI_Op op,
+                       MPI_Comm comm) {
+    PROFILE(OP_Reduce_scatter, comm, bytes_sum(recvcounts, comm_size(comm), type),
+            bytes(recvcounts[comm_rank(comm)], type), PMPI_Reduce_scatter(sendbuf, recvbuf, recvcounts, type, op, comm));
+}
+
+int MPI_Scatter(const void* sendbuf, int sendcount, MPI_Datatype sendtype, void* recvbuf, int recvcount,
+                MPI_Datatype recvtype, int root, MPI_Comm comm) {
+    int is_root = comm_rank(comm) == root;
+    PROFILE(OP_Scatter, comm, is_root ? bytes(sendcount, sendtype) * comm_size(comm) : 0,
+            bytes(recvcount, recvtype),
+            PMPI_Scatter(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm));
+}
+
+int MPI_Scatterv(const void* sendbuf, const int sendcounts[], const int displs[], MPI_Datatype sendtype,
+                 void* recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm) {
+    int is_root = comm_rank(comm) == root;
+    PROFILE(OP_Scatterv, comm, is_root ? bytes_sum(sendcounts, comm_size(comm), sendtype) : 0,
+            bytes(recvcount, recvtype),
+            PMPI_Scatterv(sendbuf, sendcounts, displs, sendtype, recvbuf, recvcount, recvtype, root, comm));
+}
+
+int MPI_Gather(const void* sendbuf, int sendcount, MPI_Datatype sendtype, void* recvbuf, int recvcount,
+               MPI_Datatype recvtype, int root, MPI_Comm comm) {
+    int is_root = comm_rank(comm) == root;
+    PROFILE(OP_Gather, comm, bytes(sendcount, sendtype),
+            is_root ? bytes(recvcount, recvtype) * comm_size(comm) : 0,
+            PMPI_Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm));
+}
+
+int MPI_Gatherv(const void* sendbuf, int sendcount, MPI_Datatype sendtype, void* recvbuf, const int recvcounts[],
+                const int displs[], MPI_Datatype recvtype, int root, MPI_Comm comm) {
+    int is_root = comm_rank(comm) == root;
+    PROFILE(OP_Gatherv, comm, bytes(sendcount, sendtype),
+            is_root ? bytes_sum(recvcounts, comm_size(comm), recvtype) : 0,
+            PMPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, root, comm));
+}
+
+int MPI_Allgather(const void* sendbuf, int sendcount, MPI_Datatype sendtype, void* recvbuf, int recvcount,
+                  MPI_Datatype recvtype, MPI_Comm comm) {
+    PROFILE(OP_Allgather, comm, bytes(sendcount, sendtype), bytes(recvcount, recvtype) * comm_size(comm),
+            PMPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm));
+}
+
+int MPI_Allgatherv(const void* sendbuf, int sendcount, MPI_Datatype sendtype, void* recvbuf,
+                   const int recvcounts[], const int displs[], MPI_Datatype recvtype, MPI_Comm comm) {
+    PROFILE(OP_Allgatherv, comm, bytes(sendcount, sendtype), bytes_sum(recvcounts, comm_size(comm), recvtype),
+            PMPI_Allgatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, comm));
+}
+
+int MPI_Alltoall(const void* sendbuf, int sendcount, MPI_Datatype sendtype, void* recvbuf, int recvcount,
+                 MPI_Datatype recvtype, MPI_Comm comm) {
+    int size = comm_size(comm);
+    PROFILE(OP_Alltoall, comm, bytes(sendcount, sendtype) * size, bytes(recvcount, recvtype) * size,
+            PMPI_Alltoall(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm));
+}
+
+int MPI_Alltoallv(const void* sendbuf, const int sendcounts[], const int sdispls[], MPI_Datatype sendtype,
+                  void* recvbuf, const int recvcounts[], const int rdispls[], MPI_Datatype recvtype, MPI_Comm comm) {
+    int size = comm_size(comm);
+    PROFILE(OP_Alltoallv, comm, bytes_sum(sendcounts, size, sendtype), bytes_sum(recvcounts, size, recvtype),
+            PMPI_Alltoallv(sendbuf, sendcounts, sdispls, sendtype, recvbuf, recvcounts, rdispls, recvtype, comm));
+}
+
+int MPI_Alltoallw(const void* sendbuf, const int sendcounts[], const int sdispls[], const MPI_Datatype sendtypes[],
+                  void* recvbuf, const int recvcounts[], const int rdispls[], const MPI_Datatype recvtypes[],
+                  MPI_Comm comm) {
+    long long sent = 0, recv = 0;
+    for (int i = comm_size(comm) - 1; i >= 0; i--) {
+        sent += bytes(sendcounts[i], sendtypes[i]);
+        recv += bytes(recvcounts[i], recvtypes[i]);
+    }
+    PROFILE(OP_Alltoallw, comm, sent, recv,
+            PMPI_Alltoallw(sendbuf, sendcounts, sdispls, sendtypes, recvbuf, recvcounts, rdispls, recvtypes, comm));
+}
+
+int MPI_Neighbor_alltoallv(const void* sendbuf, const int sendcounts[], const int sdispls[], MPI_Datatype sendtype,
+                           void* recvbuf, const int recvcounts[], const int rdispls[], MPI_Datatype recvtype,
+                           MPI_Comm comm) {
+    int indegree, outdegree, weighted;
+    PMPI_Dist_graph_neighbors_count(comm, &indegree, &outdegree, &weighted);
+    PROFILE(OP_Neighbor_alltoallv, comm, bytes_sum(sendcounts, outdegree, sendtype),
+            bytes_sum(recvcounts, indegree, recvtype),
+            PMPI_Neighbor_alltoallv(sendbuf, sendcounts, sdispls, sendtype, recvbuf, recvcounts, rdispls, recvtype,
+                                    comm));
+}
+
+#ifdef PROFILE_PCOLL
+// Persistent collectives: the init is timed, every MPI_Start is a call
+
+static int persistent(enum ProfileOp op, MPI_Comm comm, long long sent, long long recv, double start, int result,
+                      MPI_Request* request) {
+    int slot = slot_for_comm(comm);
+    add(slot, op, 0, 0, 0, PMPI_Wtime() - start);
+    track(*request, op, slot, sent, recv, 1);
+    return result;
+}
+
+int PROFILE_PCOLL(Allreduce_init)(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op,
+                                  MPI_Comm comm, MPI_Info info, MPI_Request* request) {
+    double start = PMPI_Wtime();
+    int result = PROFILE_PPCOLL(Allreduce_init)(sendbuf, recvbuf, count, type, op, comm, info, request);
+    return persistent(OP_Allreduce_init, comm, bytes(count, type), bytes(count, type), start, result, request);
+}
+
+int PROFILE_PCOLL(Allgather_init)(const void* sendbuf, int sendcount, MPI_Datatype sendtype, void* recvbuf,
+                                  int recvcount, MPI_Datatype recvtype, MPI_Comm comm, MPI_Info info,
+                                  MPI_Request* request) {
+    double start = PMPI_Wtime();
+    int result = PROFILE_PPCOLL(Allgather_init)(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm,
+                                                info, request);
+    return persistent(OP_Allgather_init, comm, bytes(sendcount, sendtype),
+                      bytes(recvcount, recvtype) * comm_size(comm), start, result, request);
+}
+
+int PROFILE_PCOLL(Allgatherv_init)(const void* sendbuf, int sendcount, MPI_Datatype sendtype, void* recvbuf,
+                                   const int recvcounts[], const int displs[], MPI_Datatype recvtype, MPI_Comm comm,
+                                   MPI_Info info, MPI_Request* request) {
+    double start = PMPI_Wtime();
+    int result = PROFILE_PPCOLL(Allgatherv_init)(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs,
+                                                 recvtype, comm, info, request);
+    return persistent(OP_Allgatherv_init, comm, bytes(sendcount, sendtype),
+                      bytes_sum(recvcounts, comm_size(comm), recvtype), start, result, request);
+}
+
+int PROFILE_PCOLL(Reduce_init)(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op,
+                               int root, MPI_Comm comm, MPI_Info info, MPI_Request* request) {
+    double start = PMPI_Wtime();
+    int result = PROFILE_PPCOLL(Reduce_init)(sendbuf, recvbuf, count, type, op, root, comm, info, request);
+    return persistent(OP_Reduce_init, comm, bytes(count, type), comm_rank(comm) == root ? bytes(count, type) : 0,
+                      start, result, request);
+}
+
+int PROFILE_PCOLL(Reduce_scatter_init)(const void* sendbuf, void* recvbuf, const int recvcounts[],
+                                       MPI_Datatype type, MPI_Op op, MPI_Comm comm, MPI_Info info,
+                                       MPI_Request* request) {
+    double start = PMPI_Wtime();
+    int result = PROFILE_PPCOLL(Reduce_scatter_init)(sendbuf, recvbuf, recvcounts, type, op, comm, info, request);
+    return persistent(OP_Reduce_scatter_init, comm, bytes_sum(recvcounts, comm_size(comm), type),
+                      bytes(recvcounts[comm_rank(comm)], type), start, result, request);
+}
+#endif
+
+// One-sided, as used by the dynamic schedule
+
+int MPI_Fetch_and_op(const void* origin, void* result_addr, MPI_Datatype type, int target, MPI_Aint disp, MPI_Op op,
+                     MPI_Win win) {
+    double start = PMPI_Wtime();
+    int result = PMPI_Fetch_and_op(origin, result_addr, type, target, disp, op, win);
+    add(slot_for_win(win), OP_Fetch_and_op, 1, bytes(1, type), bytes(1, type), PMPI_Wtime() - start);
+    return result;
+}
+
+int MPI_Win_flush(int rank, MPI_Win win) {
+    double start = PMPI_Wtime();
+    int result = PMPI_Win_flush(rank, win);
+    add(slot_for_win(win), OP_Win_flush, 1, 0, 0, PMPI_Wtime() - start);
+    return result;
+}
+
+// Summary
+
+struct Line {
+    const char* label;
+    int op;
+    long long calls, sent, recv;
+    int ranks;
+    double min, sum, max;
+};
+
+static int by_max_time(const void* a, const void* b) {
+    double x = ((const struct Line*)a)->max, y = ((const struct Line*)b)->max;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void write_csv(const char* path, const struct Record* records, int count) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "error: cannot open %s\n", path);
+        return;
+    }
+    fprintf(file, "rank,call,communicator,calls,sent_bytes,recv_bytes,seconds\n");
+    for (int i = 0; i < count; i++) {
+        fprintf(file, "%d,%s,\"%s\",%lld,%lld,%lld,%.9g\n", records[i].rank, op_names[records[i].op],
+                records[i].label, records[i].calls, records[i].sent, records[i].recv, records[i].seconds);
+    }
+    fclose(file);
+}
+
+static void write_summary(FILE* out, const struct Record* records, int count, const double* wall, int size) {
+    struct Line* lines = calloc(count > 0 ? count : 1, sizeof(struct Line));
+    double* in_mpi = calloc(size, sizeof(double));
+    int line_count = 0;
+    for (int i = 0; i < count; i++) {
+        const struct Record* r = &records[i];
+        in_mpi[r->rank] += r->seconds;
+        int l = 0;
+        while (l < line_count && (lines[l].op != r->op || strcmp(lines[l].label, r->label) != 0)) {
+            l++;
+        }
+        if (l == line_count) {
+            lines[line_count++] = (struct Line){r->label, r->op, 0, 0, 0, 0, r->seconds, 0.0, r->seconds};
+        }
+        lines[l].calls += r->calls;
+        lines[l].sent += r->sent;
+        lines[l].recv += r->recv;
+        lines[l].ranks++;
+        lines[l].sum += r->seconds;
+        lines[l].min = r->seconds < lines[l].min ? r->seconds : lines[l].min;
+        lines[l].max = r->seconds > lines[l].max ? r->seconds : lines[l].max;
+    }
+    qsort(lines, line_count, sizeof(struct Line), by_max_time);
+
+    double wall_max = 0.0;
+    for (int r = 0; r < size; r++) {
+        wall_max = wall[r] > wall_max ? wall[r] : wall_max;
+    }
+    fprintf(out, "pmpi profile: %d ranks, %.6f s from MPI_Init to MPI_Finalize\n", size, wall_max);
+    fprintf(out, "time in MPI per rank:");
+    for (int r = 0; r < size; r++) {
+        fprintf(out, " %d %.6f s (%.1f%%)%s", r, in_mpi[r], wall[r] > 0 ? 100.0 * in_mpi[r] / wall[r] : 0.0,
+                r + 1 < size ? "," : "\n");
+    }
+    fprintf(out, "%-20s %-28s %10s %14s %14s %11s %11s %11s\n", "call", "communicator", "calls", "sent bytes",
+            "recv bytes", "min s", "mean s", "max s");
+    for (int l = 0; l < line_count; l++) {
+        fprintf(out, "%-20s %-28s %10lld %14lld %14lld %11.6f %11.6f %11.6f\n", op_names[lines[l].op],
+                lines[l].label, lines[l].calls, lines[l].sent, lines[l].recv, lines[l].min,
+                lines[l].sum / lines[l].ranks, lines[l].max);
+    }
+    free(in_mpi);
+    free(lines);
+}
+
+int MPI_Finalize(void) {
+    int rank, size;
+    PMPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    PMPI_Comm_size(MPI_COMM_WORLD, &size);
+    double wall = PMPI_Wtime() - init_time;
+
+    // This rank's non-empty records
+    struct Record* mine = malloc(sizeof(struct Record) * (slot_count * OP_COUNT + 1));
+    int count = 0;
+    for (int s = 0; s < slot_count; s++) {
+        for (int op = 0; op < OP_COUNT; op++) {
+            const struct OpStats* stats = &slots[s].ops[op];
+            if (stats->calls == 0 && stats->seconds == 0.0) {
+                continue;
+            }
+            struct Record* r = &mine[count++];
+            memset(r, 0, sizeof(*r));
+            memcpy(r->label, slots[s].label, PROFILE_LABEL);
+            r->rank = rank;
+            r->op = op;
+            r->calls = stats->calls;
+            r->sent = stats->sent;
+            r->recv = stats->recv;
+            r->seconds = stats->seconds;
+        }
+    }
+
+    int* counts = rank == 0 ? malloc(sizeof(int) * size) : NULL;
+    int* displs = rank == 0 ? malloc(sizeof(int) * size) : NULL;
+    double* walls = rank == 0 ? malloc(sizeof(double) * size) : NULL;
+    int my_bytes = count * (int)sizeof(struct Record);
+    PMPI_Gather(&my_bytes, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    PMPI_Gather(&wall, 1, MPI_DOUBLE, walls, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    int total = 0;
+    if (rank == 0) {
+        for (int r = 0; r < size; r++) {
+            displs[r] = total;
+            total += counts[r];
+        }
+    }
+    struct Record* all = rank == 0 ? malloc(total > 0 ? total : 1) : NULL;
+    PMPI_Gatherv(mine, my_bytes, MPI_BYTE, all, counts, displs, MPI_BYTE, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        int records = total / (int)sizeof(struct Record);
+        const char* path = getenv("PMPI_PROFILE_OUTPUT");
+        FILE* out = path ? fopen(path, "w") : stderr;
+        if (!out) {
+            fprintf(stderr, "error: cannot open %s\n", path);
+            out = stderr;
+        }
+        write_summary(out, all, records, walls, size);
+        if (out != stderr) {
+            fclose(out);
+        }
+        if (getenv("PMPI_PROFILE_CSV")) {
+            write_csv(getenv("PMPI_PROFILE_CSV"), all, records);
+        }
+    }
+    free(all);
+    free(walls);
+    free(displs);
+    free(counts);
+    free(mine);
+    return PMPI_Finalize();
+}
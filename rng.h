@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Philox4x32-10 counter-based generator (Salmon et al., SC'11).
+// A block of four 32-bit words is a pure function of (key, counter), so any
+// rank or thread can produce any part of a stream without shared state.
+// The key is the user seed; the counter is (block index, stream id), where the
+// stream id separates unrelated consumers (points, matrix A, matrix B, ...).
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+#define RNG_STREAM_POINTS 0
+#define RNG_STREAM_MATRIX_A 1
+#define RNG_STREAM_MATRIX_B 2
+#define RNG_STREAM_STRASSEN_A 3
+#define RNG_STREAM_STRASSEN_B 4
+
+static inline void philox4x32_10(uint64_t seed, uint64_t stream, uint64_t block, uint32_t out[4]) {
+    uint32_t c0 = (uint32_t)block, c1 = (uint32_t)(block >> 32);
+    uint32_t c2 = (uint32_t)stream, c3 = (uint32_t)(stream >> 32);
+    uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+    for (int round = 0; round < 10; round++) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+        uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c0 = n0;
+        c1 = (uint32_t)p1;
+        c2 = n2;
+        c3 = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+// Writes blocks [first_block, first_block + blocks) of a stream, 4 words each.
+static inline void philox_fill(uint64_t seed, uint64_t stream, uint64_t first_block,
+                               uint32_t* out, size_t blocks) {
+    for (size_t b = 0; b < blocks; b++) {
+        philox4x32_10(seed, stream, first_block + b, out + 4 * b);
+    }
+}
+
+// Writes words [first, first + count) of a stream, for starts that are not
+// aligned to a block.
+static inline void philox_words(uint64_t seed, uint64_t stream, uint64_t first,
+                                uint32_t* out, size_t count) {
+    uint32_t words[4];
+    while (count > 0) {
+        philox4x32_10(seed, stream, first / 4, words);
+        size_t offset = first % 4;
+        size_t take = 4 - offset < count ? 4 - offset : count;
+        for (size_t i = 0; i < take; i++) {
+            out[i] = words[offset + i];
+        }
+        out += take;
+        first += take;
+        count -= take;
+    }
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Work distribution of a range [0, total) of independent items over the ranks
+// of a communicator ("--schedule=NAME", "--chunk=N"):
+//   static  - one contiguous range per rank, the remainder on the last one
+//   dynamic - ranks claim chunks of N items from a shared counter on rank 0
+//             with MPI_Fetch_and_op (passive-target RMA), so a faster rank
+//             simply claims more chunks
+//   master  - the same chunks handed out by rank 0 over point-to-point
+//             messages, for MPI libraries with slow RMA; rank 0 only serves
+// Every rank loops on schedule_next until it returns 0.
+
+enum ScheduleKind { SCHEDULE_STATIC, SCHEDULE_DYNAMIC, SCHEDULE_MASTER };
+
+#define SCHEDULE_TAG_REQUEST 101
+#define SCHEDULE_TAG_CHUNK 102
+
+struct Scheduler {
+    enum ScheduleKind kind;
+    MPI_Comm comm;
+    int rank, size;
+    long long total, chunk;
+    long long next;     // static: start of the rank's range, master: next item
+    int workers_left;   // master: workers not yet told to stop
+    MPI_Win win;
+    long long* counter; // dynamic: next unclaimed item, on rank 0
+    long long chunks;   // claimed by this rank
+    long long items;
+    double claim_seconds; // time spent waiting for chunks
+};
+
+// -1 for an unknown name
+static inline int schedule_parse(const char* name) {
+    if (strcmp(name, "static") == 0) {
+        return SCHEDULE_STATIC;
+    }
+    if (strcmp(name, "dynamic") == 0) {
+        return SCHEDULE_DYNAMIC;
+    }
+    if (strcmp(name, "master") == 0) {
+        return SCHEDULE_MASTER;
+    }
+    return -1;
+}
+
+static inline const char* schedule_name(enum ScheduleKind kind) {
+    return kind == SCHEDULE_DYNAMIC ? "dynamic" : kind == SCHEDULE_MASTER ? "master" : "static";
+}
+
+// Collective over comm
+static inline void schedule_begin(struct Scheduler* s, enum ScheduleKind kind, long long total, long long chunk,
+                                  MPI_Comm comm) {
+    memset(s, 0, sizeof(*s));
+    s->kind = kind;
+    s->comm = comm;
+    s->total = total;
+    s->chunk = chunk > 0 ? chunk : 1;
+    MPI_Comm_rank(comm, &s->rank);
+    MPI_Comm_size(comm, &s->size);
+    // A lone rank has nobody to serve
+    if (s->kind == SCHEDULE_MASTER && s->size == 1) {
+        s->kind = SCHEDULE_DYNAMIC;
+    }
+
+    if (s->kind == SCHEDULE_STATIC) {
+        s->next = s->rank * (total / s->size);
+    } else if (s->kind == SCHEDULE_DYNAMIC) {
+        MPI_Aint bytes = s->rank == 0 ? sizeof(long long) : 0;
+        MPI_Win_allocate(bytes, sizeof(long long), MPI_INFO_NULL, comm, &s->counter, &s->win);
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, s->win);
+        if (s->rank == 0) {
+            *s->counter = 0;
+            MPI_Win_sync(s->win);
+        }
+        MPI_Barrier(comm);
+    } else {
+        s->workers_left = s->size - 1;
+    }
+}
+
+// Next range [*first, *first + *n) for this rank; 0 when the work is done
+static inline int schedule_next(struct Scheduler* s, long long* first, long long* n) {
+    double start = MPI_Wtime();
+    int more = 0;
+
+    if (s->kind == SCHEDULE_STATIC) {
+        if (s->chunks == 0) {
+            *first = s->next;
+            *n = s->total / s->size + (s->rank == s->size - 1 ? s->total % s->size : 0);
+            more = 1;
+        }
+    } else if (s->kind == SCHEDULE_DYNAMIC) {
+        long long claimed;
+        MPI_Fetch_and_op(&s->chunk, &claimed, MPI_LONG_LONG, 0, 0, MPI_SUM, s->win);
+        MPI_Win_flush(0, s->win);
+        if (claimed < s->total) {
+            *first = claimed;
+            *n = s->total - claimed < s->chunk ? s->total - claimed : s->chunk;
+            more = 1;
+        }
+    } else if (s->rank == 0) {
+        // Serve requests until every worker has been told to stop
+        while (s->workers_left > 0) {
+            MPI_Status status;
+            MPI_Recv(NULL, 0, MPI_BYTE, MPI_ANY_SOURCE, SCHEDULE_TAG_REQUEST, s->comm, &status);
+            long long reply = s->next < s->total ? s->next : -1;
+            if (reply < 0) {
+                s->workers_left--;
+            } else {
+                s->next += s->chunk;
+            }
+            MPI_Send(&reply, 1, MPI_LONG_LONG, status.MPI_SOURCE, SCHEDULE_TAG_CHUNK, s->comm);
+        }
+    } else {
+        long long claimed;
+        MPI_Sendrecv(NULL, 0, MPI_BYTE, 0, SCHEDULE_TAG_REQUEST, &claimed, 1, MPI_LONG_LONG, 0, SCHEDULE_TAG_CHUNK,
+                     s->comm, MPI_STATUS_IGNORE);
+        if (claimed >= 0) {
+            *first = claimed;
+            *n = s->total - claimed < s->chunk ? s->total - claimed : s->chunk;
+            more = 1;
+        }
+    }
+
+    // Rank 0 of the master schedule serves for the whole run, it never waits
+    if (s->kind != SCHEDULE_MASTER || s->rank != 0) {
+        s->claim_seconds += MPI_Wtime() - start;
+    }
+    if (more) {
+        s->chunks++;
+        s->items += *n;
+    }
+    return more;
+}
+
+// Collective over comm
+static inline void schedule_end(struct Scheduler* s) {
+    if (s->kind == SCHEDULE_DYNAMIC) {
+        MPI_Win_unlock_all(s->win);
+        MPI_Win_free(&s->win);
+    }
+}
+
+// Chunks claimed by every rank, and how uneven the items are (max / mean over
+// the ranks that did work), on rank 0 of comm
+static inline void schedule_report(const struct Scheduler* s, MPI_Comm comm) {
+    long long mine[2] = {s->chunks, s->items};
+    long long* all = s->rank == 0 ? malloc(2 * sizeof(long long) * s->size) : NULL;
+    MPI_Gather(mine, 2, MPI_LONG_LONG, all, 2, MPI_LONG_LONG, 0, comm);
+    double claim_max;
+    MPI_Reduce(&s->claim_seconds, &claim_max, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    if (s->rank != 0) {
+        return;
+    }
+
+    long long items_max = 0, items_sum = 0;
+    int workers = 0;
+    printf("schedule: %s", schedule_name(s->kind));
+    if (s->kind != SCHEDULE_STATIC) {
+        printf(" (chunk %lld)", s->chunk);
+    }
+    printf(", chunks per rank:");
+    for (int r = 0; r < s->size; r++) {
+        printf(" %lld", all[2 * r]);
+        if (all[2 * r] > 0) {
+            items_max = all[2 * r + 1] > items_max ? all[2 * r + 1] : items_max;
+            items_sum += all[2 * r + 1];
+            workers++;
+        }
+    }
+    printf(", imbalance %.2f, claim wait max %f s\n", items_sum > 0 ? (double)items_max * workers / items_sum : 1.0,
+           claim_max);
+    free(all);
+}
@@ -1,29 +1,19 @@
+#include "args.h"
 #include "clock.h"
+#include "montecarlo.h"
 
 #include <mpi.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
-
-long long countIns(long long pointsNumber) {
-    long long inCircle = 0;
-    for (long long i = 0; i < pointsNumber; ++i) {
-        long double x = (long double)rand() / RAND_MAX * 2.0 - 1.0;
-        long double y = (long double)rand() / RAND_MAX * 2.0 - 1.0;
-        if (x * x + y * y <= 1) {
-            ++inCircle;
-        }
-    }
-    return inCircle;
-}
 
 int main(int argc, char** argv)
 {
     long long POINTS_NUMBER = 1000;
-    if (argc > 1) {
-        POINTS_NUMBER = atoll(argv[1]);
+    if (arg_positional(argc, argv, 0)) {
+        POINTS_NUMBER = atoll(arg_positional(argc, argv, 0));
     }
+    uint64_t seed = (uint64_t)arg_long(argc, argv, "seed", 1);
 
     int comm_sz;
     int my_rank;
@@ -32,34 +22,46 @@ int main(int argc, char** argv)
 
     MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
     MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    counters_open(argc, argv, MPI_COMM_WORLD);
 
-    srand(time(NULL) * 10 + my_rank % 10); // Make unique seed for srand
-
-    struct MyClock clock;
-    clock_start(&clock);
-
-    long long currentSize = POINTS_NUMBER / comm_sz;
-    if (my_rank == comm_sz - 1) {
-        currentSize += POINTS_NUMBER % currentSize;
+    struct PhaseTimers phases = {0};
+    struct Reps reps;
+    if (!reps_init(&reps, argc, argv, &phases, MPI_COMM_WORLD)) {
+        if (my_rank == 0) {
+            printf("Incorrect options (--reps is at least 1, --warmup at least 0)");
+        }
+        MPI_Finalize();
+        return 0;
     }
-    long long localIns = countIns(currentSize);
-    long long totalIns = 0;
 
-    MPI_Reduce(&localIns , &totalIns , 1, MPI_LONG_LONG,
-        MPI_SUM, 0, MPI_COMM_WORLD);
+    long long totalIns = 0;
+    for (; reps_next(&reps); reps_stop(&reps)) {
+        long long currentSize = POINTS_NUMBER / comm_sz;
+        if (my_rank == comm_sz - 1) {
+            currentSize += POINTS_NUMBER % comm_sz;
+        }
+        const struct PiKernel* kernel = piSelectKernel("auto", PI_DOUBLE);
+        phase_start(&phases, PHASE_COMPUTE);
+        long long localIns = countIns(kernel, seed, my_rank * (POINTS_NUMBER / comm_sz), currentSize);
+        phase_stop(&phases, PHASE_COMPUTE);
 
-    clock_stop(&clock);
+        phase_start(&phases, PHASE_REDUCE);
+        MPI_Reduce(&localIns , &totalIns , 1, MPI_LONG_LONG,
+            MPI_SUM, 0, MPI_COMM_WORLD);
+        phase_stop(&phases, PHASE_REDUCE);
+    }
 
-    // Time measurement
-    double elapsed = clock_elapsed(&clock);
-    double max_elapsed;
-    MPI_Reduce(&elapsed, &max_elapsed, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    // Time measurement: the median rep
+    double max_elapsed = reps_finish(&reps);
 
+    char result[128] = "";
     if (my_rank == 0) {
-        long double pi = (long double)totalIns * 4.0 / POINTS_NUMBER;
-        printf("|%Lf,%lld,%f|\n", pi, POINTS_NUMBER, max_elapsed);
+        long double pi = POINTS_NUMBER > 0 ? (long double)totalIns * 4.0 / POINTS_NUMBER : 0.0;
+        snprintf(result, sizeof(result), "\"pi\": %Lf, \"points\": %lld", pi, POINTS_NUMBER);
     }
+    phases_report("second", max_elapsed, result, NULL, &phases, reps.max_seconds, reps.reps, MPI_COMM_WORLD);
 
+    reps_free(&reps);
     MPI_Finalize();
     return 0;
 }
\ No newline at end of file
@@ -1,4 +1,10 @@
 #include "clock.h"
+#include "dtype.h"
+#include "hybrid.h"
+#include "iterate.h"
+#include "matio.h"
+#include "multivec.h"
+#include "setup.h"
 
 #include <mpi.h>
 #include <string.h>
@@ -6,53 +12,267 @@
 #include <stdlib.h>
 #include <time.h>
 
-void FillVector(int *vector, int size, int my_rank)
+// Entries [first, first + n) of the vectors, entry j of vector v being
+// (j + v) % 5 + 1 in any element type
+void FillPanel(void *slice, int first, int n, int vectors, const struct Dtype *dtype)
 {
-    if (my_rank == 0)
+    if (vectors == 1)
+    {
+        dtype_fill_pattern(slice, first, n, dtype->elem);
+    }
+    else
+    {
+        multivecFill(slice, first, n, vectors, dtype->elem);
+    }
+}
+
+// Root of the grid fills x, the first process row scatters the column
+// slices and every process column broadcasts its own slice, so a rank only
+// ever receives the block_cols entries its block multiplies. With several
+// vectors the slice is a block_cols x vectors panel, still one message.
+void FillVectorSlice(void *slice, int column_size, int block_cols, int vectors, int *coords, MPI_Comm row_comm,
+                     MPI_Comm col_comm, const struct Dtype *dtype)
+{
+    int slice_size = block_cols * vectors;
+    MPI_Datatype elem_type = matio_mpi_type(dtype->elem);
+    if (coords[0] == 0)
     {
-        for (int i = 0; i < size; ++i)
+        void *vector = NULL;
+        if (coords[1] == 0)
         {
-            vector[i] = i % 5 + 1;
+            vector = calloc((size_t)column_size * vectors, dtype_size(dtype->elem));
+            FillPanel(vector, 0, column_size, vectors, dtype);
         }
+        MPI_Scatter(vector, slice_size, elem_type, slice, slice_size, elem_type, 0, row_comm);
+        free(vector);
     }
-    MPI_Bcast(vector, size, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(slice, slice_size, elem_type, 0, col_comm);
 }
 
-void MultiplyByBlock(int *matrix, int *vector, int *result, int block_rows, int block_cols, int my_rank, int coordI, int coordJ)
+// The rank's block of the same matrix rank 0 would fill, built in place
+void GenerateBlock(void *local_matrix, int block_rows, int block_cols, int column_size, int *coords,
+                   const struct Dtype *dtype)
 {
+#pragma omp parallel for schedule(static)
     for (int i = 0; i < block_rows; ++i)
     {
+        long long row_start = (long long)(coords[0] * block_rows + i) * column_size + coords[1] * block_cols;
         for (int j = 0; j < block_cols; ++j)
         {
-            int curI = i + block_rows * coordI;
-            int curJ = j + block_cols * coordJ;
-            result[curI] += matrix[i * block_cols + j] * vector[curJ];
+            dtype_store(local_matrix, (size_t)i * block_cols + j, (row_start + j) % 5 + 1, dtype->elem);
+        }
+    }
+}
+
+// One kernel per element type (MultiplyByBlock_int32, ...)
+#define DEFINE_MULTIPLY_BY_BLOCK(name, T, A, ...)                                               \
+    void MultiplyByBlock_##name(const void *matrix_, const void *vector_slice_, void *result_,  \
+                                int block_rows, int block_cols)                                 \
+    {                                                                                           \
+        const T *matrix = matrix_;                                                              \
+        const T *vector_slice = vector_slice_;                                                  \
+        A *result = result_;                                                                    \
+        _Pragma("omp parallel for schedule(static)")                                            \
+        for (int i = 0; i < block_rows; ++i)                                                    \
+        {                                                                                       \
+            const T *row = matrix + (size_t)i * block_cols;                                     \
+            A sum = 0;                                                                          \
+            _Pragma("omp simd reduction(+:sum)")                                                \
+            for (int j = 0; j < block_cols; ++j)                                                \
+            {                                                                                   \
+                sum += (A)row[j] * vector_slice[j];                                             \
+            }                                                                                   \
+            result[i] = sum;                                                                    \
+        }                                                                                       \
+    }
+
+DTYPE_LIST(DEFINE_MULTIPLY_BY_BLOCK)
+
+typedef void (*MultiplyByBlockFn)(const void *, const void *, void *, int, int);
+#define BLOCK_KERNEL(name, ...) MultiplyByBlock_##name,
+static const MultiplyByBlockFn MultiplyByBlockKernels[] = {DTYPE_LIST(BLOCK_KERNEL)};
+
+// Matrix stays resident. Without --normalize an iteration is the single-shot
+// product: multiply and reduce along the process row. With --normalize every
+// rank needs its next x slice, which is a block row of y from another process
+// row, so the partial sums are all-reduced along the process row and the
+// block rows all-gathered along the process column.
+void IterateByBlock(void *local_matrix, void *vector_slice, void *result, int block_rows, int block_cols,
+                    int row_size, int column_size, int my_rank, int *coords, MPI_Comm row_comm,
+                    MPI_Comm col_comm, const struct Dtype *dtype, struct IterOptions opts,
+                    struct PhaseTimers *phases)
+{
+    size_t acc_size = dtype_size(dtype->acc);
+    MPI_Datatype acc_type = matio_mpi_type(dtype->acc);
+    double *times = calloc(opts.iterations, sizeof(double));
+    void *total = calloc(block_rows, acc_size);
+    char *y = opts.normalize ? calloc(row_size, acc_size) : NULL;
+    double max_abs = 0;
+
+#if ITER_PERSISTENT
+    MPI_Request exchange[2];
+    int exchanges = opts.normalize ? 2 : 1;
+    if (opts.normalize)
+    {
+        ITER_COLL_INIT(Allreduce)(result, total, block_rows, acc_type, MPI_SUM, row_comm, MPI_INFO_NULL,
+                                  &exchange[0]);
+        ITER_COLL_INIT(Allgather)(total, block_rows, acc_type, y, block_rows, acc_type, col_comm, MPI_INFO_NULL,
+                                  &exchange[1]);
+    }
+    else
+    {
+        ITER_COLL_INIT(Reduce)(result, total, block_rows, acc_type, MPI_SUM, 0, row_comm, MPI_INFO_NULL,
+                               &exchange[0]);
+    }
+#endif
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    for (int it = 0; it < opts.iterations; it++)
+    {
+        double start = MPI_Wtime();
+        phase_start(phases, PHASE_COMPUTE);
+        MultiplyByBlockKernels[dtype->id](local_matrix, vector_slice, result, block_rows, block_cols);
+        phase_stop(phases, PHASE_COMPUTE);
+        phase_work_matvec(phases, PHASE_COMPUTE, block_rows, block_cols, 1, dtype_size(dtype->elem), acc_size);
+#if ITER_PERSISTENT
+        // The all-gather reads what the all-reduce wrote, so one at a time
+        for (int e = 0; e < exchanges; e++)
+        {
+            phase_start(phases, e == 0 ? PHASE_REDUCE : PHASE_GATHER);
+            MPI_Start(&exchange[e]);
+            MPI_Wait(&exchange[e], MPI_STATUS_IGNORE);
+            phase_stop(phases, e == 0 ? PHASE_REDUCE : PHASE_GATHER);
         }
+#else
+        phase_start(phases, PHASE_REDUCE);
+        if (opts.normalize)
+        {
+            MPI_Allreduce(result, total, block_rows, acc_type, MPI_SUM, row_comm);
+            phase_stop(phases, PHASE_REDUCE);
+            phase_start(phases, PHASE_GATHER);
+            MPI_Allgather(total, block_rows, acc_type, y, block_rows, acc_type, col_comm);
+            phase_stop(phases, PHASE_GATHER);
+        }
+        else
+        {
+            MPI_Reduce(result, total, block_rows, acc_type, MPI_SUM, 0, row_comm);
+            phase_stop(phases, PHASE_REDUCE);
+        }
+#endif
+        if (opts.normalize)
+        {
+            max_abs = iter_max_abs(y, row_size, dtype->acc);
+            iter_normalize(vector_slice, dtype->elem, y + (size_t)coords[1] * block_cols * acc_size, dtype->acc,
+                           block_cols, max_abs);
+        }
+        times[it] = MPI_Wtime() - start;
+    }
+
+#if ITER_PERSISTENT
+    for (int e = 0; e < exchanges; e++)
+    {
+        MPI_Request_free(&exchange[e]);
     }
+#endif
+
+    double totalSum = 0;
+    if (coords[1] == 0)
+    {
+        double partialSum = dtype_sum(total, block_rows, dtype->acc);
+        MPI_Reduce(&partialSum, &totalSum, 1, MPI_DOUBLE, MPI_SUM, 0, col_comm);
+    }
+
+    struct IterLatency latency = {0};
+    iter_latency(times, opts.iterations, MPI_COMM_WORLD, &latency);
+    char result_fields[128] = "";
+    snprintf(result_fields, sizeof(result_fields), "\"sum\": %.0f, \"rows\": %d, \"cols\": %d", totalSum,
+             row_size, column_size);
+    phases_report("second_blocks", latency.p50, result_fields, NULL, phases, times, opts.iterations, MPI_COMM_WORLD);
+    if (my_rank == 0)
+    {
+        iter_print(&latency, opts, max_abs);
+    }
+
+    free(times);
+    free(total);
+    free(y);
 }
 
 int main(int argc, char **argv)
 {
     int row_size = 1000, column_size = 1000;
-    if (argc > 2)
+    if (arg_positional(argc, argv, 1))
     {
-        row_size = atoll(argv[1]);
-        column_size = atoll(argv[2]);
+        row_size = atoll(arg_positional(argc, argv, 0));
+        column_size = atoll(arg_positional(argc, argv, 1));
     }
 
     int comm_sz;
     int my_rank;
 
-    MPI_Init(&argc, &argv);
+    hybrid_init(&argc, &argv);
+    int vectors = (int)arg_long(argc, argv, "vectors", 1);
 
     MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
     MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    counters_open(argc, argv, MPI_COMM_WORLD);
+
+    const struct Dtype *dtype = dtype_select(argc, argv);
+    if (!dtype || vectors < 1)
+    {
+        if (my_rank == 0)
+        {
+            printf("Incorrect options (--dtype is int32, int64, float32 or float64; --vectors is at least 1)");
+        }
+        MPI_Finalize();
+        return 0;
+    }
+    uint32_t result_code = dtype->acc;
+    MPI_Datatype elem_type = matio_mpi_type(dtype->elem);
+    MPI_Datatype result_type = matio_mpi_type(result_code);
+    size_t elem_size = dtype_size(dtype->elem);
+
+    // --input=FILE replaces the generated matrix (and its sizes) with a
+    // matrix file of the --dtype element type, --save-input=FILE writes the
+    // matrix in use, --output=FILE writes the rows x vectors product
+    const char *input = arg_string(argc, argv, "input", NULL);
+    const char *save_input = arg_string(argc, argv, "save-input", NULL);
+    const char *output = arg_string(argc, argv, "output", NULL);
+    struct MatioHeader header;
+    if (input)
+    {
+        if (matio_read_header(MPI_COMM_WORLD, input, dtype->elem, &header))
+        {
+            if (my_rank == 0)
+            {
+                printf("Incorrect input file");
+            }
+            MPI_Finalize();
+            return 0;
+        }
+        row_size = (int)header.rows;
+        column_size = (int)header.cols;
+    }
+
+    struct IterOptions iter = iter_options(argc, argv);
+    if ((iter.iterations > 0 && vectors != 1) || (iter.normalize && row_size != column_size))
+    {
+        if (my_rank == 0)
+        {
+            printf("Incorrect options (--iterations needs --vectors=1, --normalize needs a square matrix)");
+        }
+        MPI_Finalize();
+        return 0;
+    }
 
-    if ((row_size * column_size) % comm_sz != 0)
+    // --iterations already times every product in one job
+    struct PhaseTimers phases = {0};
+    struct Reps reps;
+    if (!reps_init(&reps, argc, argv, &phases, MPI_COMM_WORLD) || (iter.iterations > 0 && reps_requested(argc, argv)))
     {
         if (my_rank == 0)
         {
-            printf("Incorrect processes number (rows * columns should be divisible by processes)");
+            printf("Incorrect options (--reps is at least 1, --warmup at least 0, neither applies to --iterations)");
         }
         MPI_Finalize();
         return 0;
@@ -63,6 +283,17 @@ int main(int argc, char **argv)
 
     int p_row = dims[0];
     int p_col = dims[1];
+
+    if (row_size % p_row != 0 || column_size % p_col != 0)
+    {
+        if (my_rank == 0)
+        {
+            printf("Incorrect processes number (rows should be divisible by %d and columns by %d)", p_row, p_col);
+        }
+        MPI_Finalize();
+        return 0;
+    }
+
     int block_rows = row_size / p_row;
     int block_cols = column_size / p_col;
 
@@ -73,65 +304,158 @@ int main(int argc, char **argv)
     int coords[2];
     MPI_Cart_coords(grid_comm, my_rank, 2, coords);
 
-    int *matrix = NULL;
-    int *vector = calloc(column_size, sizeof(int));
-    int *local_matrix = calloc(block_rows * block_cols, sizeof(int));
+    // row_comm: the ranks of one process row (rank = column coordinate),
+    // col_comm: the ranks of one process column (rank = row coordinate)
+    MPI_Comm row_comm, col_comm;
+    int keep_cols[2] = {0, 1};
+    int keep_rows[2] = {1, 0};
+    MPI_Cart_sub(grid_comm, keep_cols, &row_comm);
+    MPI_Cart_sub(grid_comm, keep_rows, &col_comm);
 
-    if (my_rank == 0)
+    void *matrix = NULL;
+    void *vector_slice = calloc((size_t)block_cols * vectors, elem_size);
+    void *local_matrix = calloc((size_t)block_rows * block_cols, elem_size);
+
+    struct MatioStats io_read = {0}, io_save = {0}, io_write = {0};
+
+    int local = setup_local(argc, argv);
+    MPI_Barrier(MPI_COMM_WORLD);
+    double setup_start = MPI_Wtime();
+    phase_start(&phases, PHASE_DISTRIBUTE);
+    if (input)
+    {
+        matio_read_block(MPI_COMM_WORLD, input, &header, coords[0] * block_rows, coords[1] * block_cols, block_rows,
+                         block_cols, local_matrix, elem_type, block_rows * block_cols, &io_read);
+        FillPanel(vector_slice, coords[1] * block_cols, block_cols, vectors, dtype);
+        phase_stop(&phases, PHASE_DISTRIBUTE);
+    }
+    else if (local)
+    {
+        GenerateBlock(local_matrix, block_rows, block_cols, column_size, coords, dtype);
+        FillPanel(vector_slice, coords[1] * block_cols, block_cols, vectors, dtype);
+        phase_stop(&phases, PHASE_DISTRIBUTE);
+    }
+    else
     {
-        matrix = calloc(row_size * column_size, sizeof(int));
-        for (int i = 0; i < row_size * column_size; ++i)
+        if (my_rank == 0)
         {
-            matrix[i] = i % 5 + 1;
+            matrix = calloc((size_t)row_size * column_size, elem_size);
+            dtype_fill_pattern(matrix, 0, (size_t)row_size * column_size, dtype->elem);
         }
-    }
-    FillVector(vector, column_size, my_rank);
+        phase_stop(&phases, PHASE_DISTRIBUTE);
+        phase_start(&phases, PHASE_BROADCAST);
+        FillVectorSlice(vector_slice, column_size, block_cols, vectors, coords, row_comm, col_comm, dtype);
+        phase_stop(&phases, PHASE_BROADCAST);
+        phase_start(&phases, PHASE_DISTRIBUTE);
 
-    int *sendcounts = NULL;
-    int *displs = NULL;
+        // One block_rows x block_cols block of the matrix, resized so that
+        // displacements count in block widths
+        MPI_Datatype block_type, block_resized;
+        int sizes[2] = {row_size, column_size};
+        int subsizes[2] = {block_rows, block_cols};
+        int starts[2] = {0, 0};
+        MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, elem_type, &block_type);
+        MPI_Type_create_resized(block_type, 0, block_cols * elem_size, &block_resized);
+        MPI_Type_commit(&block_resized);
+        MPI_Type_free(&block_type);
 
-    if (my_rank == 0)
-    {
-        sendcounts = malloc(comm_sz * sizeof(int));
-        displs = malloc(comm_sz * sizeof(int));
-        for (int rank = 0; rank < comm_sz; rank++)
+        int *sendcounts = NULL;
+        int *displs = NULL;
+
+        if (my_rank == 0)
         {
-            sendcounts[rank] = block_rows * block_cols;
-            displs[rank] = rank * block_rows * block_cols;
+            sendcounts = malloc(comm_sz * sizeof(int));
+            displs = malloc(comm_sz * sizeof(int));
+            for (int rank = 0; rank < comm_sz; rank++)
+            {
+                int rank_coords[2];
+                MPI_Cart_coords(grid_comm, rank, 2, rank_coords);
+                sendcounts[rank] = 1;
+                displs[rank] = rank_coords[0] * block_rows * p_col + rank_coords[1];
+            }
         }
-        MPI_Scatterv(matrix, sendcounts, displs, MPI_INT, local_matrix, block_rows * block_cols, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Scatterv(matrix, sendcounts, displs, block_resized, local_matrix, block_rows * block_cols, elem_type, 0, grid_comm);
         free(sendcounts);
         free(displs);
+        MPI_Type_free(&block_resized);
+        phase_stop(&phases, PHASE_DISTRIBUTE);
     }
-    else
+    setup_report(MPI_Wtime() - setup_start, input ? "file" : local ? "local" : "root", MPI_COMM_WORLD);
+    if (input)
+    {
+        matio_report("read matrix", &io_read, MPI_COMM_WORLD);
+    }
+    if (save_input)
     {
-        MPI_Scatterv(NULL, NULL, NULL, MPI_INT, local_matrix, block_rows * block_cols, MPI_INT, 0, MPI_COMM_WORLD);
+        matio_write_block(MPI_COMM_WORLD, save_input, dtype->elem, row_size, column_size, coords[0] * block_rows,
+                          coords[1] * block_cols, block_rows, block_cols, local_matrix, elem_type,
+                          block_rows * block_cols, &io_save);
+        matio_report("wrote matrix", &io_save, MPI_COMM_WORLD);
     }
 
-    int *result = calloc(row_size, sizeof(int));
-    int *total = calloc(row_size, sizeof(int));
+    // Partial sums of this block row, reduced along the process row onto
+    // its first column: the product stays distributed by block row
+    int result_size = block_rows * vectors;
+    void *result = calloc(result_size, dtype_size(result_code));
+    void *total = coords[1] == 0 ? calloc(result_size, dtype_size(result_code)) : NULL;
 
-    struct MyClock clock;
-    clock_start(&clock);
+    if (iter.iterations > 0)
+    {
+        IterateByBlock(local_matrix, vector_slice, result, block_rows, block_cols, row_size, column_size,
+                       my_rank, coords, row_comm, col_comm, dtype, iter, &phases);
+        MPI_Finalize();
+        return 0;
+    }
 
-    MultiplyByBlock(local_matrix, vector, result, block_rows, block_cols, my_rank, coords[0], coords[1]);
-    MPI_Reduce(result, total, row_size, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    for (; reps_next(&reps); reps_stop(&reps))
+    {
+        phase_start(&phases, PHASE_COMPUTE);
+        if (vectors == 1)
+        {
+            MultiplyByBlockKernels[dtype->id](local_matrix, vector_slice, result, block_rows, block_cols);
+        }
+        else
+        {
+            // The panel kernel adds to y
+            memset(result, 0, (size_t)result_size * dtype_size(result_code));
+            multivecMultiply(dtype, local_matrix, block_cols, 1, block_rows, block_cols, vector_slice, vectors,
+                             result);
+        }
+        phase_stop(&phases, PHASE_COMPUTE);
+        phase_work_matvec(&phases, PHASE_COMPUTE, block_rows, block_cols, vectors, elem_size,
+                          dtype_size(result_code));
+        phase_start(&phases, PHASE_REDUCE);
+        MPI_Reduce(result, total, result_size, result_type, MPI_SUM, 0, row_comm);
+        phase_stop(&phases, PHASE_REDUCE);
+    }
 
-    clock_stop(&clock);
+    // Time measurement: the median rep
+    double max_elapsed = reps_finish(&reps);
 
-    // Time measurement
-    double elapsed = clock_elapsed(&clock);
-    double max_elapsed;
-    MPI_Reduce(&elapsed, &max_elapsed, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    double totalSum = 0;
+    if (coords[1] == 0)
+    {
+        double partialSum = dtype_sum(total, result_size, result_code);
+        MPI_Reduce(&partialSum, &totalSum, 1, MPI_DOUBLE, MPI_SUM, 0, col_comm);
+    }
 
+    char result_fields[128] = "";
+    snprintf(result_fields, sizeof(result_fields), "\"sum\": %.0f, \"rows\": %d, \"cols\": %d", totalSum, row_size,
+             column_size);
+    phases_report("second_blocks", max_elapsed, result_fields, NULL, &phases, reps.max_seconds, reps.reps,
+                  MPI_COMM_WORLD);
     if (my_rank == 0)
     {
-        long long totalSum = 0;
-        for (int i = 0; i < row_size; ++i)
-        {
-            totalSum += total[i];
-        }
-        printf("|%lld,%d,%d,%f|\n", totalSum, row_size, column_size, max_elapsed);
+        printf("vectors: %d, %.1f vectors/s\n", vectors, vectors / max_elapsed);
+        printf("dtype: %s (accumulator %s), matrix read at %.2f GB/s\n", dtype->name,
+               matio_dtype_name(result_code), (double)row_size * column_size * elem_size / max_elapsed * 1e-9);
+    }
+    // The product lives on the first process column only
+    if (output && coords[1] == 0)
+    {
+        matio_write_block(col_comm, output, result_code, row_size, vectors, coords[0] * block_rows, 0, block_rows,
+                          vectors, total, result_type, result_size, &io_write);
+        matio_report("wrote result", &io_write, col_comm);
     }
 
     if (my_rank == 0)
@@ -141,8 +465,12 @@ int main(int argc, char **argv)
     free(local_matrix);
     free(result);
     free(total);
-    free(vector);
+    free(vector_slice);
+    MPI_Comm_free(&row_comm);
+    MPI_Comm_free(&col_comm);
+    MPI_Comm_free(&grid_comm);
 
+    reps_free(&reps);
     MPI_Finalize();
     return 0;
 }
\ No newline at end of file
@@ -1,4 +1,10 @@
 #include "clock.h"
+#include "dtype.h"
+#include "hybrid.h"
+#include "iterate.h"
+#include "matio.h"
+#include "multivec.h"
+#include "setup.h"
 
 #include <mpi.h>
 #include <string.h>
@@ -25,66 +31,273 @@ void BuildDisplacements(int comm_sz, int *displs, int *sizes)
     }
 }
 
-void FillVector(int *vector, int size, int my_rank)
+// Entry j of vector v is (j + v) % 5 + 1 in any element type
+void FillPanel(void *vector, int size, int vectors, const struct Dtype *dtype)
+{
+    if (vectors == 1)
+    {
+        dtype_fill_pattern(vector, 0, size, dtype->elem);
+    }
+    else
+    {
+        multivecFill(vector, 0, size, vectors, dtype->elem);
+    }
+}
+
+// All vectors travel as one size x vectors panel in a single broadcast
+void FillVector(void *vector, int size, int vectors, int my_rank, const struct Dtype *dtype)
 {
     if (my_rank == 0)
     {
-        for (int i = 0; i < size; ++i)
-        {
-            vector[i] = i % 5 + 1;
-        }
+        FillPanel(vector, size, vectors, dtype);
     }
-    MPI_Bcast(vector, size, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(vector, size * vectors, matio_mpi_type(dtype->elem), 0, MPI_COMM_WORLD);
 }
 
-void FillMatrix(int row_size, int column_size, int *local_matrix, int my_rank, int *sizes, int *displs, MPI_Datatype column_type)
+void FillMatrix(int row_size, int column_size, void *local_matrix, int my_rank, int *sizes, int *displs,
+                MPI_Datatype column_type, const struct Dtype *dtype)
 {
-    int *temp = NULL;
+    void *temp = NULL;
     if (my_rank == 0)
     {
-        temp = calloc(row_size * column_size, sizeof(int));
-        for (int i = 0; i < row_size * column_size; i++)
-        {
-            temp[i] = i % 5 + 1;
-        }
+        temp = calloc((size_t)row_size * column_size, dtype_size(dtype->elem));
+        dtype_fill_pattern(temp, 0, (size_t)row_size * column_size, dtype->elem);
     }
     MPI_Scatterv(temp, sizes, displs, column_type,
-                 local_matrix, row_size * sizes[my_rank], MPI_INT, 0, MPI_COMM_WORLD);
+                 local_matrix, row_size * sizes[my_rank], matio_mpi_type(dtype->elem), 0, MPI_COMM_WORLD);
     if (my_rank == 0) {
         free(temp);
     }
 }
 
-void MultiplyByColumn(int *matrix, int *vector, int *result, int *sizes_mat, int* displacements_mat, int my_rank, int row_size, int column_size)
+// Same matrix as FillMatrix, but every rank fills only its own columns,
+// already in the column-major local layout the scatter produces
+void GenerateMatrix(int row_size, int column_size, void *local_matrix, int my_rank, int *sizes, int *displs,
+                    const struct Dtype *dtype)
 {
-    for (int i = 0; i < row_size * sizes_mat[my_rank]; i++)
+#pragma omp parallel for schedule(static)
+    for (int j = 0; j < sizes[my_rank]; j++)
     {
-        int curI = i % row_size;
-        int curJ = i / row_size + displacements_mat[my_rank];
-        result[curI] += matrix[i] * vector[curJ];
+        long long column = displs[my_rank] + j;
+        for (int i = 0; i < row_size; i++)
+        {
+            dtype_store(local_matrix, (size_t)j * row_size + i, ((long long)i * column_size + column) % 5 + 1,
+                        dtype->elem);
+        }
     }
 }
 
+// Local columns arrive contiguous (column-major block), so each one is an
+// axpy result += x[j] * column_j. Four columns are fused per pass to read and
+// write result a quarter as often. Threads split the rows with the same
+// static schedule in every pass, so each thread only ever touches its own
+// slice of result and the passes need no barrier between them. One kernel
+// per element type (MultiplyByColumn_int32, ...).
+#define DEFINE_MULTIPLY_BY_COLUMN(name, T, A, ...)                                               \
+    void MultiplyByColumn_##name(const void *matrix_, const void *vector_, void *result_,       \
+                                 int *sizes_mat, int *displacements_mat, int my_rank,           \
+                                 int row_size)                                                  \
+    {                                                                                           \
+        const T *matrix = matrix_;                                                              \
+        A *result = result_;                                                                    \
+        int cols = sizes_mat[my_rank];                                                          \
+        const T *x = (const T *)vector_ + displacements_mat[my_rank];                           \
+        _Pragma("omp parallel")                                                                 \
+        {                                                                                       \
+            int j = 0;                                                                          \
+            for (; j + 4 <= cols; j += 4)                                                       \
+            {                                                                                   \
+                const T *c0 = matrix + (size_t)j * row_size;                                    \
+                const T *c1 = c0 + row_size;                                                    \
+                const T *c2 = c1 + row_size;                                                    \
+                const T *c3 = c2 + row_size;                                                    \
+                A x0 = x[j], x1 = x[j + 1], x2 = x[j + 2], x3 = x[j + 3];                       \
+                _Pragma("omp for simd schedule(static) nowait")                                 \
+                for (int i = 0; i < row_size; i++)                                              \
+                {                                                                               \
+                    result[i] += x0 * c0[i] + x1 * c1[i] + x2 * c2[i] + x3 * c3[i];             \
+                }                                                                               \
+            }                                                                                   \
+            for (; j < cols; j++)                                                               \
+            {                                                                                   \
+                const T *c0 = matrix + (size_t)j * row_size;                                    \
+                A x0 = x[j];                                                                    \
+                _Pragma("omp for simd schedule(static) nowait")                                 \
+                for (int i = 0; i < row_size; i++)                                              \
+                {                                                                               \
+                    result[i] += x0 * c0[i];                                                    \
+                }                                                                               \
+            }                                                                                   \
+        }                                                                                       \
+    }
+
+DTYPE_LIST(DEFINE_MULTIPLY_BY_COLUMN)
+
+typedef void (*MultiplyByColumnFn)(const void *, const void *, void *, int *, int *, int, int);
+#define COLUMN_KERNEL(name, ...) MultiplyByColumn_##name,
+static const MultiplyByColumnFn MultiplyByColumnKernels[] = {DTYPE_LIST(COLUMN_KERNEL)};
+
+// Matrix stays resident; every iteration multiplies the local columns and
+// reduce-scatters the partial sums. For a square matrix the row slice of y a
+// rank receives is exactly its column slice of x, so --normalize only needs
+// the global max |y| on top of that.
+void IterateByColumn(void *local_matrix, void *vector, void *result, void *total, int *sizes_y,
+                     int *sizes_mat, int *displacements_mat, int my_rank, int row_size, int column_size,
+                     const struct Dtype *dtype, struct IterOptions opts, struct PhaseTimers *phases)
+{
+    size_t acc_size = dtype_size(dtype->acc);
+    MPI_Datatype acc_type = matio_mpi_type(dtype->acc);
+    double *times = calloc(opts.iterations, sizeof(double));
+    double local_max = 0, max_abs = 0;
+    void *x_slice = (char *)vector + (size_t)displacements_mat[my_rank] * dtype_size(dtype->elem);
+
+#if ITER_PERSISTENT
+    MPI_Request exchange, norm;
+    ITER_COLL_INIT(Reduce_scatter)(result, total, sizes_y, acc_type, MPI_SUM, MPI_COMM_WORLD, MPI_INFO_NULL,
+                                   &exchange);
+    ITER_COLL_INIT(Allreduce)(&local_max, &max_abs, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD, MPI_INFO_NULL, &norm);
+#endif
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    for (int it = 0; it < opts.iterations; it++)
+    {
+        double start = MPI_Wtime();
+        phase_start(phases, PHASE_COMPUTE);
+        memset(result, 0, row_size * acc_size);
+        MultiplyByColumnKernels[dtype->id](local_matrix, vector, result, sizes_mat, displacements_mat, my_rank,
+                                           row_size);
+        phase_stop(phases, PHASE_COMPUTE);
+        phase_work_matvec(phases, PHASE_COMPUTE, row_size, sizes_mat[my_rank], 1, dtype_size(dtype->elem),
+                          acc_size);
+        phase_start(phases, PHASE_REDUCE);
+#if ITER_PERSISTENT
+        MPI_Start(&exchange);
+        MPI_Wait(&exchange, MPI_STATUS_IGNORE);
+#else
+        MPI_Reduce_scatter(result, total, sizes_y, acc_type, MPI_SUM, MPI_COMM_WORLD);
+#endif
+        phase_stop(phases, PHASE_REDUCE);
+        if (opts.normalize)
+        {
+            local_max = iter_max_abs(total, sizes_y[my_rank], dtype->acc);
+            phase_start(phases, PHASE_REDUCE);
+#if ITER_PERSISTENT
+            MPI_Start(&norm);
+            MPI_Wait(&norm, MPI_STATUS_IGNORE);
+#else
+            MPI_Allreduce(&local_max, &max_abs, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+#endif
+            phase_stop(phases, PHASE_REDUCE);
+            iter_normalize(x_slice, dtype->elem, total, dtype->acc, sizes_y[my_rank], max_abs);
+        }
+        times[it] = MPI_Wtime() - start;
+    }
+
+#if ITER_PERSISTENT
+    MPI_Request_free(&exchange);
+    MPI_Request_free(&norm);
+#endif
+
+    double partialSum = dtype_sum(total, sizes_y[my_rank], dtype->acc), totalSum = 0;
+    MPI_Reduce(&partialSum, &totalSum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    struct IterLatency latency = {0};
+    iter_latency(times, opts.iterations, MPI_COMM_WORLD, &latency);
+    char result_fields[128] = "";
+    snprintf(result_fields, sizeof(result_fields), "\"sum\": %.0f, \"rows\": %d, \"cols\": %d", totalSum,
+             row_size, column_size);
+    phases_report("second_columns", latency.p50, result_fields, NULL, phases, times, opts.iterations, MPI_COMM_WORLD);
+    if (my_rank == 0)
+    {
+        iter_print(&latency, opts, max_abs);
+    }
+
+    free(times);
+}
+
 int main(int argc, char **argv)
 {
     int row_size = 1000, column_size = 1000;
-    if (argc > 2)
+    if (arg_positional(argc, argv, 1))
     {
-        row_size = atoll(argv[1]);
-        column_size = atoll(argv[2]);
+        row_size = atoll(arg_positional(argc, argv, 0));
+        column_size = atoll(arg_positional(argc, argv, 1));
     }
 
     int comm_sz;
     int my_rank;
 
-    MPI_Init(&argc, &argv);
+    hybrid_init(&argc, &argv);
+    int vectors = (int)arg_long(argc, argv, "vectors", 1);
 
     MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
     MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    counters_open(argc, argv, MPI_COMM_WORLD);
+
+    const struct Dtype *dtype = dtype_select(argc, argv);
+    if (!dtype || vectors < 1)
+    {
+        if (my_rank == 0)
+        {
+            printf("Incorrect options (--dtype is int32, int64, float32 or float64; --vectors is at least 1)");
+        }
+        MPI_Finalize();
+        return 0;
+    }
+    uint32_t result_code = dtype->acc;
+    MPI_Datatype elem_type = matio_mpi_type(dtype->elem);
+    MPI_Datatype result_type = matio_mpi_type(result_code);
+    size_t elem_size = dtype_size(dtype->elem);
+
+    // --input=FILE replaces the generated matrix (and its sizes) with a
+    // matrix file of the --dtype element type, --save-input=FILE writes the
+    // matrix in use, --output=FILE writes the rows x vectors product
+    const char *input = arg_string(argc, argv, "input", NULL);
+    const char *save_input = arg_string(argc, argv, "save-input", NULL);
+    const char *output = arg_string(argc, argv, "output", NULL);
+    struct MatioHeader header;
+    if (input)
+    {
+        if (matio_read_header(MPI_COMM_WORLD, input, dtype->elem, &header))
+        {
+            if (my_rank == 0)
+            {
+                printf("Incorrect input file");
+            }
+            MPI_Finalize();
+            return 0;
+        }
+        row_size = (int)header.rows;
+        column_size = (int)header.cols;
+    }
+
+    struct IterOptions iter = iter_options(argc, argv);
+    if ((iter.iterations > 0 && vectors != 1) || (iter.normalize && row_size != column_size))
+    {
+        if (my_rank == 0)
+        {
+            printf("Incorrect options (--iterations needs --vectors=1, --normalize needs a square matrix)");
+        }
+        MPI_Finalize();
+        return 0;
+    }
+
+    // --iterations already times every product in one job
+    struct PhaseTimers phases = {0};
+    struct Reps reps;
+    if (!reps_init(&reps, argc, argv, &phases, MPI_COMM_WORLD) || (iter.iterations > 0 && reps_requested(argc, argv)))
+    {
+        if (my_rank == 0)
+        {
+            printf("Incorrect options (--reps is at least 1, --warmup at least 0, neither applies to --iterations)");
+        }
+        MPI_Finalize();
+        return 0;
+    }
 
     MPI_Datatype column_type, col_resized;
-    MPI_Type_vector(row_size, 1, column_size, MPI_INT, &column_type);
-    MPI_Type_create_resized(column_type, 0, sizeof(int), &col_resized);
+    MPI_Type_vector(row_size, 1, column_size, elem_type, &column_type);
+    MPI_Type_create_resized(column_type, 0, elem_size, &col_resized);
     MPI_Type_commit(&col_resized);
     MPI_Type_free(&column_type);
 
@@ -98,39 +311,136 @@ int main(int argc, char **argv)
     BuildSize(1, column_size, comm_sz, sizes_vec);
     BuildDisplacements(comm_sz, displacements_vec, sizes_vec);
 
-    int *local_matrix = calloc(row_size * sizes_mat[my_rank], sizeof(int));
-    int *vector = calloc(column_size, sizeof(int));
+    void *local_matrix = calloc((size_t)row_size * sizes_mat[my_rank], elem_size);
+    void *vector = calloc((size_t)column_size * vectors, elem_size);
 
-    FillMatrix(row_size, column_size, local_matrix, my_rank, sizes_mat, displacements_mat, col_resized);
+    int local_cols = sizes_mat[my_rank];
+    struct MatioStats io_read = {0}, io_save = {0}, io_write = {0};
 
-    FillVector(vector, column_size, my_rank);
+    int local = setup_local(argc, argv);
+    MPI_Barrier(MPI_COMM_WORLD);
+    double setup_start = MPI_Wtime();
+    phase_start(&phases, PHASE_DISTRIBUTE);
+    if (input)
+    {
+        matio_read_columns(MPI_COMM_WORLD, input, &header, 0, displacements_mat[my_rank], row_size, local_cols,
+                           local_matrix, &io_read);
+        FillPanel(vector, column_size, vectors, dtype);
+        phase_stop(&phases, PHASE_DISTRIBUTE);
+    }
+    else if (local)
+    {
+        GenerateMatrix(row_size, column_size, local_matrix, my_rank, sizes_mat, displacements_mat, dtype);
+        FillPanel(vector, column_size, vectors, dtype);
+        phase_stop(&phases, PHASE_DISTRIBUTE);
+    }
+    else
+    {
+        FillMatrix(row_size, column_size, local_matrix, my_rank, sizes_mat, displacements_mat, col_resized, dtype);
+        phase_stop(&phases, PHASE_DISTRIBUTE);
+        phase_start(&phases, PHASE_BROADCAST);
+        FillVector(vector, column_size, vectors, my_rank, dtype);
+        phase_stop(&phases, PHASE_BROADCAST);
+    }
+    setup_report(MPI_Wtime() - setup_start, input ? "file" : local ? "local" : "root", MPI_COMM_WORLD);
+    if (input)
+    {
+        matio_report("read matrix", &io_read, MPI_COMM_WORLD);
+    }
+    if (save_input)
+    {
+        matio_write_columns(MPI_COMM_WORLD, save_input, dtype->elem, row_size, column_size, 0,
+                            displacements_mat[my_rank], row_size, local_cols, local_matrix, &io_save);
+        matio_report("wrote matrix", &io_save, MPI_COMM_WORLD);
+    }
 
-    int *result = calloc(row_size, sizeof(int));
-    int *total = calloc(row_size, sizeof(int));
+    // y ends up split by rows: rank i owns sizes_y[i] consecutive entries
+    // (rows times vectors)
+    int *sizes_y = calloc(comm_sz, sizeof(int));
+    BuildSize(1, row_size, comm_sz, sizes_y);
+    for (int i = 0; i < comm_sz; i++)
+    {
+        sizes_y[i] *= vectors;
+    }
 
-    struct MyClock clock;
-    clock_start(&clock);
+    void *result = calloc((size_t)row_size * vectors, dtype_size(result_code));
+    void *total = calloc(sizes_y[my_rank] > 0 ? sizes_y[my_rank] : 1, dtype_size(result_code));
 
-    MultiplyByColumn(local_matrix, vector, result, sizes_mat, displacements_mat, my_rank, row_size, column_size);
-    MPI_Reduce(result, total, row_size, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (iter.iterations > 0)
+    {
+        IterateByColumn(local_matrix, vector, result, total, sizes_y, sizes_mat, displacements_mat,
+                        my_rank, row_size, column_size, dtype, iter, &phases);
+        MPI_Type_free(&col_resized);
+        MPI_Finalize();
+        return 0;
+    }
 
-    clock_stop(&clock);
+    for (; reps_next(&reps); reps_stop(&reps))
+    {
+        phase_start(&phases, PHASE_COMPUTE);
+        // Both kernels add to y
+        memset(result, 0, (size_t)row_size * vectors * dtype_size(result_code));
+        if (vectors == 1)
+        {
+            MultiplyByColumnKernels[dtype->id](local_matrix, vector, result, sizes_mat, displacements_mat, my_rank,
+                                               row_size);
+        }
+        else
+        {
+            // The local slice is column-major: element (i, j) sits at j * row_size + i
+            multivecMultiply(dtype, local_matrix, 1, row_size, row_size, sizes_mat[my_rank],
+                             (char *)vector + (size_t)displacements_mat[my_rank] * vectors * elem_size, vectors,
+                             result);
+        }
+        phase_stop(&phases, PHASE_COMPUTE);
+        phase_work_matvec(&phases, PHASE_COMPUTE, row_size, sizes_mat[my_rank], vectors, elem_size,
+                          dtype_size(result_code));
+        phase_start(&phases, PHASE_REDUCE);
+        MPI_Reduce_scatter(result, total, sizes_y, result_type, MPI_SUM, MPI_COMM_WORLD);
+        phase_stop(&phases, PHASE_REDUCE);
+    }
 
-    // Time measurement
-    double elapsed = clock_elapsed(&clock);
-    double max_elapsed;
-    MPI_Reduce(&elapsed, &max_elapsed, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    // Time measurement: the median rep
+    double max_elapsed = reps_finish(&reps);
 
+    double partialSum = dtype_sum(total, sizes_y[my_rank], result_code), totalSum = 0;
+    MPI_Reduce(&partialSum, &totalSum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    char result_fields[128] = "";
+    snprintf(result_fields, sizeof(result_fields), "\"sum\": %.0f, \"rows\": %d, \"cols\": %d", totalSum, row_size,
+             column_size);
+    phases_report("second_columns", max_elapsed, result_fields, NULL, &phases, reps.max_seconds, reps.reps,
+                  MPI_COMM_WORLD);
     if (my_rank == 0)
     {
-        long long totalSum = 0;
-        for (int i = 0; i < row_size; ++i) {
-            totalSum += total[i];
+        printf("vectors: %d, %.1f vectors/s\n", vectors, vectors / max_elapsed);
+        printf("dtype: %s (accumulator %s), matrix read at %.2f GB/s\n", dtype->name,
+               matio_dtype_name(result_code), (double)row_size * column_size * elem_size / max_elapsed * 1e-9);
+    }
+    if (output)
+    {
+        int first_row = 0;
+        for (int i = 0; i < my_rank; i++)
+        {
+            first_row += sizes_y[i] / vectors;
         }
-        printf("|%lld,%d,%d,%f|\n", totalSum, row_size, column_size, max_elapsed);
+        int local_rows = sizes_y[my_rank] / vectors;
+        matio_write_block(MPI_COMM_WORLD, output, result_code, row_size, vectors, first_row, 0, local_rows, vectors,
+                          total, result_type, sizes_y[my_rank], &io_write);
+        matio_report("wrote result", &io_write, MPI_COMM_WORLD);
     }
 
+    free(local_matrix);
+    free(vector);
+    free(result);
+    free(total);
+    free(sizes_y);
+    free(sizes_mat);
+    free(displacements_mat);
+    free(sizes_vec);
+    free(displacements_vec);
     MPI_Type_free(&col_resized);
+    reps_free(&reps);
     MPI_Finalize();
     return 0;
 }
\ No newline at end of file
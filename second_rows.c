@@ -1,4 +1,10 @@
 #include "clock.h"
+#include "dtype.h"
+#include "hybrid.h"
+#include "iterate.h"
+#include "matio.h"
+#include "multivec.h"
+#include "setup.h"
 
 #include <mpi.h>
 #include <string.h>
@@ -26,51 +32,65 @@ void BuildDisplacements(int comm_sz, int *displs, int *sizes)
     }
 }
 
-void FillVector(int *vector, int size, int my_rank)
+// Entry j of vector v is (j + v) % 5 + 1 in any element type
+void FillPanel(void *vector, int size, int vectors, const struct Dtype *dtype)
+{
+    if (vectors == 1)
+    {
+        dtype_fill_pattern(vector, 0, size, dtype->elem);
+    }
+    else
+    {
+        multivecFill(vector, 0, size, vectors, dtype->elem);
+    }
+}
+
+// All vectors travel as one size x vectors panel in a single broadcast
+void FillVector(void *vector, int size, int vectors, int my_rank, const struct Dtype *dtype)
 {
     if (my_rank == 0)
     {
-        for (int i = 0; i < size; ++i)
-        {
-            vector[i] = i % 5 + 1;
-        }
+        FillPanel(vector, size, vectors, dtype);
     }
-    MPI_Bcast(vector, size, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(vector, size * vectors, matio_mpi_type(dtype->elem), 0, MPI_COMM_WORLD);
 }
 
-void FillMatrix(int row_size, int column_size, int *matrix, int my_rank, int *sizes, int *displs)
+void FillMatrix(int row_size, int column_size, void *matrix, int my_rank, int *sizes, int *displs,
+                const struct Dtype *dtype)
 {
+    MPI_Datatype type = matio_mpi_type(dtype->elem);
     if (my_rank == 0)
     {
-        int *temp = calloc(row_size * column_size, sizeof(int));
-        for (int i = 0; i < row_size * column_size; i++)
-        {
-            temp[i] = i % 5 + 1;
-        }
-        MPI_Scatterv(temp, sizes, displs, MPI_INT,
-                     matrix, sizes[my_rank], MPI_INT, 0, MPI_COMM_WORLD);
+        void *temp = calloc((size_t)row_size * column_size, dtype_size(dtype->elem));
+        dtype_fill_pattern(temp, 0, (size_t)row_size * column_size, dtype->elem);
+        MPI_Scatterv(temp, sizes, displs, type,
+                     matrix, sizes[my_rank], type, 0, MPI_COMM_WORLD);
         free(temp);
     }
     else
     {
-        MPI_Scatterv(NULL, sizes, displs, MPI_INT,
-                     matrix, sizes[my_rank], MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Scatterv(NULL, sizes, displs, type,
+                     matrix, sizes[my_rank], type, 0, MPI_COMM_WORLD);
     }
 }
 
-long long GetDistributedVectorSum(int *v, int n, int my_rank, int *sizes, int *displs)
+// Same matrix as FillMatrix, but every rank fills only its own rows
+void GenerateMatrix(void *matrix, int my_rank, int *sizes, int *displs, const struct Dtype *dtype)
+{
+    dtype_fill_pattern(matrix, displs[my_rank], sizes[my_rank], dtype->elem);
+}
+
+// v holds elements of the given matio type
+double GetDistributedVectorSum(void *v, int n, int my_rank, int *sizes, int *displs, uint32_t code)
 {
-    long long sum = -1;
-    int *temp = calloc(n, sizeof(int));
-    MPI_Gatherv(v, sizes[my_rank], MPI_INT, temp, sizes, displs,
-                MPI_INT, 0, MPI_COMM_WORLD);
+    double sum = -1;
+    MPI_Datatype type = matio_mpi_type(code);
+    void *temp = calloc(n, dtype_size(code));
+    MPI_Gatherv(v, sizes[my_rank], type, temp, sizes, displs,
+                type, 0, MPI_COMM_WORLD);
     if (my_rank == 0)
     {
-        sum = 0;
-        for (int i = 0; i < n; i++)
-        {
-            sum += temp[i];
-        }
+        sum = dtype_sum(temp, n, code);
     }
     free(temp);
     return sum;
@@ -100,34 +120,179 @@ void PrintDistributedMatrix(int row_size, int column_size, int *local_matrix,
     }
 }
 
-void MultiplyByRow(int *matrix, int *vector, int *result, int local_row, int column_size)
+// One kernel per element type (MultiplyByRow_int32, ...)
+#define DEFINE_MULTIPLY_BY_ROW(name, T, A, ...)                                          \
+    void MultiplyByRow_##name(const void *matrix_, const void *vector_, void *result_,   \
+                              int local_row, int column_size)                             \
+    {                                                                                     \
+        const T *matrix = matrix_;                                                        \
+        const T *vector = vector_;                                                        \
+        A *result = result_;                                                              \
+        _Pragma("omp parallel for schedule(static)")                                      \
+        for (int i = 0; i < local_row; i++)                                               \
+        {                                                                                 \
+            const T *row = matrix + (size_t)i * column_size;                              \
+            A sum = 0;                                                                    \
+            _Pragma("omp simd reduction(+:sum)")                                          \
+            for (int j = 0; j < column_size; j++)                                         \
+            {                                                                             \
+                sum += (A)row[j] * vector[j];                                             \
+            }                                                                             \
+            result[i] = sum;                                                              \
+        }                                                                                 \
+    }
+
+DTYPE_LIST(DEFINE_MULTIPLY_BY_ROW)
+
+typedef void (*MultiplyByRowFn)(const void *, const void *, void *, int, int);
+#define ROW_KERNEL(name, ...) MultiplyByRow_##name,
+static const MultiplyByRowFn MultiplyByRowKernels[] = {DTYPE_LIST(ROW_KERNEL)};
+
+// Matrix stays resident; every iteration multiplies the local rows and
+// all-gathers y so that each rank holds the full product (and, with
+// --normalize, the next x)
+void IterateByRow(void *matrix, void *vector, int local_row, int row_size, int column_size, int my_rank,
+                  int *sizes_vec, int *displacements_vec, const struct Dtype *dtype, struct IterOptions opts,
+                  struct PhaseTimers *phases)
 {
-    for (int i = 0; i < local_row; i++)
+    size_t acc_size = dtype_size(dtype->acc);
+    MPI_Datatype acc_type = matio_mpi_type(dtype->acc);
+    void *local_y = calloc(local_row + 1, acc_size);
+    void *y = calloc(row_size, acc_size);
+    double *times = calloc(opts.iterations, sizeof(double));
+    double max_abs = 0;
+
+#if ITER_PERSISTENT
+    MPI_Request exchange;
+    ITER_COLL_INIT(Allgatherv)(local_y, local_row, acc_type, y, sizes_vec, displacements_vec, acc_type,
+                               MPI_COMM_WORLD, MPI_INFO_NULL, &exchange);
+#endif
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    for (int it = 0; it < opts.iterations; it++)
     {
-        result[i] = 0;
-        for (int j = 0; j < column_size; j++)
+        double start = MPI_Wtime();
+        phase_start(phases, PHASE_COMPUTE);
+        MultiplyByRowKernels[dtype->id](matrix, vector, local_y, local_row, column_size);
+        phase_stop(phases, PHASE_COMPUTE);
+        phase_work_matvec(phases, PHASE_COMPUTE, local_row, column_size, 1, dtype_size(dtype->elem), acc_size);
+        phase_start(phases, PHASE_GATHER);
+#if ITER_PERSISTENT
+        MPI_Start(&exchange);
+        MPI_Wait(&exchange, MPI_STATUS_IGNORE);
+#else
+        MPI_Allgatherv(local_y, local_row, acc_type, y, sizes_vec, displacements_vec, acc_type, MPI_COMM_WORLD);
+#endif
+        phase_stop(phases, PHASE_GATHER);
+        if (opts.normalize)
         {
-            result[i] += matrix[i * column_size + j] * vector[j];
+            max_abs = iter_max_abs(y, row_size, dtype->acc);
+            iter_normalize(vector, dtype->elem, y, dtype->acc, row_size, max_abs);
         }
+        times[it] = MPI_Wtime() - start;
+    }
+
+#if ITER_PERSISTENT
+    MPI_Request_free(&exchange);
+#endif
+
+    struct IterLatency latency = {0};
+    iter_latency(times, opts.iterations, MPI_COMM_WORLD, &latency);
+    char result[128] = "";
+    if (my_rank == 0)
+    {
+        snprintf(result, sizeof(result), "\"sum\": %.0f, \"rows\": %d, \"cols\": %d",
+                 dtype_sum(y, row_size, dtype->acc), row_size, column_size);
+    }
+    phases_report("second_rows", latency.p50, result, NULL, phases, times, opts.iterations, MPI_COMM_WORLD);
+    if (my_rank == 0)
+    {
+        iter_print(&latency, opts, max_abs);
     }
+
+    free(local_y);
+    free(y);
+    free(times);
 }
 
 int main(int argc, char **argv)
 {
     int row_size = 1000, column_size = 1000;
-    if (argc > 2)
+    if (arg_positional(argc, argv, 1))
     {
-        row_size = atoll(argv[1]);
-        column_size = atoll(argv[2]);
+        row_size = atoll(arg_positional(argc, argv, 0));
+        column_size = atoll(arg_positional(argc, argv, 1));
     }
 
     int comm_sz;
     int my_rank;
 
-    MPI_Init(&argc, &argv);
+    hybrid_init(&argc, &argv);
+    int vectors = (int)arg_long(argc, argv, "vectors", 1);
 
     MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
     MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    counters_open(argc, argv, MPI_COMM_WORLD);
+
+    const struct Dtype *dtype = dtype_select(argc, argv);
+    if (!dtype || vectors < 1)
+    {
+        if (my_rank == 0)
+        {
+            printf("Incorrect options (--dtype is int32, int64, float32 or float64; --vectors is at least 1)");
+        }
+        MPI_Finalize();
+        return 0;
+    }
+    uint32_t result_code = dtype->acc;
+    MPI_Datatype elem_type = matio_mpi_type(dtype->elem);
+    size_t elem_size = dtype_size(dtype->elem);
+
+    // --input=FILE replaces the generated matrix (and its sizes) with a
+    // matrix file of the --dtype element type, --save-input=FILE writes the
+    // matrix in use, --output=FILE writes the rows x vectors product
+    const char *input = arg_string(argc, argv, "input", NULL);
+    const char *save_input = arg_string(argc, argv, "save-input", NULL);
+    const char *output = arg_string(argc, argv, "output", NULL);
+    struct MatioHeader header;
+    if (input)
+    {
+        if (matio_read_header(MPI_COMM_WORLD, input, dtype->elem, &header))
+        {
+            if (my_rank == 0)
+            {
+                printf("Incorrect input file");
+            }
+            MPI_Finalize();
+            return 0;
+        }
+        row_size = (int)header.rows;
+        column_size = (int)header.cols;
+    }
+
+    struct IterOptions iter = iter_options(argc, argv);
+    if ((iter.iterations > 0 && vectors != 1) || (iter.normalize && row_size != column_size))
+    {
+        if (my_rank == 0)
+        {
+            printf("Incorrect options (--iterations needs --vectors=1, --normalize needs a square matrix)");
+        }
+        MPI_Finalize();
+        return 0;
+    }
+
+    // --iterations already times every product in one job
+    struct PhaseTimers phases = {0};
+    struct Reps reps;
+    if (!reps_init(&reps, argc, argv, &phases, MPI_COMM_WORLD) || (iter.iterations > 0 && reps_requested(argc, argv)))
+    {
+        if (my_rank == 0)
+        {
+            printf("Incorrect options (--reps is at least 1, --warmup at least 0, neither applies to --iterations)");
+        }
+        MPI_Finalize();
+        return 0;
+    }
 
     int *sizes_mat = calloc(comm_sz, sizeof(int));
     int *displacements_mat = calloc(comm_sz, sizeof(int));
@@ -136,37 +301,112 @@ int main(int argc, char **argv)
 
     BuildSize(row_size, column_size, comm_sz, sizes_mat);
     BuildDisplacements(comm_sz, displacements_mat, sizes_mat);
-    BuildSize(row_size, 1, comm_sz, sizes_vec);
+    BuildSize(row_size, vectors, comm_sz, sizes_vec);
     BuildDisplacements(comm_sz, displacements_vec, sizes_vec);
 
-    int *matrix = calloc(sizes_mat[my_rank], sizeof(int));
-    int *vector = calloc(column_size, sizeof(int));
+    void *matrix = calloc(sizes_mat[my_rank], elem_size);
+    void *vector = calloc((size_t)column_size * vectors, elem_size);
 
-    FillMatrix(row_size, column_size, matrix, my_rank, sizes_mat, displacements_mat);
-    FillVector(vector, column_size, my_rank);
+    int local_row = sizes_mat[my_rank] / column_size;
+    int first_row = displacements_mat[my_rank] / column_size;
+    struct MatioStats io_read = {0}, io_save = {0}, io_write = {0};
 
-    int *result = calloc(row_size, sizeof(int));
+    int local = setup_local(argc, argv);
+    MPI_Barrier(MPI_COMM_WORLD);
+    double setup_start = MPI_Wtime();
+    phase_start(&phases, PHASE_DISTRIBUTE);
+    if (input)
+    {
+        matio_read_block(MPI_COMM_WORLD, input, &header, first_row, 0, local_row, column_size, matrix, elem_type,
+                         sizes_mat[my_rank], &io_read);
+        FillPanel(vector, column_size, vectors, dtype);
+        phase_stop(&phases, PHASE_DISTRIBUTE);
+    }
+    else if (local)
+    {
+        GenerateMatrix(matrix, my_rank, sizes_mat, displacements_mat, dtype);
+        FillPanel(vector, column_size, vectors, dtype);
+        phase_stop(&phases, PHASE_DISTRIBUTE);
+    }
+    else
+    {
+        FillMatrix(row_size, column_size, matrix, my_rank, sizes_mat, displacements_mat, dtype);
+        phase_stop(&phases, PHASE_DISTRIBUTE);
+        phase_start(&phases, PHASE_BROADCAST);
+        FillVector(vector, column_size, vectors, my_rank, dtype);
+        phase_stop(&phases, PHASE_BROADCAST);
+    }
+    setup_report(MPI_Wtime() - setup_start, input ? "file" : local ? "local" : "root", MPI_COMM_WORLD);
+    if (input)
+    {
+        matio_report("read matrix", &io_read, MPI_COMM_WORLD);
+    }
+    if (save_input)
+    {
+        matio_write_block(MPI_COMM_WORLD, save_input, dtype->elem, row_size, column_size, first_row, 0, local_row,
+                          column_size, matrix, elem_type, sizes_mat[my_rank], &io_save);
+        matio_report("wrote matrix", &io_save, MPI_COMM_WORLD);
+    }
 
-    struct MyClock clock;
-    clock_start(&clock);
+    void *result = calloc((size_t)row_size * vectors, dtype_size(result_code));
 
-    int local_row = sizes_mat[my_rank] / column_size;
-    MultiplyByRow(matrix, vector, result, local_row, column_size);
+    if (iter.iterations > 0)
+    {
+        IterateByRow(matrix, vector, sizes_mat[my_rank] / column_size, row_size, column_size, my_rank,
+                     sizes_vec, displacements_vec, dtype, iter, &phases);
+        MPI_Finalize();
+        return 0;
+    }
 
-    clock_stop(&clock);
+    for (; reps_next(&reps); reps_stop(&reps))
+    {
+        phase_start(&phases, PHASE_COMPUTE);
+        if (vectors == 1)
+        {
+            MultiplyByRowKernels[dtype->id](matrix, vector, result, local_row, column_size);
+        }
+        else
+        {
+            // The panel kernel adds to y
+            memset(result, 0, (size_t)local_row * vectors * dtype_size(result_code));
+            multivecMultiply(dtype, matrix, column_size, 1, local_row, column_size, vector, vectors, result);
+        }
+        phase_stop(&phases, PHASE_COMPUTE);
+        phase_work_matvec(&phases, PHASE_COMPUTE, local_row, column_size, vectors, elem_size,
+                          dtype_size(result_code));
+    }
 
-    // Time measurement
-    double elapsed = clock_elapsed(&clock);
-    double max_elapsed;
-    MPI_Reduce(&elapsed, &max_elapsed, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    // Time measurement: the median rep
+    double max_elapsed = reps_finish(&reps);
 
-    long long totalSum = GetDistributedVectorSum(result, row_size, my_rank,
-                                                    sizes_vec, displacements_vec);
+    // The measured time is the multiply alone; collecting y is the gather
+    // phase
+    phase_start(&phases, PHASE_GATHER);
+    double totalSum = GetDistributedVectorSum(result, row_size * vectors, my_rank,
+                                              sizes_vec, displacements_vec, result_code);
+    phase_stop(&phases, PHASE_GATHER);
+    char result_fields[128] = "";
     if (my_rank == 0)
     {
-        printf("|%lld,%d,%d,%f|\n", totalSum, row_size, column_size, max_elapsed);
+        snprintf(result_fields, sizeof(result_fields), "\"sum\": %.0f, \"rows\": %d, \"cols\": %d", totalSum,
+                 row_size, column_size);
+    }
+    phases_report("second_rows", max_elapsed, result_fields, NULL, &phases, reps.max_seconds, reps.reps,
+                  MPI_COMM_WORLD);
+    if (my_rank == 0)
+    {
+        printf("vectors: %d, %.1f vectors/s\n", vectors, vectors / max_elapsed);
+        printf("dtype: %s (accumulator %s), matrix read at %.2f GB/s\n", dtype->name,
+               matio_dtype_name(result_code), (double)row_size * column_size * elem_size / max_elapsed * 1e-9);
+    }
+    if (output)
+    {
+        matio_write_block(MPI_COMM_WORLD, output, result_code, row_size, vectors, first_row, 0, local_row, vectors,
+                          result, matio_mpi_type(result_code), local_row * vectors, &io_write);
+        matio_report("wrote result", &io_write, MPI_COMM_WORLD);
     }
 
+    reps_free(&reps);
     MPI_Finalize();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,600 @@
+#include "clock.h"
+#include "hybrid.h"
+#include "matio.h"
+#include "setup.h"
+
+#include <mpi.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Distributed sparse matrix-vector product y = A * x for a square matrix in
+// CSR format. Rank r owns rows [row_starts[r], row_starts[r + 1]) of A and
+// the same range of x and y. Rows are split so that every rank gets about the
+// same number of nonzeros, and each product only exchanges the x entries that
+// the local rows actually reference, over a neighborhood communicator.
+
+struct LocalCsr
+{
+    int rows;
+    int first_row;
+    int *row_ptr;  // rows + 1 offsets into col and val
+    int *col;      // global columns, renumbered to x_ext indices by BuildHalo
+    double *val;
+};
+
+struct Halo
+{
+    MPI_Comm comm;        // sources: owners of needed x, destinations: users of ours
+    int sources;
+    int destinations;
+    int *recv_counts;
+    int *recv_displs;
+    int *send_counts;
+    int *send_displs;
+    int *send_index;      // local x entries to pack, grouped by destination
+    int recv_total;
+    int send_total;
+};
+
+// Row i of the generated matrix has width(i) nonzeros in a band around the
+// diagonal (wrapping at the edges); widths fall linearly from about
+// 2 * nnz_per_row - 1 on the first row to 1 on the last, so an equal split by
+// rows is badly imbalanced
+int GeneratedRowWidth(int i, int n, int nnz_per_row)
+{
+    long long width = n > 1 ? 1 + 2LL * (nnz_per_row - 1) * (n - 1 - i) / (n - 1) : 1;
+    return width < n ? (int)width : n;
+}
+
+void GenerateRows(struct LocalCsr *csr, int n, int nnz_per_row)
+{
+    csr->row_ptr = calloc(csr->rows + 1, sizeof(int));
+    for (int i = 0; i < csr->rows; i++)
+    {
+        csr->row_ptr[i + 1] = csr->row_ptr[i] + GeneratedRowWidth(csr->first_row + i, n, nnz_per_row);
+    }
+    int nnz = csr->row_ptr[csr->rows];
+    csr->col = malloc((nnz + 1) * sizeof(int));
+    csr->val = malloc((nnz + 1) * sizeof(double));
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < csr->rows; i++)
+    {
+        int row = csr->first_row + i;
+        int width = csr->row_ptr[i + 1] - csr->row_ptr[i];
+        int first = ((row - width / 2) % n + n) % n;
+        for (int k = 0; k < width; k++)
+        {
+            int c = (first + k) % n;
+            csr->col[csr->row_ptr[i] + k] = c;
+            csr->val[csr->row_ptr[i] + k] = (row + c) % 5 + 1;
+        }
+    }
+}
+
+// row_starts[r] = first row of rank r, row_starts[comm_sz] = n. With by_nnz
+// the boundaries are where the nonzero prefix sum crosses r / comm_sz of the
+// total, otherwise the rows are split evenly.
+void BuildRowStarts(const long long *row_ptr, int n, int comm_sz, int by_nnz, int *row_starts)
+{
+    long long total = row_ptr[n];
+    for (int r = 0; r <= comm_sz; r++)
+    {
+        if (!by_nnz)
+        {
+            row_starts[r] = (int)((long long)n * r / comm_sz);
+            continue;
+        }
+        long long target = total * r / comm_sz;
+        int lo = 0, hi = n;
+        while (lo < hi)
+        {
+            int mid = lo + (hi - lo) / 2;
+            if (row_ptr[mid] < target)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        row_starts[r] = lo;
+    }
+    row_starts[comm_sz] = n;
+}
+
+int RowOwner(const int *row_starts, int comm_sz, int row)
+{
+    int lo = 0, hi = comm_sz - 1;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo + 1) / 2;
+        if (row_starts[mid] <= row)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+// Matrix Market "coordinate" files (real, integer or pattern; general or
+// symmetric), read on rank 0 into a global CSR. Returns 0 on success.
+int ReadMatrixMarket(const char *path, int *n, long long **row_ptr, int **col, double **val)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        fprintf(stderr, "error: cannot open '%s'\n", path);
+        return 1;
+    }
+    char line[1024], object[64], format[64], field[64], symmetry[64];
+    if (!fgets(line, sizeof(line), file) ||
+        sscanf(line, "%%%%MatrixMarket %63s %63s %63s %63s", object, format, field, symmetry) != 4 ||
+        strcmp(object, "matrix") != 0 || strcmp(format, "coordinate") != 0 ||
+        (strcmp(field, "real") != 0 && strcmp(field, "integer") != 0 && strcmp(field, "pattern") != 0) ||
+        (strcmp(symmetry, "general") != 0 && strcmp(symmetry, "symmetric") != 0))
+    {
+        fprintf(stderr, "error: '%s' is not a real/integer/pattern general/symmetric coordinate matrix\n", path);
+        fclose(file);
+        return 1;
+    }
+    int pattern = strcmp(field, "pattern") == 0;
+    int symmetric = strcmp(symmetry, "symmetric") == 0;
+
+    long long rows = 0, cols = 0, entries = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+        if (line[0] != '%')
+        {
+            sscanf(line, "%lld %lld %lld", &rows, &cols, &entries);
+            break;
+        }
+    }
+    if (rows <= 0 || rows != cols)
+    {
+        fprintf(stderr, "error: '%s' must hold a square matrix\n", path);
+        fclose(file);
+        return 1;
+    }
+
+    long long capacity = symmetric ? 2 * entries : entries;
+    int *ti = malloc((capacity + 1) * sizeof(int));
+    int *tj = malloc((capacity + 1) * sizeof(int));
+    double *tv = malloc((capacity + 1) * sizeof(double));
+    long long count = 0;
+    for (long long e = 0; e < entries; e++)
+    {
+        long long i, j;
+        double v = 1.0;
+        if (fscanf(file, "%lld %lld", &i, &j) != 2 || (!pattern && fscanf(file, "%lf", &v) != 1) ||
+            i < 1 || i > rows || j < 1 || j > cols)
+        {
+            fprintf(stderr, "error: bad entry %lld in '%s'\n", e + 1, path);
+            free(ti);
+            free(tj);
+            free(tv);
+            fclose(file);
+            return 1;
+        }
+        ti[count] = (int)i - 1;
+        tj[count] = (int)j - 1;
+        tv[count++] = v;
+        if (symmetric && i != j)
+        {
+            ti[count] = (int)j - 1;
+            tj[count] = (int)i - 1;
+            tv[count++] = v;
+        }
+    }
+    fclose(file);
+
+    // Counting sort of the triplets by row
+    *n = (int)rows;
+    *row_ptr = calloc(rows + 1, sizeof(long long));
+    for (long long e = 0; e < count; e++)
+    {
+        (*row_ptr)[ti[e] + 1]++;
+    }
+    for (long long i = 0; i < rows; i++)
+    {
+        (*row_ptr)[i + 1] += (*row_ptr)[i];
+    }
+    long long *next = malloc(rows * sizeof(long long));
+    memcpy(next, *row_ptr, rows * sizeof(long long));
+    *col = malloc((count + 1) * sizeof(int));
+    *val = malloc((count + 1) * sizeof(double));
+    for (long long e = 0; e < count; e++)
+    {
+        long long at = next[ti[e]]++;
+        (*col)[at] = tj[e];
+        (*val)[at] = tv[e];
+    }
+    free(next);
+    free(ti);
+    free(tj);
+    free(tv);
+    return 0;
+}
+
+// Rank 0 sends every rank its rows of the global CSR
+void ScatterRows(struct LocalCsr *csr, const long long *row_ptr, const int *col, const double *val,
+                 const int *row_starts, int my_rank, int comm_sz)
+{
+    int *row_counts = NULL, *row_displs = NULL, *nnz_counts = NULL, *nnz_displs = NULL, *widths = NULL;
+    if (my_rank == 0)
+    {
+        row_counts = malloc(comm_sz * sizeof(int));
+        row_displs = malloc(comm_sz * sizeof(int));
+        nnz_counts = malloc(comm_sz * sizeof(int));
+        nnz_displs = malloc(comm_sz * sizeof(int));
+        int n = row_starts[comm_sz];
+        widths = malloc((n + 1) * sizeof(int));
+        for (int i = 0; i < n; i++)
+        {
+            widths[i] = (int)(row_ptr[i + 1] - row_ptr[i]);
+        }
+        for (int r = 0; r < comm_sz; r++)
+        {
+            row_counts[r] = row_starts[r + 1] - row_starts[r];
+            row_displs[r] = row_starts[r];
+            nnz_counts[r] = (int)(row_ptr[row_starts[r + 1]] - row_ptr[row_starts[r]]);
+            nnz_displs[r] = (int)row_ptr[row_starts[r]];
+        }
+    }
+
+    int *local_widths = malloc((csr->rows + 1) * sizeof(int));
+    MPI_Scatterv(widths, row_counts, row_displs, MPI_INT, local_widths, csr->rows, MPI_INT, 0, MPI_COMM_WORLD);
+    csr->row_ptr = calloc(csr->rows + 1, sizeof(int));
+    for (int i = 0; i < csr->rows; i++)
+    {
+        csr->row_ptr[i + 1] = csr->row_ptr[i] + local_widths[i];
+    }
+    int nnz = csr->row_ptr[csr->rows];
+    csr->col = malloc((nnz + 1) * sizeof(int));
+    csr->val = malloc((nnz + 1) * sizeof(double));
+    MPI_Scatterv(col, nnz_counts, nnz_displs, MPI_INT, csr->col, nnz, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Scatterv(val, nnz_counts, nnz_displs, MPI_DOUBLE, csr->val, nnz, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+    free(local_widths);
+    free(row_counts);
+    free(row_displs);
+    free(nnz_counts);
+    free(nnz_displs);
+    free(widths);
+}
+
+int CompareInts(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Finds the off-rank columns the local rows reference, tells their owners
+// which entries to send (one MPI_Alltoall + MPI_Alltoallv at setup), builds
+// the neighborhood communicator and renumbers csr->col to x_ext indices:
+// [0, rows) is the own slice of x, rows + k is the k-th halo entry.
+void BuildHalo(struct LocalCsr *csr, const int *row_starts, int comm_sz, struct Halo *halo)
+{
+    int nnz = csr->row_ptr[csr->rows];
+    int first = csr->first_row, last = csr->first_row + csr->rows;
+
+    int *needed = malloc((nnz + 1) * sizeof(int));
+    int count = 0;
+    for (int k = 0; k < nnz; k++)
+    {
+        if (csr->col[k] < first || csr->col[k] >= last)
+            needed[count++] = csr->col[k];
+    }
+    qsort(needed, count, sizeof(int), CompareInts);
+    int unique = 0;
+    for (int k = 0; k < count; k++)
+    {
+        if (unique == 0 || needed[unique - 1] != needed[k])
+            needed[unique++] = needed[k];
+    }
+    halo->recv_total = unique;
+
+    // Sorted columns come grouped by owner, in rank order
+    int *want = calloc(comm_sz, sizeof(int));
+    for (int k = 0; k < unique; k++)
+    {
+        want[RowOwner(row_starts, comm_sz, needed[k])]++;
+    }
+    int *give = calloc(comm_sz, sizeof(int));
+    MPI_Alltoall(want, 1, MPI_INT, give, 1, MPI_INT, MPI_COMM_WORLD);
+
+    int *want_displs = calloc(comm_sz, sizeof(int));
+    int *give_displs = calloc(comm_sz, sizeof(int));
+    for (int r = 1; r < comm_sz; r++)
+    {
+        want_displs[r] = want_displs[r - 1] + want[r - 1];
+        give_displs[r] = give_displs[r - 1] + give[r - 1];
+    }
+    halo->send_total = give_displs[comm_sz - 1] + give[comm_sz - 1];
+    halo->send_index = malloc((halo->send_total + 1) * sizeof(int));
+    MPI_Alltoallv(needed, want, want_displs, MPI_INT, halo->send_index, give, give_displs, MPI_INT,
+                  MPI_COMM_WORLD);
+    for (int k = 0; k < halo->send_total; k++)
+    {
+        halo->send_index[k] -= first;
+    }
+
+    // Neighbor lists keep rank order, so the exchange buffers stay in the
+    // order of needed[] and send_index[]
+    halo->sources = 0;
+    halo->destinations = 0;
+    for (int r = 0; r < comm_sz; r++)
+    {
+        halo->sources += want[r] > 0;
+        halo->destinations += give[r] > 0;
+    }
+    int *sources = malloc((halo->sources + 1) * sizeof(int));
+    int *destinations = malloc((halo->destinations + 1) * sizeof(int));
+    halo->recv_counts = malloc((halo->sources + 1) * sizeof(int));
+    halo->recv_displs = malloc((halo->sources + 1) * sizeof(int));
+    halo->send_counts = malloc((halo->destinations + 1) * sizeof(int));
+    halo->send_displs = malloc((halo->destinations + 1) * sizeof(int));
+    int s = 0, d = 0;
+    for (int r = 0; r < comm_sz; r++)
+    {
+        if (want[r] > 0)
+        {
+            sources[s] = r;
+            halo->recv_counts[s] = want[r];
+            halo->recv_displs[s++] = want_displs[r];
+        }
+        if (give[r] > 0)
+        {
+            destinations[d] = r;
+            halo->send_counts[d] = give[r];
+            halo->send_displs[d++] = give_displs[r];
+        }
+    }
+    // Edge weights are the entries exchanged, a hint for rank placement
+    MPI_Dist_graph_create_adjacent(MPI_COMM_WORLD, halo->sources, sources, halo->recv_counts,
+                                   halo->destinations, destinations, halo->send_counts, MPI_INFO_NULL, 0,
+                                   &halo->comm);
+
+#pragma omp parallel for schedule(static)
+    for (int k = 0; k < nnz; k++)
+    {
+        int c = csr->col[k];
+        if (c >= first && c < last)
+        {
+            csr->col[k] = c - first;
+        }
+        else
+        {
+            int *at = bsearch(&c, needed, unique, sizeof(int), CompareInts);
+            csr->col[k] = csr->rows + (int)(at - needed);
+        }
+    }
+
+    free(needed);
+    free(want);
+    free(give);
+    free(want_displs);
+    free(give_displs);
+    free(sources);
+    free(destinations);
+}
+
+void ExchangeHalo(const struct Halo *halo, double *x_ext, int rows, double *send_buffer)
+{
+    for (int k = 0; k < halo->send_total; k++)
+    {
+        send_buffer[k] = x_ext[halo->send_index[k]];
+    }
+    MPI_Neighbor_alltoallv(send_buffer, halo->send_counts, halo->send_displs, MPI_DOUBLE, x_ext + rows,
+                           halo->recv_counts, halo->recv_displs, MPI_DOUBLE, halo->comm);
+}
+
+void MultiplyCsr(const struct LocalCsr *csr, const double *x_ext, double *y)
+{
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < csr->rows; i++)
+    {
+        double sum = 0.0;
+        for (int k = csr->row_ptr[i]; k < csr->row_ptr[i + 1]; k++)
+        {
+            sum += csr->val[k] * x_ext[csr->col[k]];
+        }
+        y[i] = sum;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int size = 100000;
+    if (arg_positional(argc, argv, 0))
+    {
+        size = atoll(arg_positional(argc, argv, 0));
+    }
+
+    int comm_sz;
+    int my_rank;
+
+    hybrid_init(&argc, &argv);
+    MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    counters_open(argc, argv, MPI_COMM_WORLD);
+
+    // --input=FILE.mtx reads a Matrix Market matrix on rank 0, otherwise the
+    // banded matrix above is generated on every rank; --partition=rows
+    // splits rows evenly instead of by nonzeros
+    const char *input = arg_string(argc, argv, "input", NULL);
+    const char *output = arg_string(argc, argv, "output", NULL);
+    int nnz_per_row = (int)arg_long(argc, argv, "nnz-per-row", 16);
+    const char *partition = arg_string(argc, argv, "partition", "nnz");
+    int by_nnz = strcmp(partition, "rows") != 0;
+    if (size <= 0 || nnz_per_row <= 0 || (by_nnz && strcmp(partition, "nnz") != 0))
+    {
+        if (my_rank == 0)
+        {
+            printf("Incorrect options (--partition is nnz or rows, sizes must be positive)");
+        }
+        MPI_Finalize();
+        return 0;
+    }
+    struct PhaseTimers phases = {0};
+    struct Reps reps;
+    if (!reps_init(&reps, argc, argv, &phases, MPI_COMM_WORLD))
+    {
+        if (my_rank == 0)
+        {
+            printf("Incorrect options (--reps is at least 1, --warmup at least 0)");
+        }
+        MPI_Finalize();
+        return 0;
+    }
+
+    int *row_starts = malloc((comm_sz + 1) * sizeof(int));
+    struct LocalCsr csr;
+    long long total_nnz = 0;
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    double setup_start = MPI_Wtime();
+    phase_start(&phases, PHASE_DISTRIBUTE);
+    if (input)
+    {
+        long long *row_ptr = NULL;
+        int *col = NULL;
+        double *val = NULL;
+        int failed = 0;
+        if (my_rank == 0)
+        {
+            failed = ReadMatrixMarket(input, &size, &row_ptr, &col, &val);
+            if (!failed)
+            {
+                BuildRowStarts(row_ptr, size, comm_sz, by_nnz, row_starts);
+                total_nnz = row_ptr[size];
+            }
+        }
+        MPI_Bcast(&failed, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        if (failed)
+        {
+            if (my_rank == 0)
+            {
+                printf("Incorrect input file");
+            }
+            MPI_Finalize();
+            return 0;
+        }
+        MPI_Bcast(&size, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        MPI_Bcast(&total_nnz, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+        MPI_Bcast(row_starts, comm_sz + 1, MPI_INT, 0, MPI_COMM_WORLD);
+        csr.first_row = row_starts[my_rank];
+        csr.rows = row_starts[my_rank + 1] - row_starts[my_rank];
+        ScatterRows(&csr, row_ptr, col, val, row_starts, my_rank, comm_sz);
+        free(row_ptr);
+        free(col);
+        free(val);
+    }
+    else
+    {
+        // Row widths are a formula, so every rank finds the split by itself
+        long long *row_ptr = malloc((size + 1) * sizeof(long long));
+        row_ptr[0] = 0;
+        for (int i = 0; i < size; i++)
+        {
+            row_ptr[i + 1] = row_ptr[i] + GeneratedRowWidth(i, size, nnz_per_row);
+        }
+        BuildRowStarts(row_ptr, size, comm_sz, by_nnz, row_starts);
+        total_nnz = row_ptr[size];
+        free(row_ptr);
+        csr.first_row = row_starts[my_rank];
+        csr.rows = row_starts[my_rank + 1] - row_starts[my_rank];
+        GenerateRows(&csr, size, nnz_per_row);
+    }
+
+    struct Halo halo;
+    BuildHalo(&csr, row_starts, comm_sz, &halo);
+
+    double *x_ext = malloc((csr.rows + halo.recv_total + 1) * sizeof(double));
+    double *send_buffer = malloc((halo.send_total + 1) * sizeof(double));
+    double *y = calloc(csr.rows + 1, sizeof(double));
+    for (int i = 0; i < csr.rows; i++)
+    {
+        x_ext[i] = (csr.first_row + i) % 5 + 1;
+    }
+    // The first neighbor exchange also sets up the connections; keep that
+    // out of the measured product
+    ExchangeHalo(&halo, x_ext, csr.rows, send_buffer);
+    phase_stop(&phases, PHASE_DISTRIBUTE);
+    setup_report(MPI_Wtime() - setup_start, input ? "root" : "local", MPI_COMM_WORLD);
+
+    for (; reps_next(&reps); reps_stop(&reps))
+    {
+        phase_start(&phases, PHASE_HALO);
+        ExchangeHalo(&halo, x_ext, csr.rows, send_buffer);
+        phase_stop(&phases, PHASE_HALO);
+        phase_start(&phases, PHASE_COMPUTE);
+        MultiplyCsr(&csr, x_ext, y);
+        phase_stop(&phases, PHASE_COMPUTE);
+        // Values, columns and row offsets once, x and y once per row (the memory figure below, per rank)
+        phase_work(&phases, PHASE_COMPUTE, 2.0 * csr.row_ptr[csr.rows],
+                   csr.row_ptr[csr.rows] * (double)(sizeof(double) + sizeof(int)) +
+                       (csr.rows + 1.0) * sizeof(int) + 2.0 * csr.rows * sizeof(double));
+    }
+
+    // Time measurement: the median rep
+    double max_elapsed = reps_finish(&reps);
+
+    double partialSum = 0.0, totalSum = 0.0;
+    for (int i = 0; i < csr.rows; ++i)
+    {
+        partialSum += y[i];
+    }
+    MPI_Reduce(&partialSum, &totalSum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    // Balance and traffic: per-rank nonzeros and rows, halo entries received
+    // and the number of neighbors. Memory traffic of one product is the CSR
+    // arrays plus x and y once; the halo is what crosses the network.
+    long long local[4] = {csr.row_ptr[csr.rows], csr.rows, halo.recv_total, halo.sources};
+    long long local_min[4], local_max[4], local_sum[4];
+    MPI_Reduce(local, local_min, 4, MPI_LONG_LONG, MPI_MIN, 0, MPI_COMM_WORLD);
+    MPI_Reduce(local, local_max, 4, MPI_LONG_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(local, local_sum, 4, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    char result_fields[128] = "";
+    snprintf(result_fields, sizeof(result_fields), "\"sum\": %.1f, \"size\": %d, \"nnz\": %lld", totalSum, size,
+             total_nnz);
+    phases_report("second_sparse", max_elapsed, result_fields, NULL, &phases, reps.max_seconds, reps.reps,
+                  MPI_COMM_WORLD);
+    if (my_rank == 0)
+    {
+        long long memory_bytes = total_nnz * (sizeof(double) + sizeof(int)) +
+                                 (long long)(size + comm_sz) * sizeof(int) + 2LL * size * sizeof(double);
+        long long halo_bytes = local_sum[2] * (long long)sizeof(double);
+        printf("partition: %s, nnz per rank %lld..%lld (imbalance %.2f), rows per rank %lld..%lld\n",
+               by_nnz ? "nnz" : "rows", local_min[0], local_max[0],
+               (double)local_max[0] * comm_sz / (total_nnz > 0 ? total_nnz : 1), local_min[1], local_max[1]);
+        printf("spmv: %.3f GFLOP/s, %.2f GB/s, bytes moved: memory %lld, halo %lld (up to %lld neighbors)\n",
+               2.0 * total_nnz / max_elapsed * 1e-9, memory_bytes / max_elapsed * 1e-9, memory_bytes, halo_bytes,
+               local_max[3]);
+    }
+
+    if (output)
+    {
+        struct MatioStats io_write = {0};
+        matio_write_block(MPI_COMM_WORLD, output, MATIO_FLOAT64, size, 1, csr.first_row, 0, csr.rows, 1, y,
+                          MPI_DOUBLE, csr.rows, &io_write);
+        matio_report("wrote result", &io_write, MPI_COMM_WORLD);
+    }
+
+    MPI_Comm_free(&halo.comm);
+    free(halo.recv_counts);
+    free(halo.recv_displs);
+    free(halo.send_counts);
+    free(halo.send_displs);
+    free(halo.send_index);
+    free(csr.row_ptr);
+    free(csr.col);
+    free(csr.val);
+    free(x_ext);
+    free(send_buffer);
+    free(y);
+    free(row_starts);
+    reps_free(&reps);
+    MPI_Finalize();
+    return 0;
+}
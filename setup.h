@@ -0,0 +1,42 @@
+#pragma once
+
+#include "args.h"
+
+#include <mpi.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+
+// Input generation: "--generate=root" (default) fills the whole matrix on
+// rank 0 and scatters it, "--generate=local" has every rank build only its
+// own partition from the same index formula, so the global matrix (and the
+// checksums) do not change while rank 0 never holds more than its share.
+
+static inline int setup_local(int argc, char** argv) {
+    return strcmp(arg_string(argc, argv, "generate", "root"), "local") == 0;
+}
+
+// Peak resident set size of this process so far, in KiB (Linux ru_maxrss)
+static inline long setup_peak_rss_kb(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Prints the slowest rank's setup time and the peak RSS of rank 0 next to
+// the smallest and largest one over all ranks; source names where the inputs
+// came from ("root", "local" or "file"). Collective over comm.
+static inline void setup_report(double setup_time, const char* source, MPI_Comm comm) {
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    long rss = setup_peak_rss_kb();
+    long rss_min, rss_max;
+    double max_time;
+    MPI_Reduce(&setup_time, &max_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(&rss, &rss_min, 1, MPI_LONG, MPI_MIN, 0, comm);
+    MPI_Reduce(&rss, &rss_max, 1, MPI_LONG, MPI_MAX, 0, comm);
+    if (rank == 0) {
+        printf("setup: %f s (%s), peak RSS per rank: root %.1f MiB, min %.1f MiB, max %.1f MiB\n", max_time, source,
+               rss / 1024.0, rss_min / 1024.0, rss_max / 1024.0);
+    }
+}
@@ -3,16 +3,98 @@
 #include <mpi.h>
 #include <math.h>
 #include <string.h>
-#include <time.h>
 
-void initialize_matrix(double *matrix, int size, int seed) {
-    srand(seed);
-    for (int i = 0; i < size * size; i++) {
-        matrix[i] = (double)(rand() % 100);
+#include "clock.h"
+#include "gemm.h"
+#include "hybrid.h"
+#include "matio.h"
+#include "rng.h"
+#include "setup.h"
+
+struct MatmulConfig {
+    const struct GemmKernel *gemm; // NULL selects the naive loop
+    int pipeline;                  // overlap block shifts with the multiply
+    int local_init;                // every rank builds its own input blocks
+    int gather;                    // collect C on rank 0
+    uint64_t seed;
+    int panel;                     // SUMMA panel width
+    int replication;               // 2.5D Cannon layers (1 = plain Cannon)
+    const char *input_a;           // matrix files read in place of the
+    const char *input_b;           // generated inputs (NULL: generate)
+    const char *save_a;            // files the inputs in use are written to
+    const char *save_b;
+    const char *output;            // file C is written to
+    int strassen_cutoff;           // Strassen-Winograd on Cannon blocks
+                                   // larger than this (0 = off)
+    double *strassen_work;         // its gemmStrassenWorkspace doubles
+};
+
+// Per-rank phases (clock.h): broadcast is the SUMMA panels or the 2.5D
+// replication, reduce the 2.5D sum of C over the layers. In pipelined mode
+// shift is only the part of the shifts that the multiply did not hide (time
+// spent in MPI_Waitall).
+struct MatmulStats {
+    struct PhaseTimers phases;
+    double flops;
+    struct MatioStats read_io;     // --input-a/--input-b
+    struct MatioStats save_io;     // --save-a/--save-b
+    struct MatioStats write_io;    // --output
+};
+
+// Element (i, j) of an N x N input is word i * N + j of the matrix's Philox
+// stream, so any rank can build any block of the same global matrix.
+void fill_block(double *block, int rows, int cols, int row0, int col0,
+                int N, uint64_t seed, uint64_t stream) {
+    uint32_t *words = (uint32_t*)malloc(cols * sizeof(uint32_t));
+    for (int i = 0; i < rows; i++) {
+        philox_words(seed, stream, (uint64_t)(row0 + i) * N + col0,
+                     words, cols);
+        for (int j = 0; j < cols; j++) {
+            block[i * cols + j] = (double)(words[j] % 100);
+        }
     }
+    free(words);
+}
+
+void initialize_matrix(double *matrix, int size, uint64_t seed,
+                       uint64_t stream) {
+    fill_block(matrix, size, size, 0, 0, size, seed, stream);
 }
 
-void matrix_multiply_block(double *A, double *B, double *C, int block_sz) {
+// File I/O of one rank's rows x cols block at (row0, col0) of the N x N
+// matrices, collective over comm (every rank holding a distinct block)
+void read_input_blocks(MPI_Comm comm, double *local_A, double *local_B,
+                       int rows, int cols, int row0, int col0, int N,
+                       const struct MatmulConfig *config,
+                       struct MatmulStats *stats) {
+    struct MatioHeader header = {0};
+    header.dtype = MATIO_FLOAT64;
+    header.rows = N;
+    header.cols = N;
+    matio_read_block(comm, config->input_a, &header, row0, col0, rows, cols,
+                     local_A, MPI_DOUBLE, rows * cols, &stats->read_io);
+    matio_read_block(comm, config->input_b, &header, row0, col0, rows, cols,
+                     local_B, MPI_DOUBLE, rows * cols, &stats->read_io);
+}
+
+void save_input_blocks(MPI_Comm comm, double *local_A, double *local_B,
+                       int rows, int cols, int row0, int col0, int N,
+                       const struct MatmulConfig *config,
+                       struct MatmulStats *stats) {
+    if (config->save_a) {
+        matio_write_block(comm, config->save_a, MATIO_FLOAT64, N, N, row0,
+                          col0, rows, cols, local_A, MPI_DOUBLE, rows * cols,
+                          &stats->save_io);
+    }
+    if (config->save_b) {
+        matio_write_block(comm, config->save_b, MATIO_FLOAT64, N, N, row0,
+                          col0, rows, cols, local_B, MPI_DOUBLE, rows * cols,
+                          &stats->save_io);
+    }
+}
+
+void matrix_multiply_block_naive(double *A, double *B, double *C, int block_sz) {
+#pragma omp parallel for schedule(static)
     for (int i = 0; i < block_sz; i++) {
         for (int j = 0; j < block_sz; j++) {
             for (int k = 0; k < block_sz; k++) {
@@ -23,13 +105,197 @@ void matrix_multiply_block(double *A, double *B, double *C, int block_sz) {
     }
 }
 
+void matrix_multiply_block(double *A, double *B, double *C, int block_sz,
+                           const struct MatmulConfig *config,
+                           struct MatmulStats *stats) {
+    phase_start(&stats->phases, PHASE_COMPUTE);
+    if (config->strassen_cutoff > 0) {
+        gemmStrassen(config->gemm, block_sz, A, block_sz, B, block_sz, C,
+                     block_sz, config->strassen_cutoff,
+                     config->strassen_work);
+    } else if (config->gemm) {
+        gemm(config->gemm, block_sz, block_sz, block_sz,
+             A, block_sz, B, block_sz, C, block_sz);
+    } else {
+        matrix_multiply_block_naive(A, B, C, block_sz);
+    }
+    phase_stop(&stats->phases, PHASE_COMPUTE);
+    // Classical counts also for Strassen: its rates are effective ones
+    stats->flops += 2.0 * block_sz * block_sz * block_sz;
+    // A and B read, C read and written
+    phase_work(&stats->phases, PHASE_COMPUTE,
+               2.0 * block_sz * block_sz * block_sz,
+               4.0 * block_sz * block_sz * sizeof(double));
+}
+
+void cannon_steps_blocking(MPI_Comm cart_comm, double *local_A,
+                           double *local_B, double *local_C, int block_sz,
+                           int shift, const struct MatmulConfig *config,
+                           struct MatmulStats *stats) {
+    int block_elements = block_sz * block_sz;
+    int left_rank, right_rank, up_rank, down_rank;
+    MPI_Cart_shift(cart_comm, 1, -1, &right_rank, &left_rank);
+    MPI_Cart_shift(cart_comm, 0, -1, &down_rank, &up_rank);
+
+    for (int step = 0; step < shift; step++) {
+        matrix_multiply_block(local_A, local_B, local_C, block_sz,
+                              config, stats);
+
+        phase_start(&stats->phases, PHASE_SHIFT);
+        MPI_Sendrecv_replace(local_A, block_elements, MPI_DOUBLE, 
+                             left_rank, 0, right_rank, 0, 
+                             cart_comm, MPI_STATUS_IGNORE);
+
+        MPI_Sendrecv_replace(local_B, block_elements, MPI_DOUBLE, 
+                             up_rank, 0, down_rank, 0, 
+                             cart_comm, MPI_STATUS_IGNORE);
+        phase_stop(&stats->phases, PHASE_SHIFT);
+    }
+}
+
+// Double-buffered steps: the blocks for step s + 1 travel into the spare
+// buffers while step s multiplies, then the buffers swap. Persistent requests
+// are set up once per buffer parity. The shift after the last step would only
+// restore the initial layout, so it is skipped.
+void cannon_steps_pipelined(MPI_Comm cart_comm, double **local_A,
+                            double **local_B, double *local_C, int block_sz,
+                            int shift, const struct MatmulConfig *config,
+                            struct MatmulStats *stats) {
+    int block_elements = block_sz * block_sz;
+    int left_rank, right_rank, up_rank, down_rank;
+    MPI_Cart_shift(cart_comm, 1, -1, &right_rank, &left_rank);
+    MPI_Cart_shift(cart_comm, 0, -1, &down_rank, &up_rank);
+
+    double *buf_A[2] = {*local_A, (double*)malloc(block_elements *
+                                                   sizeof(double))};
+    double *buf_B[2] = {*local_B, (double*)malloc(block_elements *
+                                                   sizeof(double))};
+    if (!buf_A[1] || !buf_B[1]) {
+        fprintf(stderr, "error: memory allocation failed\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    MPI_Request requests[2][4];
+    for (int cur = 0; cur < 2; cur++) {
+        int next = 1 - cur;
+        MPI_Recv_init(buf_A[next], block_elements, MPI_DOUBLE, right_rank, 0,
+                      cart_comm, &requests[cur][0]);
+        MPI_Recv_init(buf_B[next], block_elements, MPI_DOUBLE, down_rank, 1,
+                      cart_comm, &requests[cur][1]);
+        MPI_Send_init(buf_A[cur], block_elements, MPI_DOUBLE, left_rank, 0,
+                      cart_comm, &requests[cur][2]);
+        MPI_Send_init(buf_B[cur], block_elements, MPI_DOUBLE, up_rank, 1,
+                      cart_comm, &requests[cur][3]);
+    }
+
+    int cur = 0;
+    for (int step = 0; step < shift; step++) {
+        int last = step == shift - 1;
+        if (!last) {
+            MPI_Startall(4, requests[cur]);
+        }
+
+        matrix_multiply_block(buf_A[cur], buf_B[cur], local_C, block_sz,
+                              config, stats);
+
+        if (!last) {
+            phase_start(&stats->phases, PHASE_SHIFT);
+            MPI_Waitall(4, requests[cur], MPI_STATUSES_IGNORE);
+            phase_stop(&stats->phases, PHASE_SHIFT);
+            cur = 1 - cur;
+        }
+    }
+
+    for (int parity = 0; parity < 2; parity++) {
+        for (int i = 0; i < 4; i++) {
+            MPI_Request_free(&requests[parity][i]);
+        }
+    }
+    *local_A = buf_A[cur];
+    *local_B = buf_B[cur];
+    free(buf_A[1 - cur]);
+    free(buf_B[1 - cur]);
+}
+
+MPI_Datatype create_block_type(int N, int block_sz) {
+    int sizes[2] = {N, N};
+    int subsizes[2] = {block_sz, block_sz};
+    int starts[2] = {0, 0};
+    MPI_Datatype block, resized;
+    MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C,
+                             MPI_DOUBLE, &block);
+    MPI_Type_create_resized(block, 0, block_sz * sizeof(double), &resized);
+    MPI_Type_commit(&resized);
+    MPI_Type_free(&block);
+    return resized;
+}
+
+// Displacement of the block owned by each rank of cart_comm, in units of
+// the resized block type (one block width)
+void build_block_displacements(MPI_Comm cart_comm, int N, int *counts,
+                               int *displs) {
+    int size;
+    MPI_Comm_size(cart_comm, &size);
+    for (int r = 0; r < size; r++) {
+        int coords[2];
+        MPI_Cart_coords(cart_comm, r, 2, coords);
+        counts[r] = 1;
+        displs[r] = coords[0] * N + coords[1];
+    }
+}
+
+// Rank in comm of MPI_COMM_WORLD's rank 0, which owns the full matrices
+int world_root_rank(MPI_Comm comm) {
+    MPI_Group world_group, comm_group;
+    MPI_Comm_group(MPI_COMM_WORLD, &world_group);
+    MPI_Comm_group(comm, &comm_group);
+    int world_root = 0, root;
+    MPI_Group_translate_ranks(world_group, 1, &world_root, comm_group, &root);
+    MPI_Group_free(&world_group);
+    MPI_Group_free(&comm_group);
+    return root;
+}
+
+// Ragged 1D split of n indices into parts: the first n % parts parts get
+// one extra index.
+int part_size(int n, int parts, int i) {
+    return n / parts + (i < n % parts ? 1 : 0);
+}
+
+int part_start(int n, int parts, int i) {
+    return i * (n / parts) + (i < n % parts ? i : n % parts);
+}
+
+int part_owner(int n, int parts, int index) {
+    int q = n / parts, r = n % parts;
+    if (index < r * (q + 1)) {
+        return index / (q + 1);
+    }
+    return r + (index - r * (q + 1)) / q;
+}
+
+// 2.5D Cannon: p = q * q * c ranks form a q x q x c grid. Layer 0 (the one
+// holding world rank 0) receives A and B and broadcasts them to the other
+// layers; layer l then runs its share of the q Cannon steps starting from
+// step offset part_start(q, c, l), and the partial C blocks are summed back
+// onto layer 0. With c = 1 this is plain Cannon. Each extra layer costs a
+// copy of A, B and C per rank and cuts the shift volume by c.
 void cannon_algorithm(double *A, double *B, double *C, int N, 
-                      int rank, int size) {
-    int shift = (int)sqrt(size);
-    if (shift * shift != size) {
+                      int rank, int size, const struct MatmulConfig *config,
+                      struct MatmulStats *stats) {
+    int depth = config->replication > 0 ? config->replication : 1;
+    int shift = (int)sqrt(size / depth);
+    if (size % depth != 0 || shift * shift * depth != size) {
         if (rank == 0) {
-            fprintf(stderr, "error: number of processes must be "
-                    "perfect square\n");
+            fprintf(stderr, "error: number of processes divided by the "
+                    "replication factor must be perfect square\n");
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if (depth > shift) {
+        if (rank == 0) {
+            fprintf(stderr, "error: replication factor must not exceed "
+                    "grid dimension %d\n", shift);
         }
         MPI_Abort(MPI_COMM_WORLD, 1);
     }
@@ -45,15 +311,30 @@ void cannon_algorithm(double *A, double *B, double *C, int N,
     int block_sz = N / shift;
     int block_elements = block_sz * block_sz;
 
-    MPI_Comm cart_comm;
-    int shifts[2] = {shift, shift};
-    int periods[2] = {1, 1};
-    MPI_Cart_create(MPI_COMM_WORLD, 2, shifts, periods, 1, &cart_comm);
+    MPI_Comm grid_comm;
+    int dims[3] = {shift, shift, depth};
+    int grid_periods[3] = {1, 1, 0};
+    MPI_Cart_create(MPI_COMM_WORLD, 3, dims, grid_periods, 1, &grid_comm);
 
-    int coords[2];
-    MPI_Cart_coords(cart_comm, rank, 2, coords);
+    int grid_rank;
+    MPI_Comm_rank(grid_comm, &grid_rank);
+    int coords[3];
+    MPI_Cart_coords(grid_comm, grid_rank, 3, coords);
     int row = coords[0];
     int col = coords[1];
+    int layer = coords[2];
+
+    // cart_comm is this rank's q x q layer (still periodic), depth_comm the
+    // c ranks holding the same block in every layer (rank = layer)
+    MPI_Comm cart_comm, depth_comm;
+    int keep_layer[3] = {1, 1, 0};
+    int keep_depth[3] = {0, 0, 1};
+    MPI_Cart_sub(grid_comm, keep_layer, &cart_comm);
+    MPI_Cart_sub(grid_comm, keep_depth, &depth_comm);
+
+    int home_layer = layer;
+    MPI_Bcast(&home_layer, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    int home = layer == home_layer;
 
     double *local_A = (double*)malloc(block_elements * sizeof(double));
     double *local_B = (double*)malloc(block_elements * sizeof(double));
@@ -63,132 +344,421 @@ void cannon_algorithm(double *A, double *B, double *C, int N,
         fprintf(stderr, "error: memory allocation failed on rank %d\n", rank);
         MPI_Abort(MPI_COMM_WORLD, 1);
     }
-    if (rank == 0) {
-        for (int proc_row = 0; proc_row < shift; proc_row++) {
-            for (int proc_col = 0; proc_col < shift; proc_col++) {
-                double *block_A = (double*)malloc(block_elements * 
-                                                   sizeof(double));
-                double *block_B = (double*)malloc(block_elements * 
-                                                   sizeof(double));
-                for (int i = 0; i < block_sz; i++) {
-                    for (int j = 0; j < block_sz; j++) {
-                        int global_row = proc_row * block_sz + i;
-                        int global_col = proc_col * block_sz + j;
-                        block_A[i * block_sz + j] = 
-                            A[global_row * N + global_col];
-                    }
-                }
-                for (int i = 0; i < block_sz; i++) {
-                    for (int j = 0; j < block_sz; j++) {
-                        int global_row = proc_row * block_sz + i;
-                        int global_col = proc_col * block_sz + j;
-                        block_B[i * block_sz + j] = 
-                            B[global_row * N + global_col];
-                    }
-                }
-                if (proc_row == 0 && proc_col == 0) {
-                    memcpy(local_A, block_A, block_elements * sizeof(double));
-                    memcpy(local_B, block_B, block_elements * sizeof(double));
-                } else {
-                    int dest_rank;
-                    int dest_coords[2] = {proc_row, proc_col};
-                    MPI_Cart_rank(cart_comm, dest_coords, &dest_rank);
-                    MPI_Send(block_A, block_elements, MPI_DOUBLE, 
-                             dest_rank, 0, cart_comm);
-                    MPI_Send(block_B, block_elements, MPI_DOUBLE, 
-                             dest_rank, 1, cart_comm);
-                }
 
-                free(block_A);
-                free(block_B);
-            }
-        }
+    // One block of the N x N matrix, resized so that consecutive
+    // displacements step by one block width
+    MPI_Datatype block_type = create_block_type(N, block_sz);
+    int layer_size = shift * shift;
+    int *counts = (int*)malloc(layer_size * sizeof(int));
+    int *displs = (int*)malloc(layer_size * sizeof(int));
+    build_block_displacements(cart_comm, N, counts, displs);
+    int root = home ? world_root_rank(cart_comm) : 0;
+
+    phase_start(&stats->phases, PHASE_DISTRIBUTE);
+    if (config->local_init) {
+        // every layer builds its own copy, nothing to replicate
+        fill_block(local_A, block_sz, block_sz, row * block_sz,
+                   col * block_sz, N, config->seed, RNG_STREAM_MATRIX_A);
+        fill_block(local_B, block_sz, block_sz, row * block_sz,
+                   col * block_sz, N, config->seed, RNG_STREAM_MATRIX_B);
     } else {
-        MPI_Recv(local_A, block_elements, MPI_DOUBLE, 0, 0, 
-                 cart_comm, MPI_STATUS_IGNORE);
-        MPI_Recv(local_B, block_elements, MPI_DOUBLE, 0, 1, 
-                 cart_comm, MPI_STATUS_IGNORE);
+        if (home && config->input_a) {
+            read_input_blocks(cart_comm, local_A, local_B, block_sz,
+                              block_sz, row * block_sz, col * block_sz, N,
+                              config, stats);
+        } else if (home) {
+            MPI_Scatterv(A, counts, displs, block_type, local_A,
+                         block_elements, MPI_DOUBLE, root, cart_comm);
+            MPI_Scatterv(B, counts, displs, block_type, local_B,
+                         block_elements, MPI_DOUBLE, root, cart_comm);
+        }
+        if (depth > 1) {
+            phase_start(&stats->phases, PHASE_BROADCAST);
+            MPI_Bcast(local_A, block_elements, MPI_DOUBLE, home_layer,
+                      depth_comm);
+            MPI_Bcast(local_B, block_elements, MPI_DOUBLE, home_layer,
+                      depth_comm);
+            phase_stop(&stats->phases, PHASE_BROADCAST);
+        }
     }
+    phase_stop(&stats->phases, PHASE_DISTRIBUTE);
+    if (home) {
+        save_input_blocks(cart_comm, local_A, local_B, block_sz, block_sz,
+                          row * block_sz, col * block_sz, N, config, stats);
+    }
+
+    // Layers are numbered from the home layer so that the split of the
+    // steps does not depend on where world rank 0 landed
+    int layer_index = (layer - home_layer + depth) % depth;
+    int first_step = part_start(shift, depth, layer_index);
+    int steps = part_size(shift, depth, layer_index);
 
+    phase_start(&stats->phases, PHASE_SKEW);
     int left_rank, right_rank;
-    MPI_Cart_shift(cart_comm, 1, -row, &right_rank, &left_rank);
+    MPI_Cart_shift(cart_comm, 1, -(row + first_step), &right_rank,
+                   &left_rank);
     MPI_Sendrecv_replace(local_A, block_elements, MPI_DOUBLE, 
                          left_rank, 0, right_rank, 0, 
                          cart_comm, MPI_STATUS_IGNORE);
 
     int up_rank, down_rank;
-    MPI_Cart_shift(cart_comm, 0, -col, &down_rank, &up_rank);
+    MPI_Cart_shift(cart_comm, 0, -(col + first_step), &down_rank, &up_rank);
     MPI_Sendrecv_replace(local_B, block_elements, MPI_DOUBLE, 
                          up_rank, 0, down_rank, 0, 
                          cart_comm, MPI_STATUS_IGNORE);
 
-    for (int step = 0; step < shift; step++) {
-        matrix_multiply_block(local_A, local_B, local_C, block_sz);
+    phase_stop(&stats->phases, PHASE_SKEW);
 
-        MPI_Cart_shift(cart_comm, 1, -1, &right_rank, &left_rank);
-        MPI_Sendrecv_replace(local_A, block_elements, MPI_DOUBLE, 
-                             left_rank, 0, right_rank, 0, 
-                             cart_comm, MPI_STATUS_IGNORE);
+    if (config->pipeline) {
+        cannon_steps_pipelined(cart_comm, &local_A, &local_B, local_C,
+                               block_sz, steps, config, stats);
+    } else {
+        cannon_steps_blocking(cart_comm, local_A, local_B, local_C,
+                              block_sz, steps, config, stats);
+    }
 
-        MPI_Cart_shift(cart_comm, 0, -1, &down_rank, &up_rank);
-        MPI_Sendrecv_replace(local_B, block_elements, MPI_DOUBLE, 
-                             up_rank, 0, down_rank, 0, 
-                             cart_comm, MPI_STATUS_IGNORE);
+    if (depth > 1) {
+        phase_start(&stats->phases, PHASE_REDUCE);
+        if (home) {
+            MPI_Reduce(MPI_IN_PLACE, local_C, block_elements, MPI_DOUBLE,
+                       MPI_SUM, home_layer, depth_comm);
+        } else {
+            MPI_Reduce(local_C, NULL, block_elements, MPI_DOUBLE, MPI_SUM,
+                       home_layer, depth_comm);
+        }
+        phase_stop(&stats->phases, PHASE_REDUCE);
+    }
+
+    phase_start(&stats->phases, PHASE_GATHER);
+    if (config->gather && home) {
+        MPI_Gatherv(local_C, block_elements, MPI_DOUBLE, C, counts, displs,
+                    block_type, root, cart_comm);
+    }
+    phase_stop(&stats->phases, PHASE_GATHER);
+
+    if (config->output && home) {
+        matio_write_block(cart_comm, config->output, MATIO_FLOAT64, N, N,
+                          row * block_sz, col * block_sz, block_sz, block_sz,
+                          local_C, MPI_DOUBLE, block_elements,
+                          &stats->write_io);
+    }
+
+    MPI_Type_free(&block_type);
+    free(counts);
+    free(displs);
+    free(local_A);
+    free(local_B);
+    free(local_C);
+    MPI_Comm_free(&cart_comm);
+    MPI_Comm_free(&depth_comm);
+    MPI_Comm_free(&grid_comm);
+}
+
+// Root-side types for the (possibly ragged) block of every rank of a
+// p_row x p_col grid over an N x N matrix. Empty blocks get count 0.
+void build_grid_block_types(MPI_Comm grid_comm, int N, int p_row, int p_col,
+                            int *counts, MPI_Datatype *types) {
+    int size;
+    MPI_Comm_size(grid_comm, &size);
+    for (int r = 0; r < size; r++) {
+        int coords[2];
+        MPI_Cart_coords(grid_comm, r, 2, coords);
+        int sizes[2] = {N, N};
+        int subsizes[2] = {part_size(N, p_row, coords[0]),
+                           part_size(N, p_col, coords[1])};
+        int starts[2] = {part_start(N, p_row, coords[0]),
+                         part_start(N, p_col, coords[1])};
+        if (subsizes[0] == 0 || subsizes[1] == 0) {
+            counts[r] = 0;
+            types[r] = MPI_DOUBLE;
+            continue;
+        }
+        counts[r] = 1;
+        MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C,
+                                 MPI_DOUBLE, &types[r]);
+        MPI_Type_commit(&types[r]);
+    }
+}
+
+// Scatters (to_blocks) or gathers the root's full matrix to/from every
+// rank's contiguous local block. Blocks differ in shape, so this is an
+// MPI_Alltoallw in which only the root sends (or receives) anything.
+void exchange_grid_blocks(double *full, double *local, int local_elements,
+                          int root, int to_blocks, MPI_Comm grid_comm,
+                          int *counts, MPI_Datatype *types) {
+    int size, rank;
+    MPI_Comm_size(grid_comm, &size);
+    MPI_Comm_rank(grid_comm, &rank);
+
+    int *zero_counts = (int*)calloc(size, sizeof(int));
+    int *zero_displs = (int*)calloc(size, sizeof(int));
+    int *local_counts = (int*)calloc(size, sizeof(int));
+    MPI_Datatype *doubles = (MPI_Datatype*)malloc(size *
+                                                  sizeof(MPI_Datatype));
+    for (int r = 0; r < size; r++) {
+        doubles[r] = MPI_DOUBLE;
+    }
+    local_counts[root] = local_elements;
+
+    int *root_counts = rank == root ? counts : zero_counts;
+    MPI_Datatype *root_types = rank == root ? types : doubles;
+    if (to_blocks) {
+        MPI_Alltoallw(full, root_counts, zero_displs, root_types,
+                      local, local_counts, zero_displs, doubles, grid_comm);
+    } else {
+        MPI_Alltoallw(local, local_counts, zero_displs, doubles,
+                      full, root_counts, zero_displs, root_types, grid_comm);
+    }
+
+    free(zero_counts);
+    free(zero_displs);
+    free(local_counts);
+    free(doubles);
+}
+
+// SUMMA on any p_row x p_col grid: A, B and C use the same ragged 2D block
+// layout. For each panel of k, the owning process column broadcasts its
+// columns of A along process rows and the owning process row broadcasts
+// its rows of B along process columns; every rank then adds the panel
+// product into its block of C. Panels never cross an owner boundary of
+// either A's columns or B's rows.
+void summa_algorithm(double *A, double *B, double *C, int N,
+                     int rank, int size, const struct MatmulConfig *config,
+                     struct MatmulStats *stats) {
+    int dims[2] = {0, 0};
+    MPI_Dims_create(size, 2, dims);
+    int p_row = dims[0], p_col = dims[1];
+
+    MPI_Comm grid_comm;
+    int periods[2] = {0, 0};
+    MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 1, &grid_comm);
+
+    int grid_rank;
+    MPI_Comm_rank(grid_comm, &grid_rank);
+    int coords[2];
+    MPI_Cart_coords(grid_comm, grid_rank, 2, coords);
+
+    // row_comm spans a process row (rank = column coordinate),
+    // col_comm spans a process column (rank = row coordinate)
+    MPI_Comm row_comm, col_comm;
+    int keep_cols[2] = {0, 1};
+    int keep_rows[2] = {1, 0};
+    MPI_Cart_sub(grid_comm, keep_cols, &row_comm);
+    MPI_Cart_sub(grid_comm, keep_rows, &col_comm);
+
+    int rows = part_size(N, p_row, coords[0]);
+    int cols = part_size(N, p_col, coords[1]);
+    int row0 = part_start(N, p_row, coords[0]);
+    int col0 = part_start(N, p_col, coords[1]);
+
+    double *local_A = (double*)malloc((size_t)rows * cols * sizeof(double) + 1);
+    double *local_B = (double*)malloc((size_t)rows * cols * sizeof(double) + 1);
+    double *local_C = (double*)calloc((size_t)rows * cols + 1, sizeof(double));
+    int panel = config->panel > 0 ? config->panel : 64;
+    double *panel_A = (double*)malloc((size_t)rows * panel * sizeof(double) + 1);
+    double *panel_B = (double*)malloc((size_t)panel * cols * sizeof(double) + 1);
+
+    if (!local_A || !local_B || !local_C || !panel_A || !panel_B) {
+        fprintf(stderr, "error: memory allocation failed on rank %d\n", rank);
+        MPI_Abort(MPI_COMM_WORLD, 1);
     }
 
-    if (rank == 0) {
-        for (int i = 0; i < block_sz; i++) {
-            for (int j = 0; j < block_sz; j++) {
-                C[i * N + j] = local_C[i * block_sz + j];
+    int *counts = (int*)malloc(size * sizeof(int));
+    MPI_Datatype *types = (MPI_Datatype*)malloc(size * sizeof(MPI_Datatype));
+    build_grid_block_types(grid_comm, N, p_row, p_col, counts, types);
+    int root = world_root_rank(grid_comm);
+
+    phase_start(&stats->phases, PHASE_DISTRIBUTE);
+    if (config->local_init) {
+        fill_block(local_A, rows, cols, row0, col0, N, config->seed,
+                   RNG_STREAM_MATRIX_A);
+        fill_block(local_B, rows, cols, row0, col0, N, config->seed,
+                   RNG_STREAM_MATRIX_B);
+    } else if (config->input_a) {
+        read_input_blocks(grid_comm, local_A, local_B, rows, cols, row0, col0,
+                          N, config, stats);
+    } else {
+        exchange_grid_blocks(A, local_A, rows * cols, root, 1, grid_comm,
+                             counts, types);
+        exchange_grid_blocks(B, local_B, rows * cols, root, 1, grid_comm,
+                             counts, types);
+    }
+    phase_stop(&stats->phases, PHASE_DISTRIBUTE);
+    save_input_blocks(grid_comm, local_A, local_B, rows, cols, row0, col0, N,
+                      config, stats);
+
+    for (int k = 0; k < N;) {
+        int owner_col = part_owner(N, p_col, k);
+        int owner_row = part_owner(N, p_row, k);
+        int width = panel;
+        int a_end = part_start(N, p_col, owner_col) +
+                    part_size(N, p_col, owner_col);
+        int b_end = part_start(N, p_row, owner_row) +
+                    part_size(N, p_row, owner_row);
+        if (width > a_end - k) width = a_end - k;
+        if (width > b_end - k) width = b_end - k;
+
+        phase_start(&stats->phases, PHASE_BROADCAST);
+        if (coords[1] == owner_col) {
+            int offset = k - col0;
+            for (int i = 0; i < rows; i++) {
+                memcpy(panel_A + i * width, local_A + i * cols + offset,
+                       width * sizeof(double));
             }
         }
-        for (int proc_row = 0; proc_row < shift; proc_row++) {
-            for (int proc_col = 0; proc_col < shift; proc_col++) {
-                if (proc_row == 0 && proc_col == 0) continue;
-
-                int src_coords[2] = {proc_row, proc_col};
-                int src_rank;
-                MPI_Cart_rank(cart_comm, src_coords, &src_rank);
-
-                double *recv_block = (double*)malloc(block_elements * 
-                                                      sizeof(double));
-                MPI_Recv(recv_block, block_elements, MPI_DOUBLE, 
-                         src_rank, 2, cart_comm, MPI_STATUS_IGNORE);
-
-                for (int i = 0; i < block_sz; i++) {
-                    for (int j = 0; j < block_sz; j++) {
-                        int global_row = proc_row * block_sz + i;
-                        int global_col = proc_col * block_sz + j;
-                        C[global_row * N + global_col] = 
-                            recv_block[i * block_sz + j];
+        MPI_Bcast(panel_A, rows * width, MPI_DOUBLE, owner_col, row_comm);
+
+        if (coords[0] == owner_row) {
+            memcpy(panel_B, local_B + (size_t)(k - row0) * cols,
+                   (size_t)width * cols * sizeof(double));
+        }
+        MPI_Bcast(panel_B, width * cols, MPI_DOUBLE, owner_row, col_comm);
+        phase_stop(&stats->phases, PHASE_BROADCAST);
+
+        phase_start(&stats->phases, PHASE_COMPUTE);
+        if (rows > 0 && cols > 0) {
+            if (config->gemm) {
+                gemm(config->gemm, rows, cols, width, panel_A, width,
+                     panel_B, cols, local_C, cols);
+            } else {
+                for (int i = 0; i < rows; i++) {
+                    for (int j = 0; j < cols; j++) {
+                        for (int p = 0; p < width; p++) {
+                            local_C[i * cols + j] += panel_A[i * width + p] *
+                                                     panel_B[p * cols + j];
+                        }
                     }
                 }
-
-                free(recv_block);
             }
         }
-    } else {
-        MPI_Send(local_C, block_elements, MPI_DOUBLE, 0, 2, cart_comm);
+        phase_stop(&stats->phases, PHASE_COMPUTE);
+        stats->flops += 2.0 * rows * cols * width;
+        phase_work(&stats->phases, PHASE_COMPUTE, 2.0 * rows * cols * width,
+                   ((double)rows * width + (double)width * cols + 2.0 * rows * cols) * sizeof(double));
+
+        k += width;
+    }
+
+    phase_start(&stats->phases, PHASE_GATHER);
+    if (config->gather) {
+        exchange_grid_blocks(C, local_C, rows * cols, root, 0, grid_comm,
+                             counts, types);
     }
+    phase_stop(&stats->phases, PHASE_GATHER);
 
+    if (config->output) {
+        matio_write_block(grid_comm, config->output, MATIO_FLOAT64, N, N, row0,
+                          col0, rows, cols, local_C, MPI_DOUBLE, rows * cols,
+                          &stats->write_io);
+    }
+
+    for (int r = 0; r < size; r++) {
+        if (counts[r] > 0) {
+            MPI_Type_free(&types[r]);
+        }
+    }
+    free(counts);
+    free(types);
     free(local_A);
     free(local_B);
     free(local_C);
-    MPI_Comm_free(&cart_comm);
+    free(panel_A);
+    free(panel_B);
+    MPI_Comm_free(&row_comm);
+    MPI_Comm_free(&col_comm);
+    MPI_Comm_free(&grid_comm);
+}
+
+// Strassen-Winograd against the classical kernel on one block of the run's
+// size, with inputs in [-1, 1) (the run's small integers multiply exactly
+// either way): the best of three times of each and the largest difference
+// relative to the largest entry of the classical C
+void strassen_report(const struct MatmulConfig *config, int block_sz) {
+    size_t elements = (size_t)block_sz * block_sz;
+    double *A = gemmAlloc(elements), *B = gemmAlloc(elements);
+    double *classical = gemmAlloc(elements), *strassen = gemmAlloc(elements);
+    uint32_t *words = (uint32_t*)malloc(elements * sizeof(uint32_t));
+    philox_words(config->seed, RNG_STREAM_STRASSEN_A, 0, words, elements);
+    for (size_t i = 0; i < elements; i++) {
+        A[i] = words[i] / 2147483648.0 - 1.0;
+    }
+    philox_words(config->seed, RNG_STREAM_STRASSEN_B, 0, words, elements);
+    for (size_t i = 0; i < elements; i++) {
+        B[i] = words[i] / 2147483648.0 - 1.0;
+    }
+
+    double classical_time = 0.0, strassen_time = 0.0;
+    for (int run = 0; run < 3; run++) {
+        memset(classical, 0, elements * sizeof(double));
+        memset(strassen, 0, elements * sizeof(double));
+        double start = MPI_Wtime();
+        gemm(config->gemm, block_sz, block_sz, block_sz, A, block_sz, B,
+             block_sz, classical, block_sz);
+        double middle = MPI_Wtime();
+        gemmStrassen(config->gemm, block_sz, A, block_sz, B, block_sz,
+                     strassen, block_sz, config->strassen_cutoff,
+                     config->strassen_work);
+        double end = MPI_Wtime();
+        if (run == 0 || middle - start < classical_time) {
+            classical_time = middle - start;
+        }
+        if (run == 0 || end - middle < strassen_time) {
+            strassen_time = end - middle;
+        }
+    }
+
+    double max_error = 0.0, max_entry = 0.0;
+    for (size_t i = 0; i < elements; i++) {
+        max_error = fmax(max_error, fabs(strassen[i] - classical[i]));
+        max_entry = fmax(max_entry, fabs(classical[i]));
+    }
+    printf("strassen: cutoff %d, %d levels on %d x %d blocks, %.6f s vs "
+           "%.6f s classical (speedup %.2f), max error %.3e\n",
+           config->strassen_cutoff,
+           gemmStrassenLevels(block_sz, config->strassen_cutoff), block_sz,
+           block_sz, strassen_time, classical_time,
+           classical_time / strassen_time,
+           max_entry > 0 ? max_error / max_entry : max_error);
+
+    free(words);
+    free(A);
+    free(B);
+    free(classical);
+    free(strassen);
+}
+
+// Recomputes a few entries of C = A * B directly
+double check_product(double *A, double *B, double *C, int N) {
+    double max_error = 0.0;
+    for (int sample = 0; sample < 16; sample++) {
+        int i = (int)((long long)sample * 7919 % N);
+        int j = (int)((long long)sample * 104729 % N);
+        double expected = 0.0;
+        for (int k = 0; k < N; k++) {
+            expected += A[i * N + k] * B[k * N + j];
+        }
+        double error = fabs(C[i * N + j] - expected) /
+                       (fabs(expected) > 1.0 ? fabs(expected) : 1.0);
+        if (error > max_error) {
+            max_error = error;
+        }
+    }
+    return max_error;
 }
 
 int main(int argc, char *argv[]) {
     int comm_sz;
     int my_rank;
 
-    MPI_Init(&argc, &argv);
+    hybrid_init(&argc, &argv);
     MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
     MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    counters_open(argc, argv, MPI_COMM_WORLD);
 
     int N = 8;
     
-    if (argc > 1) {
-        N = atoi(argv[1]);
+    if (arg_positional(argc, argv, 0)) {
+        N = atoi(arg_positional(argc, argv, 0));
         if (N <= 0) {
             if (my_rank == 0) {
                 fprintf(stderr, "error: invalid matrix size\n");
@@ -198,13 +768,124 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    int grid_dim = (int)sqrt(comm_sz);
-    if (grid_dim * grid_dim != comm_sz) {
+    // Float64 matrix files replace the generated inputs; N comes from them
+    const char *input_a = arg_string(argc, argv, "input-a", NULL);
+    const char *input_b = arg_string(argc, argv, "input-b", NULL);
+    if (!input_a != !input_b) {
+        if (my_rank == 0) {
+            fprintf(stderr, "error: --input-a and --input-b go together\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    if (input_a) {
+        struct MatioHeader header_a, header_b;
+        if (matio_read_header(MPI_COMM_WORLD, input_a, MATIO_FLOAT64,
+                              &header_a) ||
+            matio_read_header(MPI_COMM_WORLD, input_b, MATIO_FLOAT64,
+                              &header_b)) {
+            MPI_Finalize();
+            return 1;
+        }
+        if (header_a.rows != header_a.cols || header_b.rows != header_a.rows ||
+            header_b.cols != header_a.cols) {
+            if (my_rank == 0) {
+                fprintf(stderr, "error: input matrices must be square and "
+                        "of the same size\n");
+            }
+            MPI_Finalize();
+            return 1;
+        }
+        N = (int)header_a.rows;
+    }
+
+    const char *algorithm = arg_string(argc, argv, "algo", "cannon");
+    int use_summa = strcmp(algorithm, "summa") == 0;
+    if (!use_summa && strcmp(algorithm, "cannon") != 0) {
+        if (my_rank == 0) {
+            fprintf(stderr, "error: unknown algorithm '%s' "
+                    "(cannon, summa)\n", algorithm);
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    int replication = (int)arg_long(argc, argv, "replication", 1);
+    int layer_sz = replication > 0 ? comm_sz / replication : 0;
+    int grid_dim = (int)sqrt(layer_sz);
+    if (!use_summa && (replication <= 0 || layer_sz * replication != comm_sz ||
+                       grid_dim * grid_dim != layer_sz)) {
         if (my_rank == 0) {
             fprintf(stderr, "error: number of processes must be "
-                    "perfect square\n");
-            fprintf(stderr, "current processes: %d\n", comm_sz);
-            fprintf(stderr, "valid options: 1, 4, 9, 16, 25, 36, 49, 64...\n");
+                    "c * q * q (c = --replication, default 1)\n");
+            fprintf(stderr, "current processes: %d, replication: %d\n",
+                    comm_sz, replication);
+            fprintf(stderr, "valid options for c = 1: "
+                    "1, 4, 9, 16, 25, 36, 49, 64...\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+
+    struct MatmulConfig config = {0};
+    const char *gemm_isa = arg_string(argc, argv, "gemm", "auto");
+    if (strcmp(gemm_isa, "naive") != 0) {
+        config.gemm = gemmSelectKernel(gemm_isa);
+        if (!config.gemm) {
+            if (my_rank == 0) {
+                fprintf(stderr, "error: gemm kernel '%s' is not supported "
+                        "on this machine\n", gemm_isa);
+            }
+            MPI_Finalize();
+            return 1;
+        }
+    }
+    config.strassen_cutoff = (int)arg_long(argc, argv, "strassen-cutoff", 0);
+    if (config.strassen_cutoff < 0) {
+        if (my_rank == 0) {
+            fprintf(stderr, "error: --strassen-cutoff must be >= 0\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    if (config.strassen_cutoff > 0 && (use_summa || !config.gemm)) {
+        if (my_rank == 0) {
+            fprintf(stderr, "error: --strassen-cutoff works on Cannon blocks "
+                    "with a packed gemm kernel (not summa or --gemm=naive)\n");
+        }
+        MPI_Finalize();
+        return 1;
+    }
+    int block_sz = use_summa ? 0 : N / grid_dim;
+    if (config.strassen_cutoff > 0) {
+        config.strassen_work = gemmAlloc(
+            gemmStrassenWorkspace(config.gemm, block_sz,
+                                  config.strassen_cutoff));
+    }
+    config.pipeline = arg_flag(argc, argv, "pipeline");
+    config.panel = (int)arg_long(argc, argv, "panel", 64);
+    config.replication = replication;
+    config.input_a = input_a;
+    config.input_b = input_b;
+    config.save_a = arg_string(argc, argv, "save-a", NULL);
+    config.save_b = arg_string(argc, argv, "save-b", NULL);
+    config.output = arg_string(argc, argv, "output", NULL);
+    config.local_init = !input_a &&
+                        strcmp(arg_string(argc, argv, "generate", "root"),
+                               "local") == 0;
+    config.seed = (uint64_t)arg_long(argc, argv, "seed", 1);
+    int check = arg_flag(argc, argv, "check");
+    // Without a root-side input there is nothing to collect C for, unless
+    // the result is checked
+    config.gather = (!config.local_init && !input_a) || check;
+    const char *source = input_a ? "file" :
+                         config.local_init ? "local" : "root";
+    struct MatmulStats stats = {0};
+    struct Reps reps;
+    if (!reps_init(&reps, argc, argv, &stats.phases, MPI_COMM_WORLD)) {
+        if (my_rank == 0) {
+            fprintf(stderr, "error: --reps must be at least 1 and --warmup "
+                    "at least 0\n");
         }
         MPI_Finalize();
         return 1;
@@ -212,7 +893,8 @@ int main(int argc, char *argv[]) {
 
     double *A = NULL, *B = NULL, *C = NULL;
 
-    if (my_rank == 0) {
+    double init_start = MPI_Wtime();
+    if (my_rank == 0 && config.gather) {
         A = (double*)malloc(N * N * sizeof(double));
         B = (double*)malloc(N * N * sizeof(double));
         C = (double*)calloc(N * N, sizeof(double));
@@ -222,31 +904,84 @@ int main(int argc, char *argv[]) {
             MPI_Abort(MPI_COMM_WORLD, 1);
         }
 
-        srand(time(NULL));
-        initialize_matrix(A, N, rand());
-        initialize_matrix(B, N, rand());
+        if (input_a) {
+            // only for --check; the run itself reads per block
+            struct MatmulStats root_io = {0};
+            read_input_blocks(MPI_COMM_SELF, A, B, N, N, 0, 0, N, &config,
+                              &root_io);
+        } else {
+            initialize_matrix(A, N, config.seed, RNG_STREAM_MATRIX_A);
+            initialize_matrix(B, N, config.seed, RNG_STREAM_MATRIX_B);
+        }
     }
 
-    MPI_Barrier(MPI_COMM_WORLD);
-    double start_time = MPI_Wtime();
-
-    cannon_algorithm(A, B, C, N, my_rank, comm_sz);
+    double init_time = MPI_Wtime() - init_start;
 
-    double elapsed = MPI_Wtime() - start_time;
+    // Every rep distributes, multiplies and collects again
+    for (; reps_next(&reps); reps_stop(&reps)) {
+        if (use_summa) {
+            summa_algorithm(A, B, C, N, my_rank, comm_sz, &config, &stats);
+        } else {
+            cannon_algorithm(A, B, C, N, my_rank, comm_sz, &config, &stats);
+        }
+    }
 
-    double max_elapsed;
-    MPI_Reduce(&elapsed, &max_elapsed, 1, MPI_DOUBLE, MPI_MAX, 0, 
-               MPI_COMM_WORLD);
+    // The median rep; the flops and phases are per rep
+    double max_elapsed = reps_finish(&reps);
+    stats.flops /= reps.warmup + reps.reps;
     MPI_Barrier(MPI_COMM_WORLD);
 
+    double max_compute;
+    MPI_Reduce(&stats.phases.seconds[PHASE_COMPUTE], &max_compute, 1,
+               MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    char result[64], info[160];
+    snprintf(result, sizeof(result), "\"n\": %d, \"processes\": %d", N,
+             comm_sz);
+    snprintf(info, sizeof(info),
+             "\"algorithm\": \"%s\", \"replication\": %d, "
+             "\"pipeline\": %d, \"source\": \"%s\", \"strassen\": %d",
+             use_summa ? "summa" : "cannon", replication, config.pipeline,
+             source, config.strassen_cutoff);
+    phases_report("third", max_elapsed, result, info, &stats.phases,
+                  reps.max_seconds, reps.reps, MPI_COMM_WORLD);
+    if (my_rank == 0) {
+        // Local kernel rate is per rank, the total one is for the whole run
+        printf("gemm: %s, %.2f GFLOP/s per rank, %.2f GFLOP/s total\n",
+               config.gemm ? config.gemm->isa : "naive",
+               stats.flops / max_compute * 1e-9,
+               2.0 * N * N * N / max_elapsed * 1e-9);
+        if (config.strassen_cutoff > 0) {
+            strassen_report(&config, block_sz);
+        }
+    }
+    // Setup is the root-side fill (with --check also under --generate=local)
+    // plus the distribution of the blocks
+    setup_report(init_time + stats.phases.seconds[PHASE_DISTRIBUTE], source,
+                 MPI_COMM_WORLD);
+    if (input_a) {
+        matio_report("read A, B", &stats.read_io, MPI_COMM_WORLD);
+    }
+    if (config.save_a || config.save_b) {
+        matio_report("wrote inputs", &stats.save_io, MPI_COMM_WORLD);
+    }
+    if (config.output) {
+        matio_report("wrote C", &stats.write_io, MPI_COMM_WORLD);
+    }
+
     if (my_rank == 0) {
-        printf("|%d,%d,%f|\n", N, comm_sz, max_elapsed);
+        if (check) {
+            printf("check: max relative error %.3e\n",
+                   check_product(A, B, C, N));
+        }
 
         free(A);
         free(B);
         free(C);
     }
 
+    free(config.strassen_work);
+    reps_free(&reps);
     MPI_Finalize();
     return 0;
 }
\ No newline at end of file